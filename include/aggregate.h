@@ -0,0 +1,14 @@
+#pragma once
+
+#include "dataset.h"
+
+#include <string>
+#include <vector>
+
+// Writes the tables of scripts/aggregate_release_stats.py straight from
+// experiment results: <outRoot>/<dataset>/TIMINGS.csv, MIARY_STANDARD.csv,
+// MIARY_ZNORMALIZOWANE.csv and <outRoot>/REPORT.txt, with values rounded as
+// if read back from the STAT files. SUMMARY.json adds the balanced metrics.
+bool WriteAggregatedReport(const std::string& outRoot,
+                           std::vector<ExperimentSummary> summaries,
+                           std::string& err);
\ No newline at end of file
@@ -1,9 +1,13 @@
 #pragma once
 
+#include "consistency_cache.h"
 #include "dataset.h"
 #include "distance.h"
+#include "neighbor_cache.h"
 
+#include <cstdint>
 #include <string>
+#include <utility>
 #include <vector>
 
 bool SatisfiesGRule(const Dataset& ds,
@@ -13,6 +17,29 @@ bool SatisfiesGRule(const Dataset& ds,
                     const Instance& tst,
                     const Instance& trn);
 
+// g-rule of a (tst, trn) pair compiled into per-attribute acceptance tests.
+// Attributes that do not constrain the rule are left out and the remaining
+// terms are ordered from the most to the least selective.
+struct CompiledGRule {
+    struct Term {
+        int attr = -1;
+        bool nominal = false;
+        double lo = 0.0;                    // numeric: accepted interval [lo, hi]
+        double hi = 0.0;
+        std::vector<uint64_t> accepted;     // nominal: bitmask over dataset value codes
+        double selectivity = 1.0;           // estimated fraction of accepted values
+    };
+    std::vector<Term> terms;
+};
+
+CompiledGRule CompileGRule(const Dataset& ds,
+                           const Stats& stats,
+                           const DistanceConfig& cfg,
+                           const Instance& tst,
+                           const Instance& trn);
+
+bool SatisfiesGRule(const CompiledGRule& rule, const Instance& cand);
+
 bool IsConsistentGRule(const Dataset& ds,
                        const Stats& stats,
                        const DistanceConfig& cfg,
@@ -20,6 +47,71 @@ bool IsConsistentGRule(const Dataset& ds,
                        const Instance& trn,
                        const std::vector<int>& verifySet);
 
+// Per-test-object verification order for g-rule consistency checks.
+// The verify rows are kept once, nearest to the test object first; a rule of
+// class c visits only the rows of other classes, jumping over each run of
+// class-c rows in one step. Rows that broke recent rules are kept in a small
+// ring cache and tried before the scan.
+struct RuleVerifier {
+    static constexpr size_t kWitnessCacheSize = 8;
+
+    std::vector<int> order;                         // verify rows, nearest first
+    std::vector<int> orderClass;                    // position -> class index of its row
+    std::vector<int> nextOther;                     // position -> next position of another class (or size)
+    std::vector<std::pair<int, int>> witnesses;     // (row index, class index)
+    size_t nextWitness = 0;
+    size_t rules = 0;                               // rules verified
+    size_t checks = 0;                              // rows tested against those rules
+
+    // --zone-maps: scan ds.zones blocks instead of the ordered rows, skipping
+    // blocks of the rule's class only and blocks outside the rule's box.
+    const ZoneMaps* zones = nullptr;
+    std::vector<int> blockOrder;                    // blocks nearest to the test object first
+    std::vector<char> member;                       // row -> in the verify set
+};
+
+RuleVerifier BuildRuleVerifier(const Dataset& ds, const std::vector<Neighbor>& sortedVerifySet);
+
+// Exact verifier over the zone maps of ds for the verify set `rows` (test object = row x).
+RuleVerifier BuildZoneRuleVerifier(const Dataset& ds, const Stats& stats, size_t x, const std::vector<int>& rows);
+
+// Bounded verify set for --ria-approx: for every class, its `nearest` rows
+// closest to the test object plus `sample` random other rows of that class
+// (seeded, so runs are reproducible). nearest <= 0 means the exact verifier.
+struct RiaVerifyLimits {
+    int nearest = 0;
+    int sample = 0;
+    uint64_t seed = 0;
+};
+
+// Per-query limits for anytime classification (0 => unlimited). The ranking
+// compares the query with at most `distances` candidates (spread evenly over
+// the list); rules are verified nearest first until `ruleChecks` rules or
+// `timeMs` of wall time are used; k+NN out of time after its ranking votes
+// with the k nearest under the base stats, skipping the local SVDM. A query
+// that hits a limit decides from the votes gathered so far (its nearest
+// neighbor's class if none) and is marked ClassificationResult::partial; one
+// that does not is exact.
+struct QueryBudget {
+    double timeMs = 0.0;
+    size_t ruleChecks = 0;
+    size_t distances = 0;
+
+    bool Active() const { return timeMs > 0.0 || ruleChecks > 0 || distances > 0; }
+};
+
+RuleVerifier BuildSampledRuleVerifier(const Dataset& ds,
+                                      const std::vector<Neighbor>& sortedVerifySet,
+                                      const RiaVerifyLimits& limits,
+                                      uint64_t stream);
+
+bool IsConsistentGRule(const Dataset& ds,
+                       const Stats& stats,
+                       const DistanceConfig& cfg,
+                       const Instance& tst,
+                       const Instance& trn,
+                       RuleVerifier& verifier);
+
 std::vector<Neighbor> ComputeNeighbors(const Dataset& ds,
                                        const Stats& stats,
                                        const DistanceConfig& cfg,
@@ -40,18 +132,46 @@ ClassificationResult ClassifyKPlusNN(const Dataset& ds,
                                      const std::vector<int>& trainingIdx,
                                      int tstIdx,
                                      int k,
-                                     int nLocal);
+                                     int nLocal,
+                                     const std::vector<int>* neighborPool = nullptr,
+                                     const QueryBudget& budget = QueryBudget(),
+                                     NeighborCache* neighborCache = nullptr);
 
+// cache: exact RIA (limits.nearest <= 0) votes from the test object's row when
+// it is filled and fills it otherwise (not from a partial result).
 ClassificationResult ClassifyRIA(const Dataset& ds,
                                  const DistanceConfig& cfg,
                                  const Stats& stats,
                                  const std::vector<int>& trainingIdx,
                                  int tstIdx,
-                                 int kForReport);
+                                 int kForReport,
+                                 const RiaVerifyLimits& limits = RiaVerifyLimits(),
+                                 ConsistencyCache* cache = nullptr,
+                                 const QueryBudget& budget = QueryBudget());
 
+// neighborPool (e.g. LSH candidates) replaces trainingIdx as the rows the
+// neighborhood is taken from; class sizes still come from trainingIdx.
+// cache: filled by exact RIA under the same stats (rows not filled are checked).
+// neighborCache: lists ranked under the same stats with all other rows as
+// candidates (trainingIdx is every other row and there is no pool), read when
+// deep enough and stored on a miss; the same for step 1 of k+NN.
 ClassificationResult ClassifyRIONA(const Dataset& ds,
                                    const DistanceConfig& cfg,
                                    const Stats& stats,
                                    const std::vector<int>& trainingIdx,
                                    int tstIdx,
-                                   int k);
\ No newline at end of file
+                                   int k,
+                                   const std::vector<int>* neighborPool = nullptr,
+                                   const ConsistencyCache* cache = nullptr,
+                                   const QueryBudget& budget = QueryBudget(),
+                                   NeighborCache* neighborCache = nullptr);
+
+// RIONA for an object that is not a row of ds (e.g. a served query); its
+// nominal codes index ds.nominalValues, -1 for values ds has not seen.
+ClassificationResult ClassifyRIONA(const Dataset& ds,
+                                   const DistanceConfig& cfg,
+                                   const Stats& stats,
+                                   const std::vector<int>& trainingIdx,
+                                   const Instance& tst,
+                                   int k,
+                                   const QueryBudget& budget = QueryBudget());
\ No newline at end of file
@@ -0,0 +1,57 @@
+#pragma once
+
+#include "dataset.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Progress of one experiment cell (or shard of a cell).
+struct CheckpointState {
+    std::string cell;                  // experiment suffix, guards against mismatched files
+    uint64_t key = 0;                  // hash of the data and result-affecting options (CheckpointKey)
+    size_t begin = 0;                  // slice of test objects [begin, end)
+    size_t end = 0;
+    size_t done = 0;                   // rows [begin, done) are classified
+    bool complete = false;             // final files have been written
+    double timeClassifyMs = 0.0;       // classify time spent so far
+    size_t partial = 0;                // rows [begin, done) stopped by their --budget-*
+    double timeReadMs = 0.0;           // complete: read/prep/write times of the finishing run
+    double timePrepMs = 0.0;
+    double timeWriteMs = 0.0;
+    bool streaming = false;            // rows already on disk (--stream), no predictions saved
+    uint64_t outBytes = 0;             // streaming: OUT/kNN file sizes at `done`
+    uint64_t knnBytes = 0;
+    std::vector<std::vector<int>> confStd;   // confusion matrices of rows [begin, done)
+    std::vector<std::vector<int>> confNorm;
+    LatencyHistogram latency;          // latencies of rows [begin, done)
+    std::vector<SlowObject> slowest;   //   their slowest objects (--slow)
+    RiaApproxReport ria;               //   --ria-approx held-out counters
+    LshReport lsh;                     //   --lsh counters
+    size_t cacheHits = 0;              //   neighbor-cache lookups
+    size_t cacheMisses = 0;
+    size_t rowsDone = 0;               // not streaming: rows [begin, rowsDone) are in the rows file
+    uint64_t rowsBytes = 0;            //   which is valid up to this size
+};
+
+// Writes the state and (unless streaming) the predictions/neighbor lists of
+// rows [begin, done). Rows go to `path`.rows, which only gets the rows
+// [rowsDone, done) appended; the state is replaced atomically (a temporary
+// file, synced to disk, then renamed) and records how much of the rows file
+// is valid, so a crash between the two steps loses nothing.
+bool SaveCheckpoint(const std::string& path,
+                    const Dataset& ds,
+                    CheckpointState& state,
+                    const std::vector<std::string>& predStd,
+                    const std::vector<std::string>& predNorm,
+                    const std::vector<std::vector<Neighbor>>& knnLists,
+                    std::string& err);
+
+// Restores state and fills the first (done - begin) slots of the buffers.
+bool LoadCheckpoint(const std::string& path,
+                    const Dataset& ds,
+                    CheckpointState& state,
+                    std::vector<std::string>& predStd,
+                    std::vector<std::string>& predNorm,
+                    std::vector<std::vector<Neighbor>>& knnLists,
+                    std::string& err);
\ No newline at end of file
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+// Bit-packed n x n matrix: bit (tst, trn) is set when the g-rule of (tst, trn)
+// is consistent with all training rows of tst (leave-one-out, under the stats
+// of one mode). Exact RIA fills a row per test object; RIA for another k votes
+// from it, and RIONA skips rules already known to be consistent, since a rule
+// consistent with the training set is consistent with any neighborhood of it.
+// Workers fill disjoint rows; rows are read only by later experiments.
+class ConsistencyCache {
+public:
+    void Init(size_t rows);
+    static uint64_t BytesFor(size_t rows);
+
+    bool Has(size_t tst) const { return tst < filled.size() && filled[tst]; }
+    bool Consistent(size_t tst, size_t trn) const {
+        return (bits[tst * words + (trn >> 6)] >> (trn & 63)) & 1;
+    }
+    void Set(size_t tst, size_t trn) { bits[tst * words + (trn >> 6)] |= uint64_t(1) << (trn & 63); }
+    // Clears the row before it is filled again, then marks it complete.
+    void Clear(size_t tst);
+    void MarkFilled(size_t tst) { filled[tst] = 1; }
+
+private:
+    size_t words = 0;                       // 64-bit words per row
+    std::vector<uint64_t> bits;
+    std::vector<char> filled;
+};
\ No newline at end of file
@@ -1,15 +1,29 @@
 #pragma once
 
+#include "latency.h"
+
+#include <cstdint>
 #include <string>
 #include <unordered_map>
+#include <utility>
 #include <vector>
 
 enum class AttrType { Numeric, Nominal };
 
+// Per-attribute distance family (--metric). Attribute distances are summed.
+//   SVDM: numeric |a - b| / range, nominal SVDM (or SVDM') between values
+//   HEOM: numeric |a - b| / range, nominal overlap (0 if equal, else 1)
+//   IVDM: numeric values compared through interpolated class distributions, nominal SVDM
+enum class Metric { SVDM, HEOM, IVDM };
+
+// Storage used for candidate ranking (--precision). Exact distances stay double.
+enum class Precision { F64, F32, U16, U8 };
+
 // Represents a single attribute value (numeric or nominal) plus missing flag.
 struct AttributeValue {
     bool missing = false;
     double num = 0.0;          // valid when numeric and not missing
+    int code = -1;             // dataset-wide value code (nominal, not missing)
     std::string raw;           // original token (for output)
 };
 
@@ -20,6 +34,24 @@ struct Instance {
     std::string decision;                      // decision/class value
 };
 
+// --zone-maps: a visiting order of the rows (rows themselves keep their
+// indices) cut into blocks of kBlockRows, each summarized per attribute slot.
+struct ZoneMaps {
+    static constexpr size_t kBlockRows = 64;
+
+    std::vector<int> order;                    // position -> row
+    std::vector<int> classOf;                  // row -> decision index
+    std::vector<int> slotOf;                   // attribute -> numeric / nominal slot
+    std::vector<double> numMin;                // block * numeric slots -> min present value (NaN if none)
+    std::vector<double> numMax;                // block * numeric slots -> max present value (NaN if none)
+    std::vector<char> numMissing;              // block * numeric slots -> some row lacks the value
+    std::vector<uint64_t> nomMask;             // block * nominal slots -> bit (code % 64) of present codes
+    std::vector<char> nomMissing;              // block * nominal slots -> some row lacks the value
+    std::vector<uint64_t> classMask;           // block -> bit per class (all ones above 64 classes)
+
+    size_t Blocks() const { return (order.size() + kBlockRows - 1) / kBlockRows; }
+};
+
 // Encapsulates dataset along with attribute types and class label mapping.
 struct Dataset {
     std::vector<Instance> rows;
@@ -28,6 +60,29 @@ struct Dataset {
     std::vector<int> nominalIdx;               // indices of nominal attributes
     std::vector<std::string> decisionValues;   // unique decision values
     std::unordered_map<std::string, int> decisionIndex;
+    std::vector<std::vector<std::string>> nominalValues; // attr -> code -> value
+
+    // Compact columns for --precision f32|u16|u8, row-major over numericIdx / nominalIdx slots
+    // (u8: numeric as f32, nominal codes attribute-major in nomU8).
+    Precision precision = Precision::F64;
+    std::vector<float> numF32;                 // f32: value (NaN if missing)
+    std::vector<uint16_t> numU16;              // u16: (v - numLo) / numStep (0xFFFF if missing)
+    std::vector<double> numLo;                 // numeric slot -> dataset minimum
+    std::vector<double> numStep;               // numeric slot -> quantization step (u16)
+    std::vector<double> numAbsMax;             // numeric slot -> max |value| (f32 error bound)
+    std::vector<uint16_t> nomCodes;            // value code (dictionary size if missing)
+    std::vector<uint8_t> nomU8;                // u8: slot * rows + row -> value code + 1 (0 if missing)
+
+    // Flat columns read by the distance kernels, row-major over the same slots.
+    size_t kernelRows = 0;                     // rows covered (later rows use InstanceDistance)
+    std::vector<double> kernelNum;             // value (NaN if missing)
+    std::vector<int> kernelNom;                // value code + 1 (0 if missing)
+
+    // --dedup: rows with identical conditional attributes share a prototype (empty => off).
+    std::vector<int> prototypeOf;              // row -> prototype
+    size_t prototypeCount = 0;
+
+    ZoneMaps zones;                            // --zone-maps (empty => off)
 };
 
 // Statistics for numeric attributes (min/max/range).
@@ -42,20 +97,81 @@ struct NumericStat {
 struct NominalStat {
     std::vector<std::string> values;                         // index -> value
     std::unordered_map<std::string, int> index;              // value -> index
-    std::vector<std::vector<double>> dist;                   // SVDM distance matrix
+    std::vector<std::vector<double>> dist;                   // value distances (SVDM or overlap); empty on demand
+    std::vector<int> codeIndex;                              // dataset code -> index (-1 if absent)
+    bool onDemand = false;                                   // high cardinality: see ValueDistance
+    std::vector<double> prob;                                // on demand: index * classes + class -> P(class | value)
+    size_t classes = 0;                                      //   classes per prob row
+};
+
+// IVDM discretization of a numeric attribute: class distributions of equal-width
+// intervals, padded with an empty interval on each side, interpolated linearly
+// between interval midpoints.
+struct IvdmStat {
+    int intervals = 0;
+    double lo = 0.0;
+    double width = 0.0;                                      // 0 => attribute contributes nothing
+    std::vector<std::vector<double>> prob;                   // padded interval -> class -> P(c | interval)
+};
+
+struct DistanceKernel;
+
+// Distances from row x to rows[0..count) under one Stats, written to out.
+using DistanceBatchFn = void (*)(const Dataset& ds,
+                                 const DistanceKernel& kernel,
+                                 size_t x,
+                                 const int* rows,
+                                 size_t count,
+                                 double* out);
+
+// Branch-light form of a Stats for the dataset's kernel columns: the batch
+// function is chosen once per Stats for the metric and the attribute layout.
+struct DistanceKernel {
+    DistanceBatchFn batch = nullptr;                         // null => InstanceDistance only
+    std::vector<double> range;                               // numeric slot -> range (0 => term 0)
+    std::vector<IvdmStat> ivdm;                              // numeric slot -> IVDM stat (IVDM only)
+    std::vector<std::vector<double>> nomTable;               // nominal slot -> (codes+1)^2, 0 = missing
+    std::vector<size_t> nomWidth;                            // nominal slot -> codes + 1
+    std::vector<std::vector<double>> nomProb;                // on-demand slot -> (codes+1) x probStride, NaN = missing
+    std::vector<char> nomOnDemand;                           // nominal slot -> terms from nomProb, not nomTable
+    size_t probStride = 1;                                   // classes (at least 1)
+    double probScale = 1.0;                                  // 0.5 for SVDM'
+    bool overlap = false;                                    // HEOM: on-demand terms are 0 or 1
+    double missingNominal = 2.0;
+    std::vector<std::pair<bool, size_t>> runs;               // (nominal, slots) in attribute order
+    std::vector<int> slotOf;                                 // attribute -> numeric / nominal slot
+    double missingNumeric = 1.0;
+    double ivdmScale = 1.0;                                  // 0.5 for the primed variant
+};
+
+// Float32 distance tables matching Dataset's compact columns.
+struct CompactMetric {
+    std::vector<float> numWeight;                            // numeric slot -> factor for |a - b|
+    std::vector<std::vector<float>> nomTable;                // nominal slot -> (codes+1)^2 SVDM
+    float missingNumeric = 1.0f;
+    double errorBound = 0.0;                                 // max |compact - exact| distance
+    std::vector<int> slotOf;                                 // attribute -> numeric / nominal slot
+    std::vector<double> termErr;                             // term -> rounding error (numeric slots, then nominal)
+    std::vector<double> termMax;                             // term -> largest value
 };
 
 // Preprocessing result used for distance calculations.
 struct Stats {
     std::vector<NumericStat> numStats;                       // size = attributes
     std::vector<NominalStat> nomStats;                       // size = attributes
+    CompactMetric compact;                                   // filled unless precision is f64
+    std::vector<double> pairDist;                            // all row pairs (upper triangle) or empty
+    std::vector<IvdmStat> ivdm;                              // size = attributes (IVDM only)
+    DistanceKernel kernel;                                   // see BuildDistanceKernel
 };
 
 // Settings describing how distances are computed.
 struct DistanceConfig {
+    Metric metric = Metric::SVDM;
     bool svdmPrime = false;          // true => SVDM' (normalized), false => SVDM
     double missingNominal = 2.0;     // distance when nominal value missing
     double missingNumeric = 1.0;     // distance when numeric value missing
+    size_t denseValues = 1024;       // nominal attributes with more values compute SVDM on demand
 };
 
 // Neighbour used in kNN lists.
@@ -71,10 +187,74 @@ struct Config {
     std::string algo = "all";          // riona | ria | knn | all
     std::string mode = "g";            // g | l | both
     std::string svdm = "svdm";         // svdm | svdmprime
+    std::string metric = "svdm";       // svdm | heom | ivdm
     std::string missingToken = "?";
     std::string outDir = ".";
     std::vector<int> kValues;          // if empty => auto
     int nForKPlusNN = -1;              // if -1 => use training size
+    int shardIndex = 0;                // --shard i/N: classify only slice i (0-based)
+    int shardCount = 1;                //   of N contiguous slices of test objects
+    bool mergeShards = false;          // `riona merge`: combine shard outputs
+    double checkpointSec = 0.0;        // checkpoint period in seconds (0 => off)
+    bool resume = false;               // continue from existing checkpoints
+    bool stream = false;               // write OUT/kNN rows as they are classified
+    int threads = 1;                   // classification threads
+    std::string knnFormat = "csv";     // csv | bin | bin32 (float32 distances)
+    std::string traceFile;             // Chrome trace output (empty => off)
+    std::string precision;             // f64 | f32 | u16 | u8 (candidate ranking storage; empty => planner)
+    uint64_t memoryLimit = 2ull << 30; // planner memory budget in bytes
+    bool explainPlan = false;          // print the execution plan and stop
+    std::string forceStrategy;         // planner override, e.g. "matrix,exact"
+    bool riaApprox = false;            // RIA: bounded verify set instead of all rows
+    int riaNearest = 64;               //   nearest rows per class in the verify set
+    int riaSample = 64;                //   plus random rows per class
+    double riaHoldout = 0.05;          //   fraction also classified exactly (disagreement report)
+    int lshTables = 0;                 // RIONA/k+NN: LSH candidate tables (0 => exact)
+    int lshHashes = 4;                 //   hash functions per table
+    int lshProbes = 0;                 //   extra buckets probed per table
+    double lshWidth = 0.0;             //   bucket width (0 => auto)
+    double lshCheck = 0.05;            //   fraction also searched exactly (recall@k report)
+    bool dedup = false;                // collapse duplicate rows into weighted prototypes
+    bool zoneMaps = false;             // visit rows in blocks with min/max summaries
+    std::string neighborCacheDir;      // persistent neighbor lists (empty => off)
+    bool neighborCacheLocal = false;   //   also for local mode
+    size_t svdmDenseMax = 1024;        // values above which a nominal attribute has no SVDM matrix
+    size_t looSample = 0;              // class-stratified test objects per experiment (0 => all)
+    double budgetMs = 0.0;             // per-query wall time budget (0 => none)
+    size_t budgetRules = 0;            //   rules verified
+    size_t budgetDistances = 0;        //   candidates compared with the query
+    uint64_t seed = 1;                 // seed for sampled modes
+    int slowCount = 20;                // rows listed in SLOW_*.csv (0 => off)
+    std::string aggregateDir;          // batch: aggregated tables (empty => <outdir>/_aggregated)
+};
+
+// --ria-approx settings and the approximate-vs-exact comparison on held-out objects.
+struct RiaApproxReport {
+    int nearest = 0;
+    int sample = 0;
+    uint64_t seed = 0;
+    double holdout = 0.0;
+    size_t heldOut = 0;                // objects classified both ways
+    size_t disagreeStd = 0;            // different standard / normalized decision
+    size_t disagreeNorm = 0;
+    size_t exactCorrectStd = 0;        // correct decisions of each variant
+    size_t approxCorrectStd = 0;
+    size_t exactCorrectNorm = 0;
+    size_t approxCorrectNorm = 0;
+};
+
+// LSH candidate statistics of one experiment (--lsh).
+struct LshReport {
+    int tables = 0;
+    int hashes = 0;
+    int probes = 0;
+    double width = 0.0;
+    size_t queries = 0;                // objects searched through the index
+    size_t fallbacks = 0;              // too few candidates => exact search
+    size_t candidateSum = 0;
+    size_t checked = 0;                // objects also searched exactly
+    size_t exactNeighbors = 0;         // exact neighbors of those objects
+    size_t foundNeighbors = 0;         //   and how many the index returned (ties interchangeable)
 };
 
 // Classification output per instance
@@ -82,6 +262,13 @@ struct ClassificationResult {
     std::string predictedStandard;
     std::string predictedNormalized;
     std::vector<Neighbor> knnList;  // neighbors used in the algorithm
+    size_t ruleChecks = 0;          // g-rules verified (RIA/RIONA)
+    size_t consistencyChecks = 0;   // training rows tested against those rules
+    bool partial = false;           // stopped by its QueryBudget (best-effort decision)
+    uint64_t latencyNs = 0;         // wall time of the classification (set by the driver)
+    int cacheLookup = -1;           // neighbor cache consulted: 1 hit, 0 miss (-1 not consulted)
+    RiaApproxReport ria;            // --ria-approx / --lsh counters of this object (set by the
+    LshReport lsh;                  //   driver, added to the experiment's when it commits)
 };
 
 // Metrics per class
@@ -89,4 +276,57 @@ struct MetricsPerClass {
     double precision = 0.0;
     double recall = 0.0;
     double f1 = 0.0;
+};
+
+// One entry of the slowest-objects report.
+struct SlowObject {
+    size_t row = 0;
+    uint64_t latencyNs = 0;
+    size_t neighbors = 0;
+    size_t ruleChecks = 0;
+    size_t consistencyChecks = 0;
+};
+
+// Sampled leave-one-out (--loo-sample): test objects drawn per class.
+struct LooSampleReport {
+    size_t objects = 0;                // test objects classified
+    uint64_t seed = 0;
+    std::vector<int> drawn;            // class -> objects drawn
+    int replicates = 1000;             // bootstrap replicates of the balanced metrics
+};
+
+// Partial result of one shard of a leave-one-out experiment.
+struct ShardSummary {
+    int index = 0;
+    int count = 1;
+    size_t begin = 0;                  // classified rows [begin, end)
+    size_t end = 0;
+    double timeReadMs = 0.0;
+    double timePrepMs = 0.0;
+    double timeClassifyMs = 0.0;
+    double timeWriteMs = 0.0;
+    double timeTotalMs = 0.0;
+    std::vector<std::vector<int>> confStd;
+    std::vector<std::vector<int>> confNorm;
+    LatencyHistogram latency;          // per-object latencies of the shard
+    std::vector<SlowObject> slowest;   // its slowest objects (--slow), slowest first
+    size_t partial = 0;                // objects whose --budget-* ran out
+};
+
+// Metrics and timings of one finished experiment, collected for aggregated
+// reports (riona batch).
+struct ExperimentSummary {
+    std::string dataset;               // input file name without extension
+    std::string algorithm;
+    std::string mode;
+    std::string svdm;
+    int k = 0;
+    double timeReadMs = 0.0;
+    double timePrepMs = 0.0;
+    double timeClassifyMs = 0.0;
+    double timeWriteMs = 0.0;
+    double timeTotalMs = 0.0;
+    std::vector<std::string> classes;           // decision values
+    std::vector<MetricsPerClass> metricsStd;    // per class, standard decisions
+    std::vector<MetricsPerClass> metricsNorm;   // per class, normalized decisions
 };
\ No newline at end of file
@@ -2,6 +2,66 @@
 
 #include "dataset.h"
 
-Stats ComputeStats(const Dataset& ds, const std::vector<int>& indices, const DistanceConfig& distCfg);
+#include <cmath>
+#include <string>
+#include <utility>
+
+// weights (optional, parallel to indices): how many rows each index stands for.
+Stats ComputeStats(const Dataset& ds,
+                   const std::vector<int>& indices,
+                   const DistanceConfig& distCfg,
+                   const std::vector<int>* weights = nullptr);
 double NominalDistance(const NominalStat& ns, const std::string& a, const std::string& b, const DistanceConfig& cfg);
-double InstanceDistance(const Dataset& ds, const Stats& stats, const DistanceConfig& cfg, const Instance& x, const Instance& y);
\ No newline at end of file
+
+// Distance between present values i and j (stats indices) of a nominal
+// attribute. Attributes with more than cfg.denseValues dataset values keep
+// only P(class | value) and take the L1 between those rows here, term by term
+// as the dense matrix is filled, so both give the same doubles.
+inline double ValueDistance(const NominalStat& ns, int i, int j, const DistanceConfig& cfg) {
+    if (!ns.onDemand) {
+        return ns.dist[i][j];
+    }
+    if (cfg.metric == Metric::HEOM) {
+        return i == j ? 0.0 : 1.0;
+    }
+    const double* pi = ns.prob.data() + (size_t)i * ns.classes;
+    const double* pj = ns.prob.data() + (size_t)j * ns.classes;
+    double sum = 0.0;
+    for (size_t c = 0; c < ns.classes; ++c) {
+        sum += std::abs(pi[c] - pj[c]);
+    }
+    if (cfg.svdmPrime) {
+        sum *= 0.5;
+    }
+    return sum;
+}
+double InstanceDistance(const Dataset& ds, const Stats& stats, const DistanceConfig& cfg, const Instance& x, const Instance& y);
+
+// Float32 tables for the compact columns (filled by ComputeStats unless precision is f64).
+CompactMetric BuildCompactMetric(const Dataset& ds, const Stats& stats, const DistanceConfig& cfg);
+// Refresh stats.compact for one attribute after its stats changed, like
+// RefreshKernelAttribute: a numeric weight, or the row and column of `code`
+// in a nominal table (the whole table when the dictionary grew).
+void RefreshCompactAttribute(const Dataset& ds, Stats& stats, const DistanceConfig& cfg, int attr, int code);
+
+// Distances between all pairs of rows under stats, stored in stats.pairDist
+// (upper triangle, row-major) and split over `threads` workers.
+void BuildPairDistances(const Dataset& ds, Stats& stats, const DistanceConfig& cfg, int threads);
+// Entry of stats.pairDist for rows i and j of an n-row dataset.
+inline double PairDistance(const Stats& stats, size_t n, size_t i, size_t j) {
+    if (i == j) {
+        return 0.0;
+    }
+    if (i > j) {
+        std::swap(i, j);
+    }
+    return stats.pairDist[i * n - i * (i + 1) / 2 + (j - i - 1)];
+}
+
+// Fill the compact columns used for ranking with --precision f32|u16|u8.
+bool BuildCompactColumns(Dataset& ds, Precision precision, std::string& err);
+// Float32 distance between two rows over the compact columns; within
+// stats.compact.errorBound of InstanceDistance.
+float CompactDistance(const Dataset& ds, const CompactMetric& metric, size_t x, size_t y);
+// Numeric part of CompactDistance (u8 ranks nominal attributes with NominalQuery).
+float CompactNumericDistance(const Dataset& ds, const CompactMetric& metric, size_t x, size_t y);
\ No newline at end of file
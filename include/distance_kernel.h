@@ -0,0 +1,60 @@
+#pragma once
+
+#include "dataset.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+// Fill ds.kernelNum / ds.kernelNom from the parsed rows (after nominal codes).
+void BuildKernelColumns(Dataset& ds);
+// Append the kernel columns of a row added after BuildKernelColumns.
+void AppendKernelRow(Dataset& ds, size_t row);
+
+// Kernel tables for stats and the batch function specialized for
+// cfg.metric and the attribute layout (all numeric, all nominal, mixed).
+DistanceKernel BuildDistanceKernel(const Dataset& ds, const Stats& stats, const DistanceConfig& cfg);
+// Refresh the kernel entries of one attribute after its stats changed; for a
+// nominal attribute only the row and column of `code` (the whole table when
+// the dictionary grew).
+void RefreshKernelAttribute(const Dataset& ds, Stats& stats, const DistanceConfig& cfg, int attr, int code);
+
+// --precision u8: nominal distances from one query row as byte tables, one per
+// nominal slot, indexed by the u8 code (code + 1, 0 = missing) and padded to
+// 16-entry parts for in-register lookups. Entries are multiples of `step`.
+struct NominalQuery {
+    std::vector<uint8_t> tables;       // slot -> 16 * parts[slot] bytes from offset[slot]
+    std::vector<size_t> offset;
+    std::vector<uint8_t> parts;
+    double step = 0.0;
+    double errorBound = 0.0;           // max |step * sum - exact nominal part|
+};
+
+NominalQuery BuildNominalQuery(const Dataset& ds, const DistanceKernel& k, size_t row);
+// Quantized nominal sums of rows [first, first + count), 16 or 32 rows per
+// step with SSSE3/AVX2 when the CPU has them (same integers either way).
+void NominalSums(const Dataset& ds, const NominalQuery& q, size_t first, size_t count, uint16_t* out);
+uint16_t NominalSum(const Dataset& ds, const NominalQuery& q, size_t row);
+
+// P(class c | x) of an IVDM attribute, interpolated between interval midpoints.
+inline double IvdmProbability(const IvdmStat& iv, double x, size_t c) {
+    const double t = std::min((double)iv.intervals + 1.0, std::max(0.0, (x - iv.lo) / iv.width + 0.5));
+    const int j = std::min((int)t, iv.intervals);
+    const double f = t - (double)j;
+    return iv.prob[j][c] * (1.0 - f) + iv.prob[j + 1][c] * f;
+}
+
+// IVDM distance of two present numeric values: L1 between their interpolated
+// class distributions, times `scale` (0.5 for the primed variant).
+inline double IvdmTerm(const IvdmStat& iv, double x, double y, double scale) {
+    if (iv.width == 0.0) {
+        return 0.0;
+    }
+    const size_t d = iv.prob.empty() ? 0 : iv.prob[0].size();
+    double sum = 0.0;
+    for (size_t c = 0; c < d; ++c) {
+        sum += std::abs(IvdmProbability(iv, x, c) - IvdmProbability(iv, y, c));
+    }
+    return sum * scale;
+}
\ No newline at end of file
@@ -0,0 +1,69 @@
+#pragma once
+
+#include "dataset.h"
+
+#include <cstdint>
+#include <fstream>
+#include <string>
+#include <utility>
+#include <vector>
+
+// Binary kNN file (--knn-format bin|bin32), little-endian:
+//   header  "RKNN", u32 version, u32 flags (bit 0: float32 distances),
+//           u64 first row, u32 rows per block
+//   blocks  u32 rows, u32 payload bytes; per row: varint count, count
+//           zigzag-varint index deltas (the first relative to the row itself),
+//           count distances (f64 or f32)
+//   index   per block: u64 first row, u64 file offset
+//   footer  u64 index offset, u64 block count, "RKNE"
+// Blocks hold up to `rows per block` rows; a block may be shorter when it was
+// closed early by a checkpoint.
+class KnnBinaryWriter {
+public:
+    static constexpr uint32_t kRowsPerBlock = 1024;
+
+    // resumeBytes > 0 continues a checkpointed file that was cut back to that size.
+    bool Open(const std::string& path, size_t firstRow, bool float32, uint64_t resumeBytes, std::string& err);
+    void Write(size_t row, const std::vector<Neighbor>& list);
+    // Ends the current block; returns the file size, a valid resume point.
+    uint64_t Flush();
+    bool Close(std::string& err);
+
+private:
+    void EndBlock();
+
+    std::ofstream file;
+    std::string block;
+    std::vector<std::pair<uint64_t, uint64_t>> index;   // (first row, offset)
+    uint64_t offset = 0;
+    size_t blockFirstRow = 0;
+    uint32_t blockRows = 0;
+    bool float32 = false;
+};
+
+class KnnBinaryReader {
+public:
+    bool Open(const std::string& path, std::string& err);
+    size_t FirstRow() const { return firstRow; }
+    size_t RowCount() const { return rowCount; }
+    bool Float32() const { return float32; }
+    // Random access by absolute row index.
+    bool ReadRow(size_t row, std::vector<Neighbor>& list, std::string& err);
+
+private:
+    bool LoadBlock(size_t b, std::string& err);
+
+    std::ifstream file;
+    std::vector<std::pair<uint64_t, uint64_t>> index;
+    std::vector<std::vector<Neighbor>> cached;          // decoded rows of block `cachedBlock`
+    size_t cachedBlock = SIZE_MAX;
+    size_t firstRow = 0;
+    size_t rowCount = 0;
+    bool float32 = false;
+};
+
+bool WriteKnnBinaryFile(const std::string& path,
+                        const std::vector<std::vector<Neighbor>>& knnLists,
+                        size_t firstRow,
+                        bool float32,
+                        std::string& err);
\ No newline at end of file
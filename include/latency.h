@@ -0,0 +1,32 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <iosfwd>
+#include <vector>
+
+// Log-linear (HDR-style) histogram of latencies in nanoseconds: exact below
+// 128 ns, above that 64 sub-buckets per power of two (under 1.6% error).
+class LatencyHistogram {
+public:
+    void Record(uint64_t ns);
+    uint64_t Count() const { return total; }
+    uint64_t Max() const { return max; }
+    // Highest value equivalent to the p-th percentile (0 < p <= 100).
+    uint64_t Percentile(double p) const;
+    // Adds the objects of another histogram (shards of one experiment).
+    void Merge(const LatencyHistogram& other);
+
+    // Text form for shard files and checkpoints: the max, then
+    // `bucket:count` for every non-empty bucket.
+    void Write(std::ostream& out) const;
+    bool Read(std::istream& in);
+
+private:
+    static size_t BucketOf(uint64_t ns);
+    static uint64_t BucketHigh(size_t bucket);
+
+    std::vector<uint64_t> counts;
+    uint64_t total = 0;
+    uint64_t max = 0;
+};
\ No newline at end of file
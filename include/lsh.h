@@ -0,0 +1,75 @@
+#pragma once
+
+#include "dataset.h"
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+// Locality-sensitive hash index for approximate neighbor candidates.
+//
+// Rows are embedded so that L1 distance follows InstanceDistance: numeric
+// attributes as range-normalized values, nominal attributes as their
+// class-probability vectors (SVDM is the L1 distance between those; halved
+// for SVDM'). HEOM embeds nominal values as half one-hot vectors and IVDM
+// numeric values as their interpolated class distributions. Each table
+// hashes the embedding with `hashes` Cauchy (1-stable) projections quantized
+// to buckets of `width`.
+class LshIndex {
+public:
+    // width <= 0 picks twice the typical distance to the 8th nearest row.
+    void Build(const Dataset& ds,
+               const Stats& stats,
+               const DistanceConfig& cfg,
+               int tables,
+               int hashes,
+               double width,
+               uint64_t seed);
+
+    // Rows sharing a bucket with `row` in any table, plus up to `probes`
+    // neighboring buckets per table (multi-probe), without `row` itself.
+    std::vector<int> Candidates(size_t row, int probes) const;
+    // The same for an object outside the index (a serve query).
+    std::vector<int> Candidates(const Dataset& ds, const Instance& query, int probes) const;
+
+    // In-place updates for a changing training set: Insert hashes a row
+    // appended to ds after Build (embedded with the build-time class
+    // probabilities), Erase drops a row from its buckets.
+    void Insert(const Dataset& ds, size_t row);
+    void Erase(size_t row);
+
+    double Width() const { return width; }
+
+private:
+    // Mean L1 embedding distance from up to `sample` rows to their k-th
+    // nearest row; sets the bucket width when none is given.
+    double TypicalDistance(int k, int sample, uint64_t seed) const;
+
+    struct Table {
+        std::vector<float> a;                                   // hashes x dim projections
+        std::vector<float> b;                                   // offsets in [0, width)
+        std::unordered_map<uint64_t, std::vector<int>> buckets;
+    };
+
+    void Embed(const Dataset& ds, const Instance& inst, float* e) const;
+    void Project(const Table& t, const float* e, std::vector<double>& out) const;
+    uint64_t RowKey(const Table& t, size_t row) const;
+    // Rows in the buckets of embedding e (and up to `probes` neighbors per table).
+    std::vector<int> Probe(const float* e, int probes) const;
+    static uint64_t BucketKey(const std::vector<int64_t>& h);
+
+    size_t rows = 0;
+    size_t dim = 0;
+    size_t classes = 0;
+    Metric metric = Metric::SVDM;
+    std::vector<float> embedding;                               // rows x dim
+    std::vector<double> numLo;                                  // numeric slot -> minimum
+    std::vector<double> numRange;                               // numeric slot -> range
+    std::vector<std::vector<std::vector<float>>> classProb;     // nominal slot -> code -> embedded vector
+    std::vector<size_t> nomDim;                                 // nominal slot -> embedded width
+    std::vector<IvdmStat> ivdm;                                 // numeric slot -> IVDM intervals
+    double ivdmScale = 1.0;
+    std::vector<Table> tableList;
+    int hashCount = 0;
+    double width = 1.0;
+};
\ No newline at end of file
@@ -2,8 +2,20 @@
 
 #include "dataset.h"
 
+#include <cstdint>
+#include <utility>
 #include <vector>
 
 std::vector<std::vector<int>> InitMatrix(size_t d);
 std::vector<MetricsPerClass> ComputeMetrics(const std::vector<std::vector<int>>& conf);
-MetricsPerClass ComputeBalanced(const std::vector<MetricsPerClass>& perClass);
\ No newline at end of file
+MetricsPerClass ComputeBalanced(const std::vector<MetricsPerClass>& perClass);
+
+// Wilson score interval of the proportion successes / trials (z = 1.96: 95%).
+std::pair<double, double> WilsonInterval(int successes, int trials, double z = 1.96);
+
+// Percentile bootstrap 95% interval of ComputeBalanced over conf. Each
+// replicate redraws every row (true class) with replacement at its own size,
+// as a class-stratified sample is drawn; seeded, so reruns agree.
+std::pair<MetricsPerClass, MetricsPerClass> BootstrapBalanced(const std::vector<std::vector<int>>& conf,
+                                                              int replicates,
+                                                              uint64_t seed);
\ No newline at end of file
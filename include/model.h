@@ -0,0 +1,78 @@
+#pragma once
+
+#include "dataset.h"
+#include "lsh.h"
+
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// Stats of a changing set of rows. Numeric extrema come from per-attribute
+// value counts and SVDM from value-by-class counts, so Add/Remove touch only
+// the row's own values: one SVDM row and column per nominal attribute.
+// Get() always matches ComputeStats over the same rows (value indices may be
+// ordered differently). Supports the SVDM and HEOM metrics; IVDM intervals
+// move with the numeric extrema and need ComputeStats. On-demand attributes
+// (more than cfg.denseValues values) update one probability row instead.
+class IncrementalStats {
+public:
+    void Init(const Dataset& ds, const std::vector<int>& indices, const DistanceConfig& cfg);
+    void Add(const Dataset& ds, int row);
+    void Remove(const Dataset& ds, int row);
+    const Stats& Get() const { return stats; }
+
+private:
+    void Update(const Dataset& ds, int row, int delta);
+    void RefreshNumeric(size_t a);
+    void RefreshSvdm(size_t a, int code);
+    void AddValue(const Dataset& ds, size_t a, int code);
+    void DropValue(size_t a, int code);
+
+    DistanceConfig cfg;
+    size_t classes = 0;
+    std::vector<std::map<double, int>> numValues;              // attr -> value -> rows
+    std::vector<std::vector<std::vector<int>>> counts;         // attr -> code -> class -> rows
+    std::vector<std::vector<int>> totals;                      // attr -> code -> rows
+    std::vector<std::vector<int>> valueCodes;                  // attr -> stats value index -> code
+    Stats stats;
+};
+
+// Mutable training set: Insert/Erase keep the stats (and an optional LSH
+// index) current without rebuilding them. Erased rows stay in Data() as
+// tombstones so row indices, neighbor lists and ids remain valid.
+class Model {
+public:
+    // Takes the dataset as prepared for classification (types, codes, classes).
+    // Incremental updates need --precision f64.
+    bool Init(Dataset data, const DistanceConfig& cfg, std::string& err);
+    void EnableLsh(int tables, int hashes, double width, uint64_t seed);
+
+    // inst carries raw tokens and missing flags (as read); numeric values,
+    // nominal codes, new classes and the id are filled in here.
+    bool Insert(Instance inst, int& row, std::string& err);
+    bool Erase(int row, std::string& err);
+
+    const Dataset& Data() const { return ds; }
+    const Stats& CurrentStats() const { return stats.Get(); }
+    const DistanceConfig& Distance() const { return cfg; }
+    const std::vector<std::unordered_map<std::string, int>>& Codes() const { return codes; }
+    const LshIndex* Index() const { return lsh.get(); }
+    bool IsLive(int row) const { return row >= 0 && (size_t)row < live.size() && live[row]; }
+    // Live rows in row order (the training set).
+    std::vector<int> LiveRows() const;
+    // LSH candidates of a row, or all other live rows without an index.
+    std::vector<int> Candidates(int row, int probes) const;
+    // Compares the incrementally kept stats with ComputeStats over the live
+    // rows; err names the first attribute that differs.
+    bool CheckStats(std::string& err) const;
+
+private:
+    Dataset ds;
+    DistanceConfig cfg;
+    IncrementalStats stats;
+    std::vector<char> live;
+    std::vector<std::unordered_map<std::string, int>> codes;  // attr -> value -> code
+    std::unique_ptr<LshIndex> lsh;
+};
\ No newline at end of file
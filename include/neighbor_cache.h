@@ -0,0 +1,69 @@
+#pragma once
+
+#include "dataset.h"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// Persistent neighbor lists (--neighbor-cache <dir>): per row, its nearest
+// other rows in ComputeNeighbors order under the stats of one mode, with all
+// other rows as candidates (leave-one-out). One file per NeighborCacheKey, so
+// runs over other algorithms, k or n of the same data rank each object once.
+// File NBR_<key>.bin, little-endian (the payload is read in place):
+//   header  "RNBC", u32 version, u64 key, u64 rows, u32 depth, u32 0
+//   dists   f64 [rows * depth]
+//   index   i32 [rows * depth]; a first entry of -1 marks a row not cached
+// The file is mapped read-only. Rows ranked by this run are kept in memory
+// (NeighborCacheMemory, counted by the planner) until Save; workers store
+// disjoint rows, lookups of a row follow its store.
+// Runs sharing a file (e.g. shards) replace it in turn: the last one wins.
+class NeighborCache {
+public:
+    NeighborCache() = default;
+    NeighborCache(const NeighborCache&) = delete;
+    NeighborCache& operator=(const NeighborCache&) = delete;
+    ~NeighborCache();
+
+    // Maps the file of key in dir when it matches (anything else is ignored
+    // and replaced by Save). New rows are ranked `depth` deep; the file's
+    // rows serve any k up to the file's own depth.
+    bool Open(const std::string& dir, uint64_t key, size_t rows, size_t depth, std::string& err);
+    size_t Depth() const { return depth; }
+
+    // The k nearest rows of `row`, when cached at least k deep.
+    bool Find(size_t row, size_t k, std::vector<Neighbor>& out) const;
+    // Keeps the Depth() nearest rows of `row` for Find and Save.
+    void Store(size_t row, const std::vector<Neighbor>& ranked);
+
+    // Rewrites the file at Depth() with the stored rows and the file's rows
+    // that are deep enough (replaced atomically), then maps it again and
+    // frees the stored rows; nothing to do unless rows were stored.
+    bool Save(std::string& err);
+
+private:
+    bool MapRow(size_t row, size_t k, std::vector<Neighbor>* out) const;
+    void Unmap();
+
+    std::string path;
+    uint64_t key = 0;
+    size_t rows = 0;
+    size_t depth = 0;
+    std::vector<std::vector<Neighbor>> stored;          // row -> ranked this run (empty => none)
+    std::atomic<bool> dirty{false};
+
+    // Mapped file (null => none).
+    const unsigned char* mapped = nullptr;
+    size_t mappedBytes = 0;
+    size_t mappedDepth = 0;
+    void* mapping = nullptr;                            // Windows: file mapping handle
+};
+
+// Content hash of the rows and attribute types of ds, the distance settings
+// and the stats mode ("g" or "l").
+uint64_t NeighborCacheKey(const Dataset& ds, const DistanceConfig& cfg, const std::string& mode);
+
+// Memory held by Store for `rows` rows ranked `depth` deep.
+uint64_t NeighborCacheMemory(size_t rows, size_t depth);
\ No newline at end of file
@@ -1,19 +1,88 @@
 #pragma once
 
 #include "dataset.h"
+#include "knn_binary.h"
+#include "latency.h"
 #include "metrics.h"
 
+#include <cstdint>
+#include <fstream>
 #include <string>
 #include <vector>
 
+// Predictions/neighbor lists cover rows [firstRow, firstRow + size), or
+// rows[0..size) when a row list is given (--loo-sample).
 void WriteOutFile(const std::string& path,
                   const Dataset& ds,
                   const std::vector<std::string>& predStd,
                   const std::vector<std::string>& predNorm,
-                  const std::string& missingToken);
+                  const std::string& missingToken,
+                  size_t firstRow = 0,
+                  const std::vector<size_t>* rows = nullptr);
 
 void WriteKnnFile(const std::string& path,
-                  const std::vector<std::vector<Neighbor>>& knnLists);
+                  const std::vector<std::vector<Neighbor>>& knnLists,
+                  size_t firstRow = 0,
+                  const std::vector<size_t>* rows = nullptr);
+
+// One line of the text kNN file: "<row+1>,<count>,(<index+1>,<dist>)...".
+void WriteKnnRow(std::ostream& out, size_t row, const std::vector<Neighbor>& list);
+
+// Writes OUT/kNN rows one at a time, in row order, so that a run does not
+// have to keep predictions and neighbor lists of all rows in memory.
+class StreamingResultWriter {
+public:
+    // knnFormat is csv, bin or bin32. Non-zero byte counts continue a
+    // checkpointed run: the files are cut back to those sizes and appended to.
+    bool Open(const std::string& outPath,
+              const std::string& knnPath,
+              const std::string& knnFormat,
+              size_t firstRow,
+              uint64_t outBytes,
+              uint64_t knnBytes,
+              std::string& err);
+    void Write(const Dataset& ds, size_t row, const ClassificationResult& res, const std::string& missingToken);
+    void Flush(uint64_t& outBytes, uint64_t& knnBytes);
+    bool Close(std::string& err);
+
+private:
+    std::ofstream outStream;
+    std::ofstream knnStream;
+    KnnBinaryWriter knnBinary;
+    bool binary = false;
+};
+
+void WriteShardFile(const std::string& path, const ShardSummary& shard);
+bool ReadShardFile(const std::string& path, ShardSummary& shard, std::string& err);
+void AppendShardTimes(const std::string& statPath, const std::vector<ShardSummary>& shards);
+
+// "Latency(us): p50=.., p90=.., p99=.., max=.., objects=N" line of the STAT file.
+void AppendLatency(const std::string& statPath, const LatencyHistogram& latency);
+// RiaApprox* lines: --ria-approx settings and the held-out comparison with exact RIA.
+void AppendRiaApproxReport(const std::string& statPath, const RiaApproxReport& report);
+
+// Lsh* lines: --lsh settings, candidate counts and recall@k of the sampled objects.
+void AppendLshReport(const std::string& statPath, const LshReport& report);
+
+// LooSample* lines: the drawn objects per class, Wilson intervals of the
+// accuracy and per-class recall, bootstrap intervals of the balanced metrics.
+void AppendLooSampleReport(const std::string& statPath,
+                           const Dataset& ds,
+                           const LooSampleReport& report,
+                           const std::vector<std::vector<int>>& confStd,
+                           const std::vector<std::vector<int>>& confNorm);
+
+// "Budget: timeMs=.., rules=.., distances=.., partial=P of N" line for --budget-*.
+void AppendBudgetReport(const std::string& statPath, const Config& cfg, size_t partial, size_t objects);
+
+// "NeighborCache: depth=D, hits=H, misses=M" line for --neighbor-cache.
+void AppendNeighborCacheReport(const std::string& statPath, size_t depth, size_t hits, size_t misses);
+
+// "Dedup: rows=N, prototypes=P" line for --dedup.
+void AppendDedupReport(const std::string& statPath, const Dataset& ds);
+
+// SLOW_*.csv: the slowest objects, slowest first.
+void WriteSlowFile(const std::string& path, const Dataset& ds, const std::vector<SlowObject>& slowest);
 
 void WriteStatFile(const std::string& path,
                    const Dataset& ds,
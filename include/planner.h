@@ -0,0 +1,55 @@
+#pragma once
+
+#include "dataset.h"
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#include <vector>
+
+// One experiment as the planner sees it: how many neighbors it ranks per object.
+struct PlannedExperiment {
+    std::string algo;
+    std::string mode;
+    int k = 0;
+    int ranked = 0;                    // neighbors ranked per object (n-1 => full ranking)
+    std::string neighbors;             // matrix | f32 | u16 | u8 | scan
+    std::string consistency;           // exact | sampled | cached | exact+cached | none
+    double cost = 0.0;                 // estimated work, attribute-term units
+};
+
+// Strategy choice for one dataset, made after reading it and computing the
+// global stats. Only exact strategies are picked; the sampled RIA verifier is
+// used only when asked for (planning fails when the exact one exceeds the
+// memory limit).
+struct ExecutionPlan {
+    bool distanceMatrix = false;       // global-mode distances precomputed for all row pairs
+    std::string precision = "f64";     // f64 | f32 | u16 | u8 storage for neighbor ranking
+    bool sampledConsistency = false;   // RIA verifies rules on a bounded set (--ria-approx)
+    bool consistencyCache = false;     // exact RIA rule decisions kept per mode (ConsistencyCache)
+    uint64_t memoryLimit = 0;
+    uint64_t baseBytes = 0;            // rows and SVDM tables (per worker in local mode)
+    uint64_t matrixBytes = 0;
+    uint64_t compactBytes = 0;         // columns of the chosen (or considered) precision
+    uint64_t verifierBytes = 0;        // exact RIA verifiers of all workers
+    uint64_t cacheBytes = 0;           // rule caches of all modes
+    size_t neighborCacheDepth = 0;     // --neighbor-cache list depth (0 => not cached)
+    uint64_t neighborCacheBytes = 0;   //   rows it ranks, held in memory until saved
+    double matrixBuildCost = 0.0;
+    std::vector<PlannedExperiment> experiments;
+    std::vector<std::string> reasons;  // one line per decision
+};
+
+// algos are base names (RIONA, RIA, KNN); kList as resolved for the run.
+// cfg.forceStrategy overrides the cost model: comma-separated scan | matrix |
+// f32 | u16 | u8 and exact | sampled. An explicit --precision is kept as given.
+bool PlanExecution(const Dataset& ds,
+                   const Stats& stats,
+                   const Config& cfg,
+                   const std::vector<std::string>& algos,
+                   const std::vector<std::string>& modes,
+                   const std::vector<int>& kList,
+                   ExecutionPlan& plan,
+                   std::string& err);
+
+void PrintPlan(std::ostream& out, const Dataset& ds, const ExecutionPlan& plan);
\ No newline at end of file
@@ -0,0 +1,48 @@
+#pragma once
+
+#include "dataset.h"
+
+#include <vector>
+
+// Duplicate collapsing (--dedup). Rows with identical conditional attribute
+// values (missing flags, numeric values, nominal codes) share a prototype:
+// their distances to any object are equal and they satisfy the same g-rules,
+// so the classifiers evaluate each (prototype, class) group once and weight
+// it by its size. Fills ds.prototypeOf; returns the number of prototypes.
+size_t BuildPrototypes(Dataset& ds);
+
+// A list of rows split into (prototype, class) groups, in order of first
+// appearance. The representative of a group is its first row in the list.
+// The slot table spans every (prototype, class) pair, so it is taken from a
+// per-thread pool and handed back (with its used entries cleared) instead of
+// being allocated for each query.
+struct RowGroups {
+    std::vector<int> rows;             // group -> representative row
+    std::vector<int> weights;          // group -> rows in the group
+    std::vector<int> start;            // group -> offset into members (groups + 1 entries)
+    std::vector<int> members;          // rows of each group, in list order
+    std::vector<int> slot;             // prototype * classes + class -> group (-1 if none)
+    std::vector<size_t> used;          // group -> its slot entry
+
+    RowGroups() = default;
+    RowGroups(RowGroups&& other) noexcept;
+    RowGroups& operator=(RowGroups&& other) noexcept;
+    RowGroups(const RowGroups&) = delete;
+    RowGroups& operator=(const RowGroups&) = delete;
+    ~RowGroups();
+
+private:
+    void Release();
+};
+
+RowGroups GroupRows(const Dataset& ds, const std::vector<int>& rows);
+
+// Group of a row that was in the grouped list.
+int GroupOf(const Dataset& ds, const RowGroups& groups, int row);
+
+// Expand neighbors over the representatives, sorted by (dist, index), into the
+// k nearest member rows, ordered exactly as ComputeNeighbors orders rows.
+std::vector<Neighbor> ExpandNeighbors(const Dataset& ds,
+                                      const RowGroups& groups,
+                                      const std::vector<Neighbor>& ranked,
+                                      int k);
\ No newline at end of file
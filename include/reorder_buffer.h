@@ -0,0 +1,30 @@
+#pragma once
+
+#include "dataset.h"
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+
+// Accepts classification results in any order and hands them to `commit`
+// strictly in row order. A producer must call WaitForTurn before classifying
+// a row; it blocks while the row is `window` or more rows ahead of the next
+// row to commit, which bounds the number of buffered results.
+class ReorderBuffer {
+public:
+    using CommitFn = std::function<void(size_t row, ClassificationResult& res)>;
+
+    ReorderBuffer(size_t firstRow, size_t window, CommitFn commit);
+
+    void WaitForTurn(size_t row);
+    void Push(size_t row, ClassificationResult res);
+
+private:
+    std::mutex mutex;
+    std::condition_variable turn;
+    std::map<size_t, ClassificationResult> pending;
+    size_t nextRow;
+    size_t window;
+    CommitFn commit;
+};
\ No newline at end of file
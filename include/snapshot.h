@@ -0,0 +1,90 @@
+#pragma once
+
+#include "dataset.h"
+#include "lsh.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+// Prepared training set with its stats, shared read-only by any number of
+// readers. A snapshot is never modified once published; a reload builds a
+// new one and the old one is freed when its last reader drops it.
+struct ModelSnapshot {
+    Dataset ds;
+    DistanceConfig cfg;
+    Stats stats;
+    std::vector<int> rows;                                      // training rows (all of ds)
+    std::vector<std::unordered_map<std::string, int>> codes;    // attr -> value -> code
+    std::shared_ptr<const LshIndex> lsh;                        // --lsh candidates (null without)
+    int k = 1;                                                  // neighborhood size
+    std::string source;                                         // ARFF file it was built from
+    uint64_t version = 0;                                       // 1 for the first snapshot
+};
+
+// Tokens of a query row (conditional attributes, optionally followed by the
+// decision, which is ignored) encoded against the snapshot's dictionaries:
+// numeric values parsed, nominal codes looked up (-1 for unseen values).
+bool EncodeQuery(const ModelSnapshot& snap,
+                 const std::string& line,
+                 const std::string& missingToken,
+                 Instance& query,
+                 std::string& err);
+
+// Tokens of a training row for Model::Insert: every conditional attribute
+// followed by the decision, kept raw (Insert encodes them).
+bool SplitTrainingRow(const Dataset& ds,
+                      const std::string& line,
+                      const std::string& missingToken,
+                      Instance& inst,
+                      std::string& err);
+
+// The current snapshot behind an atomically swapped shared_ptr: readers take
+// a reference without locking and keep a consistent model for the whole query.
+class SnapshotStore {
+public:
+    std::shared_ptr<const ModelSnapshot> Current() const { return std::atomic_load(&current); }
+    // Numbers `next` one past the current snapshot and publishes it. With
+    // `expected` set, only while that version is still current, so an edit
+    // of an older model never replaces a reload that landed meanwhile.
+    bool PublishNext(std::shared_ptr<ModelSnapshot> next, uint64_t expected = 0);
+
+private:
+    std::shared_ptr<const ModelSnapshot> current;
+    std::mutex publishMutex;                                    // serializes publishers, not readers
+};
+
+// Builds snapshots on a background thread and publishes them to a store.
+// Requests made while a build runs are coalesced: only the latest path is
+// built next. A failed build leaves the current snapshot in place.
+class SnapshotReloader {
+public:
+    using BuildFn = std::function<bool(const std::string& path, ModelSnapshot& snap, std::string& err)>;
+    // Called on the reload thread after each build (err is empty on success).
+    using DoneFn = std::function<void(const std::string& path, const std::string& err)>;
+
+    SnapshotReloader(SnapshotStore& store, BuildFn build, DoneFn done);
+    // Finishes the pending build, if any, then joins the thread.
+    ~SnapshotReloader();
+
+    void Request(const std::string& path);
+
+private:
+    void Run();
+
+    SnapshotStore& store;
+    BuildFn build;
+    DoneFn done;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::string pending;
+    bool hasPending = false;
+    bool stopping = false;
+    std::thread worker;
+};
\ No newline at end of file
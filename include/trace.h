@@ -0,0 +1,38 @@
+#pragma once
+
+#include <chrono>
+#include <string>
+
+// Timeline profiling in Chrome trace-event format (--trace out.json).
+// Each thread appends complete events to its own buffer without locking;
+// the buffers are merged only when the trace is written.
+
+void TraceEnable();
+bool TraceEnabled();
+
+// Tags subsequent events of the calling thread with the running experiment
+// (dataset, algorithm, mode, k) and returns its id, which the experiment's
+// worker threads adopt with TraceUseExperiment; the tag is per thread, so
+// experiments running side by side (batch) keep their own.
+int TraceSetExperiment(const std::string& dataset, const std::string& algo, const std::string& mode, int k);
+void TraceUseExperiment(int id);
+
+// Records [construction, destruction) as one event. A span with row >= 0
+// also tags every span nested in it (on the same thread) with that test object.
+class TraceSpan {
+public:
+    explicit TraceSpan(const char* name, int row = -1);
+    ~TraceSpan();
+
+    TraceSpan(const TraceSpan&) = delete;
+    TraceSpan& operator=(const TraceSpan&) = delete;
+
+private:
+    const char* name;
+    int row;
+    int prevRow;
+    bool active;
+    std::chrono::steady_clock::time_point start;
+};
+
+bool WriteTrace(const std::string& path, std::string& err);
\ No newline at end of file
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <cstdint>
 #include <string>
 #include <vector>
 
@@ -8,4 +9,12 @@ std::vector<std::string> SplitByWhitespace(const std::string& line);
 std::string ToLower(const std::string& s);
 bool StartsWithNoCase(const std::string& s, const std::string& prefix);
 bool IsCommentLine(const std::string& s);
-std::vector<std::string> SplitCsvLike(const std::string& line);
\ No newline at end of file
+std::vector<std::string> SplitCsvLike(const std::string& line);
+// splitmix64 finalizer: well-mixed 64-bit hash for seeded, reproducible sampling.
+uint64_t Mix64(uint64_t x);
+// Byte count such as "1048576", "512K", "64M" or "2G" (binary units).
+bool ParseByteSize(const std::string& text, uint64_t& bytes);
+// Non-negative integer such as "1000" (no sign, units or trailing characters).
+bool ParseCount(const std::string& text, size_t& count);
+// Non-negative finite number such as "2.5" (no trailing characters).
+bool ParseNonNegative(const std::string& text, double& value);
\ No newline at end of file
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <mutex>
+
+// Worker threads shared by the jobs of `riona batch`: every job runs on a
+// thread of its own and borrows idle slots for its parallel phases, so a
+// large dataset uses the cores that finished jobs leave behind.
+class WorkerSlots {
+public:
+    explicit WorkerSlots(int idle);
+
+    // Takes up to `wanted` idle slots and returns how many it got.
+    int TryAcquire(int wanted);
+    void Release(int count);
+
+private:
+    std::mutex mutex;
+    int idle;
+};
\ No newline at end of file
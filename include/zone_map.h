@@ -0,0 +1,35 @@
+#pragma once
+
+#include "algorithms.h"
+#include "dataset.h"
+
+#include <cstdint>
+#include <vector>
+
+// Zone maps (--zone-maps). The rows are ordered along a Z-order curve over the
+// range-normalized numeric attributes, then by nominal codes and class, and the
+// order is cut into blocks of ZoneMaps::kBlockRows rows summarized per slot.
+// Rows keep their indices (ids, tie-breaks and outputs are unchanged); scans
+// visit them block by block instead. Needs the kernel columns.
+void BuildZoneMaps(Dataset& ds);
+
+// Blocks ordered by a lower bound of their distance from row x under kernel
+// (ties by block). bounds[block] receives the bound; it never exceeds the
+// kernel distance to any row of the block, rounding included.
+std::vector<int> BlocksByBound(const Dataset& ds, const DistanceKernel& kernel, size_t x, std::vector<double>& bounds);
+
+// The k nearest candidates of row x sorted by (dist, index), as ComputeNeighbors
+// ranks them; blocks whose bound exceeds the k-th distance are not read.
+std::vector<Neighbor> ZoneNeighbors(const Dataset& ds,
+                                    const DistanceKernel& kernel,
+                                    size_t x,
+                                    const std::vector<int>& candidates,
+                                    int k);
+
+// Nominal term -> OR of the 64-bit words of its accepted codes, matching the
+// code % 64 bits of ZoneMaps::nomMask (numeric terms get 0).
+std::vector<uint64_t> FoldAccepted(const CompiledGRule& rule);
+
+// False when no row of the block can satisfy the rule: some term rejects
+// every present value of an attribute that no row of the block lacks.
+bool BlockMayMatch(const Dataset& ds, size_t block, const CompiledGRule& rule, const std::vector<uint64_t>& folded);
\ No newline at end of file
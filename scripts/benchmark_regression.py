@@ -0,0 +1,333 @@
+#!/usr/bin/env python3
+import argparse
+import json
+import re
+import statistics
+import subprocess
+import sys
+import time
+from datetime import datetime, timezone
+from pathlib import Path
+
+
+RESULT_NAME_RE = re.compile(
+    r"^(OUT|kNN|STAT)_([A-Za-z]+)_(.+)_D(\d+)_R(\d+)_k(\d+)_([A-Za-z]+)_([gl])\.(csv|txt)$"
+)
+TIMES_RE = re.compile(
+    r"Times(?:\(ms\))?:\s*read=([^,]+),\s*preprocess=([^,]+),\s*classify=([^,]+),\s*write=([^,]+),\s*total=([^\s]+)",
+    re.IGNORECASE,
+)
+NEIGHBOR_RE = re.compile(r"\((-?\d+),([^)]+)\)")
+
+
+def cell_key(algo, dataset, k, metric, mode):
+    # C# writes "kNN" where the C++ port writes "KNN".
+    return f"{algo.upper()}_{dataset}_k{k}_{metric.upper()}_{mode}"
+
+
+def index_results(root):
+    """Map cell key -> {"OUT": path, "kNN": path, "STAT": path} for every result file under root."""
+    cells = {}
+    for path in root.rglob("*"):
+        if not path.is_file() or "_aggregated" in path.parts:
+            continue
+        m = RESULT_NAME_RE.match(path.name)
+        if not m:
+            continue
+        kind, algo, dataset, _, _, k, metric, mode, _ = m.groups()
+        cells.setdefault(cell_key(algo, dataset, k, metric, mode), {})[kind] = path
+    return cells
+
+
+def read_lines(path):
+    with open(path, "r", encoding="utf-8", errors="replace") as f:
+        lines = [raw.rstrip("\r\n").lstrip("\ufeff") for raw in f]
+    return [line for line in lines if line]
+
+
+def id_base(lines):
+    # C# numbers rows from 0, the C++ port from 1; neighbor ids follow the same base.
+    if not lines:
+        return 0
+    return 0 if lines[0].split(",", 1)[0].strip() == "0" else 1
+
+
+def parse_out(path):
+    lines = read_lines(path)
+    base = id_base(lines)
+    rows = {}
+    for line in lines:
+        parts = line.split(",")
+        if len(parts) < 3:
+            continue
+        rows[int(parts[0]) - base] = (parts[-2], parts[-1])
+    return rows
+
+
+def parse_knn(path):
+    lines = read_lines(path)
+    base = id_base(lines)
+    rows = {}
+    for line in lines:
+        head = line.split(",", 2)
+        if len(head) < 2:
+            continue
+        rows[int(head[0]) - base] = [
+            (int(idx) - base, float(dist), print_precision(dist)) for idx, dist in NEIGHBOR_RE.findall(line)
+        ]
+    return rows
+
+
+def print_precision(text):
+    """Half a unit in the last printed digit of a distance (C++ prints 6 significant digits)."""
+    text = text.strip().lower()
+    mantissa, _, exponent = text.partition("e")
+    decimals = len(mantissa.partition(".")[2])
+    return 0.5 * 10.0 ** (int(exponent or 0) - decimals)
+
+
+def parse_stat(path):
+    info = {"objects": 0, "times": {}}
+    for line in read_lines(path):
+        if line.startswith("Objects:"):
+            info["objects"] = int(line.split(":", 1)[1].strip())
+            continue
+        m = TIMES_RE.search(line)
+        if m:
+            names = ["read", "preprocess", "classify", "write", "total"]
+            info["times"] = {n: float(v) for n, v in zip(names, m.groups())}
+    return info
+
+
+def close_enough(a, b, tol):
+    return abs(a - b) <= tol * max(1.0, abs(b))
+
+
+def compare_out(new_path, ref_path):
+    new_rows = parse_out(new_path)
+    ref_rows = parse_out(ref_path)
+    mismatches = 0
+    for row, ref in ref_rows.items():
+        if new_rows.get(row) != ref:
+            mismatches += 1
+    return mismatches + sum(1 for row in new_rows if row not in ref_rows)
+
+
+def same_distance(a, b, tol):
+    """Distances (dist, precision) agree within tol or within what their printed digits allow."""
+    return abs(a[0] - b[0]) <= a[1] + b[1] or close_enough(a[0], b[0], tol)
+
+
+def knn_rows_match(new, ref, tol):
+    """Both lists hold the same sorted distances, and the same neighbors apart from those
+    tied with the last distance: ties at the boundary may be broken either way."""
+    if len(new) != len(ref):
+        return False
+    new_sorted = sorted((d, eps) for _, d, eps in new)
+    ref_sorted = sorted((d, eps) for _, d, eps in ref)
+    if not all(same_distance(a, b, tol) for a, b in zip(new_sorted, ref_sorted)):
+        return False
+    if not ref:
+        return True
+    last = ref_sorted[-1]
+    ref_dist = {idx: (d, eps) for idx, d, eps in ref}
+    for idx, d, eps in new:
+        if idx in ref_dist:
+            if not same_distance((d, eps), ref_dist[idx], tol):
+                return False
+        elif not same_distance((d, eps), last, tol):
+            return False
+    new_idx = {idx for idx, _, _ in new}
+    return all(idx in new_idx or same_distance((d, eps), last, tol) for idx, d, eps in ref)
+
+
+def compare_knn(new_path, ref_path, tol):
+    new_rows = parse_knn(new_path)
+    ref_rows = parse_knn(ref_path)
+    mismatches = 0
+    for row, ref in ref_rows.items():
+        new = new_rows.get(row)
+        if new is None or not knn_rows_match(new, ref, tol):
+            mismatches += 1
+    return mismatches + sum(1 for row in new_rows if row not in ref_rows)
+
+
+def run_riona(binary, dataset_path, outdir, threads, extra):
+    cmd = [str(binary), "--input", str(dataset_path), "--algo", "all", "--mode", "both",
+           "--outdir", str(outdir), "--threads", str(threads)] + extra
+    start = time.perf_counter()
+    proc = subprocess.run(cmd, stdout=subprocess.DEVNULL, stderr=subprocess.PIPE, text=True)
+    wall_ms = (time.perf_counter() - start) * 1000.0
+    if proc.returncode != 0:
+        raise SystemExit(f"riona failed ({proc.returncode}): {' '.join(cmd)}\n{proc.stderr}")
+    return wall_ms
+
+
+def load_json(path, default):
+    if path and path.exists():
+        with open(path, "r", encoding="utf-8") as f:
+            return json.load(f)
+    return default
+
+
+def git_revision(repo_root):
+    try:
+        proc = subprocess.run(["git", "rev-parse", "--short", "HEAD"], cwd=repo_root,
+                              capture_output=True, text=True)
+        return proc.stdout.strip() if proc.returncode == 0 else ""
+    except OSError:
+        return ""
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Run riona on reference datasets, compare OUT/kNN against stored results "
+        "and track classify timings in a JSON history."
+    )
+    parser.add_argument("--binary", required=True, help="Path to the riona executable.")
+    parser.add_argument("--dataset", action="append", required=True,
+                        help="Dataset name (data/<name>.arff); may be repeated.")
+    parser.add_argument("--data-dir", default="data", help="Folder with <name>.arff files.")
+    parser.add_argument("--reference", action="append", default=[],
+                        help="Reference results tree (e.g. results) compared on OUT and kNN; may be repeated.")
+    parser.add_argument("--out-only-reference", action="append", default=[],
+                        help="Reference results tree compared on OUT only, for implementations whose "
+                        "distances differ from this one (results-from-C#); may be repeated.")
+    parser.add_argument("--expected", default="scripts/benchmark_expected.json",
+                        help="Known mismatch counts per reference/cell (missing entries mean 0).")
+    parser.add_argument("--write-expected", action="store_true",
+                        help="Record the current mismatch counts as the expected ones and exit 0.")
+    parser.add_argument("--dist-tol", type=float, default=1e-5,
+                        help="Relative tolerance for neighbor distances (default: 1e-5).")
+    parser.add_argument("--workdir", default="_benchmark", help="Where riona writes its outputs.")
+    parser.add_argument("--history", default="_benchmark/history.json", help="JSON timing history.")
+    parser.add_argument("--budget", type=float, default=0.25,
+                        help="Allowed classify slowdown vs. the history median (default: 0.25 = 25%%).")
+    parser.add_argument("--window", type=int, default=5, help="Previous runs used for the median.")
+    parser.add_argument("--min-ms", type=float, default=100.0,
+                        help="Ignore timing regressions for cells faster than this (noise).")
+    parser.add_argument("--threads", type=int, default=1, help="Passed to riona --threads.")
+    parser.add_argument("--riona-arg", action="append", default=[],
+                        help="Extra argument passed through to riona; may be repeated.")
+    args = parser.parse_args()
+
+    repo_root = Path(__file__).resolve().parents[1]
+
+    def resolve(p):
+        p = Path(p)
+        return p if p.is_absolute() else repo_root / p
+
+    binary = resolve(args.binary)
+    workdir = resolve(args.workdir)
+    history_path = resolve(args.history)
+    expected_path = resolve(args.expected)
+    references = [(resolve(r), True) for r in args.reference] + \
+        [(resolve(r), False) for r in args.out_only_reference]
+    for ref, _ in references:
+        if not ref.exists():
+            raise SystemExit(f"Reference folder not found: {ref}")
+
+    expected = load_json(expected_path, {})
+    history = load_json(history_path, {"runs": []})
+    failures = []
+
+    for dataset in args.dataset:
+        dataset_path = resolve(Path(args.data_dir) / f"{dataset}.arff")
+        if not dataset_path.exists():
+            raise SystemExit(f"Dataset not found: {dataset_path}")
+        outdir = workdir / f"{dataset}-t{args.threads}"
+        wall_ms = run_riona(binary, dataset_path, outdir, args.threads, args.riona_arg)
+        produced = {k: v for k, v in index_results(outdir).items() if f"_{dataset}_" in k}
+        if not produced:
+            raise SystemExit(f"No results produced for {dataset} under {outdir}")
+
+        print(f"DATASET: {dataset} (wall {wall_ms:.1f} ms, threads {args.threads})")
+
+        # Correctness against every reference tree.
+        for ref, with_knn in references:
+            ref_cells = index_results(ref / dataset if (ref / dataset).exists() else ref)
+            for key, files in sorted(produced.items()):
+                ref_files = ref_cells.get(key)
+                if not ref_files:
+                    continue
+                counts = {}
+                if "OUT" in files and "OUT" in ref_files:
+                    counts["out"] = compare_out(files["OUT"], ref_files["OUT"])
+                if with_knn and "kNN" in files and "kNN" in ref_files:
+                    counts["knn"] = compare_knn(files["kNN"], ref_files["kNN"], args.dist_tol)
+                exp_key = f"{ref.name}/{key}"
+                if args.write_expected:
+                    if any(counts.values()):
+                        expected[exp_key] = counts
+                    else:
+                        expected.pop(exp_key, None)
+                allowed = expected.get(exp_key, {})
+                status = "ok"
+                for what, n in counts.items():
+                    if n > allowed.get(what, 0):
+                        status = "MISMATCH"
+                        failures.append(f"{exp_key}: {what} mismatches {n} > expected {allowed.get(what, 0)}")
+                detail = " ".join(f"{w}={n}" for w, n in counts.items())
+                print(f"  {ref.name:<16} {key:<40} {detail:<18} {status}")
+
+        # Timings against the history.
+        cells = {}
+        for key, files in sorted(produced.items()):
+            if "STAT" not in files:
+                continue
+            stat = parse_stat(files["STAT"])
+            classify_ms = stat["times"].get("classify", 0.0)
+            cells[key] = {
+                "classify_ms": classify_ms,
+                "total_ms": stat["times"].get("total", 0.0),
+                "objects_per_sec": stat["objects"] / (classify_ms / 1000.0) if classify_ms > 0 else 0.0,
+            }
+
+        previous = [
+            r for r in history["runs"]
+            if r.get("dataset") == dataset and r.get("threads") == args.threads
+        ][-args.window:]
+        for key, cur in cells.items():
+            past = [r["cells"][key]["classify_ms"] for r in previous if key in r.get("cells", {})]
+            status = "ok"
+            if past:
+                limit = statistics.median(past) * (1.0 + args.budget)
+                if cur["classify_ms"] > limit and cur["classify_ms"] >= args.min_ms:
+                    status = f"SLOWER (limit {limit:.1f} ms)"
+                    failures.append(f"{dataset}/{key}: classify {cur['classify_ms']:.1f} ms > {limit:.1f} ms")
+            print(f"  timing           {key:<40} classify={cur['classify_ms']:.1f}ms "
+                  f"objects/s={cur['objects_per_sec']:.0f} {status}")
+
+        history["runs"].append(
+            {
+                "timestamp": datetime.now(timezone.utc).isoformat(timespec="seconds"),
+                "revision": git_revision(repo_root),
+                "dataset": dataset,
+                "threads": args.threads,
+                "wall_ms": wall_ms,
+                "cells": cells,
+            }
+        )
+
+    history_path.parent.mkdir(parents=True, exist_ok=True)
+    with open(history_path, "w", encoding="utf-8") as f:
+        json.dump(history, f, indent=1)
+
+    if args.write_expected:
+        with open(expected_path, "w", encoding="utf-8") as f:
+            json.dump(dict(sorted(expected.items())), f, indent=1)
+            f.write("\n")
+        print(f"Wrote expected mismatch counts to: {expected_path}")
+        return 0
+
+    if failures:
+        print("REGRESSIONS:")
+        for line in failures:
+            print(f"  {line}")
+        return 1
+    print("No regressions.")
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,232 @@
+#include "aggregate.h"
+
+#include "metrics.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <map>
+#include <sstream>
+#include <tuple>
+
+// A table row: column name -> cell text.
+using TableRow = std::map<std::string, std::string>;
+
+// Value as it appears in a STAT file (default stream precision).
+static double AsPrinted(double v) {
+    std::ostringstream ss;
+    ss << v;
+    return std::stod(ss.str());
+}
+
+// Fixed notation without trailing zeros (fmt_float of the script).
+static std::string FormatFixed(double v, int places) {
+    char buf[64];
+    std::snprintf(buf, sizeof(buf), "%.*f", places, AsPrinted(v));
+    std::string s = buf;
+    while (!s.empty() && s.back() == '0') {
+        s.pop_back();
+    }
+    if (!s.empty() && s.back() == '.') {
+        s.pop_back();
+    }
+    return s.empty() ? "0" : s;
+}
+
+// CSV with "\r\n" row ends, as written by Python's csv module.
+static void WriteCsv(const std::filesystem::path& path,
+                     const std::vector<std::string>& columns,
+                     const std::vector<TableRow>& rows) {
+    std::ofstream out(path, std::ios::binary);
+    for (size_t c = 0; c < columns.size(); ++c) {
+        out << (c ? "," : "") << columns[c];
+    }
+    out << "\r\n";
+    for (const auto& row : rows) {
+        for (size_t c = 0; c < columns.size(); ++c) {
+            out << (c ? "," : "") << row.at(columns[c]);
+        }
+        out << "\r\n";
+    }
+}
+
+// Plain-text table with a dashed header rule (render_table of the script).
+static std::string RenderTable(const std::vector<std::string>& columns,
+                               const std::vector<TableRow>& rows,
+                               const std::vector<std::string>& rightAlign) {
+    std::vector<size_t> widths;
+    for (const auto& c : columns) {
+        size_t w = c.size();
+        for (const auto& row : rows) {
+            w = std::max(w, row.at(c).size());
+        }
+        widths.push_back(w);
+    }
+    auto cell = [&](size_t c, const std::string& text) {
+        std::string pad(widths[c] - text.size(), ' ');
+        bool right = std::find(rightAlign.begin(), rightAlign.end(), columns[c]) != rightAlign.end();
+        return right ? pad + text : text + pad;
+    };
+
+    std::ostringstream out;
+    for (size_t c = 0; c < columns.size(); ++c) {
+        out << (c ? "  " : "") << cell(c, columns[c]);
+    }
+    out << "\n";
+    for (size_t c = 0; c < columns.size(); ++c) {
+        out << (c ? "  " : "") << std::string(widths[c], '-');
+    }
+    for (const auto& row : rows) {
+        out << "\n";
+        for (size_t c = 0; c < columns.size(); ++c) {
+            out << (c ? "  " : "") << cell(c, row.at(columns[c]));
+        }
+    }
+    return out.str();
+}
+
+static std::string JsonString(const std::string& s) {
+    std::string out = "\"";
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') {
+            out += '\\';
+        }
+        out += ch;
+    }
+    return out + "\"";
+}
+
+static void WriteJsonMetrics(std::ostream& out, const char* prefix, const MetricsPerClass& m) {
+    out << "\"" << prefix << "Precision\": " << FormatFixed(m.precision, 6)
+        << ", \"" << prefix << "Recall\": " << FormatFixed(m.recall, 6)
+        << ", \"" << prefix << "F1\": " << FormatFixed(m.f1, 6);
+}
+
+bool WriteAggregatedReport(const std::string& outRoot,
+                           std::vector<ExperimentSummary> summaries,
+                           std::string& err) {
+    std::error_code ec;
+    std::filesystem::create_directories(outRoot, ec);
+    if (ec) {
+        err = "Cannot create aggregate folder: " + outRoot;
+        return false;
+    }
+
+    std::stable_sort(summaries.begin(), summaries.end(),
+                     [](const ExperimentSummary& a, const ExperimentSummary& b) {
+                         return std::tie(a.dataset, a.algorithm, a.mode, a.k, a.svdm) <
+                                std::tie(b.dataset, b.algorithm, b.mode, b.k, b.svdm);
+                     });
+
+    const std::vector<std::string> timingCols = {"Algorithm", "Mode", "k", "read", "preprocess",
+                                                 "classify", "write", "total"};
+    const std::vector<std::string> stdCols = {"Algorithm", "Mode", "k", "CId", "Precision", "Recall", "F1"};
+    const std::vector<std::string> normCols = {"Algorithm", "Mode", "k", "NCId", "NPrecision", "NRecall", "NF1"};
+
+    std::ostringstream report;
+    for (size_t first = 0; first < summaries.size();) {
+        const std::string& dataset = summaries[first].dataset;
+        size_t last = first;
+        while (last < summaries.size() && summaries[last].dataset == dataset) {
+            ++last;
+        }
+
+        std::vector<TableRow> timingRows;
+        std::vector<TableRow> stdRows;
+        std::vector<TableRow> normRows;
+        for (size_t e = first; e < last; ++e) {
+            const auto& s = summaries[e];
+            TableRow key = {{"Algorithm", s.algorithm}, {"Mode", s.mode}, {"k", std::to_string(s.k)}};
+
+            TableRow t = key;
+            t["read"] = FormatFixed(s.timeReadMs, 4);
+            t["preprocess"] = FormatFixed(s.timePrepMs, 4);
+            t["classify"] = FormatFixed(s.timeClassifyMs, 4);
+            t["write"] = FormatFixed(s.timeWriteMs, 4);
+            t["total"] = FormatFixed(s.timeTotalMs, 4);
+            timingRows.push_back(std::move(t));
+
+            std::vector<size_t> order(s.classes.size());
+            for (size_t c = 0; c < order.size(); ++c) {
+                order[c] = c;
+            }
+            std::sort(order.begin(), order.end(),
+                      [&](size_t a, size_t b) { return s.classes[a] < s.classes[b]; });
+            for (size_t c : order) {
+                TableRow r = key;
+                r["CId"] = s.classes[c];
+                r["Precision"] = FormatFixed(s.metricsStd[c].precision, 6);
+                r["Recall"] = FormatFixed(s.metricsStd[c].recall, 6);
+                r["F1"] = FormatFixed(s.metricsStd[c].f1, 6);
+                stdRows.push_back(std::move(r));
+
+                TableRow n = key;
+                n["NCId"] = s.classes[c];
+                n["NPrecision"] = FormatFixed(s.metricsNorm[c].precision, 6);
+                n["NRecall"] = FormatFixed(s.metricsNorm[c].recall, 6);
+                n["NF1"] = FormatFixed(s.metricsNorm[c].f1, 6);
+                normRows.push_back(std::move(n));
+            }
+        }
+
+        std::filesystem::path datasetDir = std::filesystem::path(outRoot) / dataset;
+        std::filesystem::create_directories(datasetDir, ec);
+        WriteCsv(datasetDir / "TIMINGS.csv", timingCols, timingRows);
+        WriteCsv(datasetDir / "MIARY_STANDARD.csv", stdCols, stdRows);
+        WriteCsv(datasetDir / "MIARY_ZNORMALIZOWANE.csv", normCols, normRows);
+
+        if (first > 0) {
+            report << "\n";
+        }
+        report << "DATASET: " << dataset << "\n\n"
+               << "TIMINGS(ms)\n"
+               << RenderTable(timingCols, timingRows,
+                              {"k", "read", "preprocess", "classify", "write", "total"}) << "\n\n"
+               << "MIARY_STANDARD (CId)\n"
+               << RenderTable(stdCols, stdRows, {"k", "Precision", "Recall", "F1"}) << "\n\n"
+               << "MIARY_ZNORMALIZOWANE (NCId)\n"
+               << RenderTable(normCols, normRows, {"k", "NPrecision", "NRecall", "NF1"}) << "\n"
+               << "\n" << std::string(80, '=') << "\n";
+        first = last;
+    }
+
+    std::ofstream reportOut(std::filesystem::path(outRoot) / "REPORT.txt", std::ios::binary);
+    reportOut << report.str();
+
+    std::ofstream json(std::filesystem::path(outRoot) / "SUMMARY.json");
+    json << "[\n";
+    for (size_t e = 0; e < summaries.size(); ++e) {
+        const auto& s = summaries[e];
+        json << "  {\"dataset\": " << JsonString(s.dataset)
+             << ", \"algorithm\": " << JsonString(s.algorithm)
+             << ", \"mode\": " << JsonString(s.mode)
+             << ", \"k\": " << s.k
+             << ", \"svdm\": " << JsonString(s.svdm) << ",\n"
+             << "   \"times\": {\"read\": " << FormatFixed(s.timeReadMs, 4)
+             << ", \"preprocess\": " << FormatFixed(s.timePrepMs, 4)
+             << ", \"classify\": " << FormatFixed(s.timeClassifyMs, 4)
+             << ", \"write\": " << FormatFixed(s.timeWriteMs, 4)
+             << ", \"total\": " << FormatFixed(s.timeTotalMs, 4) << "},\n"
+             << "   \"balanced\": {";
+        WriteJsonMetrics(json, "Bal_", ComputeBalanced(s.metricsStd));
+        json << ", ";
+        WriteJsonMetrics(json, "NBal_", ComputeBalanced(s.metricsNorm));
+        json << "},\n   \"perClass\": [";
+        for (size_t c = 0; c < s.classes.size(); ++c) {
+            json << (c ? ",\n                " : "") << "{\"class\": " << JsonString(s.classes[c]) << ", ";
+            WriteJsonMetrics(json, "", s.metricsStd[c]);
+            json << ", ";
+            WriteJsonMetrics(json, "N", s.metricsNorm[c]);
+            json << "}";
+        }
+        json << "]}" << (e + 1 < summaries.size() ? "," : "") << "\n";
+    }
+    json << "]\n";
+
+    if (!reportOut || !json) {
+        err = "Cannot write aggregated report under: " + outRoot;
+        return false;
+    }
+    return true;
+}
\ No newline at end of file
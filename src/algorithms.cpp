@@ -1,6 +1,14 @@
 #include "algorithms.h"
 
+#include "distance_kernel.h"
+#include "prototypes.h"
+#include "trace.h"
+#include "util.h"
+#include "zone_map.h"
+
 #include <algorithm>
+#include <chrono>
+#include <random>
 
 bool SatisfiesGRule(const Dataset& ds,
                     const Stats& stats,
@@ -46,6 +54,93 @@ bool SatisfiesGRule(const Dataset& ds,
     return true;
 }
 
+static double NominalDistanceByIndex(const NominalStat& ns, int i, int j, const DistanceConfig& cfg) {
+    if (i < 0 || j < 0) {
+        return cfg.missingNominal;
+    }
+    return ValueDistance(ns, i, j, cfg);
+}
+
+CompiledGRule CompileGRule(const Dataset& ds,
+                           const Stats& stats,
+                           const DistanceConfig& cfg,
+                           const Instance& tst,
+                           const Instance& trn) {
+    CompiledGRule rule;
+    const size_t m = ds.types.size();
+    for (size_t a = 0; a < m; ++a) {
+        const auto& vTst = tst.attrs[a];
+        const auto& vTrn = trn.attrs[a];
+
+        // Missing values => attribute does not constrain the rule.
+        if (vTst.missing || vTrn.missing) {
+            continue;
+        }
+
+        CompiledGRule::Term term;
+        term.attr = static_cast<int>(a);
+        if (ds.types[a] == AttrType::Numeric) {
+            term.lo = std::min(vTst.num, vTrn.num);
+            term.hi = std::max(vTst.num, vTrn.num);
+
+            // Candidates come from the rows the stats were computed on, so an
+            // interval covering [min, max] admits every value.
+            const auto& ns = stats.numStats[a];
+            if (ns.hasValue && term.lo <= ns.min && term.hi >= ns.max) {
+                continue;
+            }
+            term.selectivity = (ns.range > 0.0) ? (term.hi - term.lo) / ns.range : 0.0;
+        } else {
+            const auto& ns = stats.nomStats[a];
+            const auto& dict = ds.nominalValues[a];
+            auto indexOf = [&](int code) {
+                return (code >= 0 && code < (int)ns.codeIndex.size()) ? ns.codeIndex[code] : -1;
+            };
+            const int iTst = indexOf(vTst.code);
+            const double r = NominalDistanceByIndex(ns, iTst, indexOf(vTrn.code), cfg);
+
+            term.nominal = true;
+            term.accepted.assign((dict.size() + 63) / 64, 0);
+            size_t acceptedCount = 0;
+            for (size_t code = 0; code < dict.size(); ++code) {
+                double d = NominalDistanceByIndex(ns, iTst, indexOf((int)code), cfg);
+                if (d <= r + 1e-12) {
+                    term.accepted[code >> 6] |= uint64_t(1) << (code & 63);
+                    ++acceptedCount;
+                }
+            }
+            if (acceptedCount == dict.size()) {
+                continue;
+            }
+            term.selectivity = (double)acceptedCount / (double)dict.size();
+        }
+        rule.terms.push_back(std::move(term));
+    }
+
+    std::stable_sort(rule.terms.begin(), rule.terms.end(),
+                     [](const CompiledGRule::Term& x, const CompiledGRule::Term& y) {
+                         return x.selectivity < y.selectivity;
+                     });
+    return rule;
+}
+
+bool SatisfiesGRule(const CompiledGRule& rule, const Instance& cand) {
+    for (const auto& term : rule.terms) {
+        const auto& v = cand.attrs[term.attr];
+        if (v.missing) {
+            continue;
+        }
+        if (term.nominal) {
+            if (!((term.accepted[v.code >> 6] >> (v.code & 63)) & 1)) {
+                return false;
+            }
+        } else if (v.num < term.lo || v.num > term.hi) {
+            return false;
+        }
+    }
+    return true;
+}
+
 bool IsConsistentGRule(const Dataset& ds,
                        const Stats& stats,
                        const DistanceConfig& cfg,
@@ -53,46 +148,397 @@ bool IsConsistentGRule(const Dataset& ds,
                        const Instance& trn,
                        const std::vector<int>& verifySet) {
     const std::string& decision = trn.decision;
+    const CompiledGRule rule = CompileGRule(ds, stats, cfg, tst, trn);
     for (int idx : verifySet) {
         const auto& cand = ds.rows[idx];
-        if (cand.decision != decision &&
-            SatisfiesGRule(ds, stats, cfg, cand, tst, trn)) {
+        if (cand.decision != decision && SatisfiesGRule(rule, cand)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+RuleVerifier BuildRuleVerifier(const Dataset& ds, const std::vector<Neighbor>& sortedVerifySet) {
+    const size_t n = sortedVerifySet.size();
+    RuleVerifier verifier;
+    verifier.order.resize(n);
+    verifier.orderClass.resize(n);
+    verifier.nextOther.resize(n);
+    for (size_t p = 0; p < n; ++p) {
+        verifier.order[p] = sortedVerifySet[p].index;
+        verifier.orderClass[p] = ds.decisionIndex.at(ds.rows[sortedVerifySet[p].index].decision);
+    }
+    for (size_t p = n; p-- > 0;) {
+        const bool runEnds = p + 1 == n || verifier.orderClass[p + 1] != verifier.orderClass[p];
+        verifier.nextOther[p] = runEnds ? (int)(p + 1) : verifier.nextOther[p + 1];
+    }
+    verifier.witnesses.reserve(RuleVerifier::kWitnessCacheSize);
+    return verifier;
+}
+
+RuleVerifier BuildZoneRuleVerifier(const Dataset& ds, const Stats& stats, size_t x, const std::vector<int>& rows) {
+    RuleVerifier verifier;
+    verifier.zones = &ds.zones;
+    std::vector<double> bounds;
+    verifier.blockOrder = BlocksByBound(ds, stats.kernel, x, bounds);
+    verifier.member.assign(ds.rows.size(), 0);
+    for (int idx : rows) {
+        verifier.member[idx] = 1;
+    }
+    verifier.witnesses.reserve(RuleVerifier::kWitnessCacheSize);
+    return verifier;
+}
+
+RuleVerifier BuildSampledRuleVerifier(const Dataset& ds,
+                                      const std::vector<Neighbor>& sortedVerifySet,
+                                      const RiaVerifyLimits& limits,
+                                      uint64_t stream) {
+    const size_t d = ds.decisionValues.size();
+
+    // Strata: positions (in distance order) of the rows of each class.
+    std::vector<std::vector<size_t>> strata(d);
+    for (size_t pos = 0; pos < sortedVerifySet.size(); ++pos) {
+        strata[ds.decisionIndex.at(ds.rows[sortedVerifySet[pos].index].decision)].push_back(pos);
+    }
+
+    // Keep the nearest rows of each class plus a seeded random sample of the rest.
+    std::vector<size_t> kept;
+    std::mt19937_64 rng(Mix64(limits.seed ^ Mix64(stream)));
+    for (auto& rows : strata) {
+        const size_t nearest = std::min(rows.size(), (size_t)std::max(0, limits.nearest));
+        const size_t sample = std::min(rows.size() - nearest, (size_t)std::max(0, limits.sample));
+        for (size_t i = 0; i < sample; ++i) {
+            std::uniform_int_distribution<size_t> pick(nearest + i, rows.size() - 1);
+            std::swap(rows[nearest + i], rows[pick(rng)]);
+        }
+        kept.insert(kept.end(), rows.begin(), rows.begin() + (nearest + sample));
+    }
+    std::sort(kept.begin(), kept.end());
+
+    std::vector<Neighbor> bounded;
+    bounded.reserve(kept.size());
+    for (size_t pos : kept) {
+        bounded.push_back(sortedVerifySet[pos]);
+    }
+    return BuildRuleVerifier(ds, bounded);
+}
+
+static void RememberWitness(RuleVerifier& verifier, int idx, int cls) {
+    std::pair<int, int> w(idx, cls);
+    if (verifier.witnesses.size() < RuleVerifier::kWitnessCacheSize) {
+        verifier.witnesses.push_back(w);
+    } else {
+        verifier.witnesses[verifier.nextWitness] = w;
+        verifier.nextWitness = (verifier.nextWitness + 1) % RuleVerifier::kWitnessCacheSize;
+    }
+}
+
+bool IsConsistentGRule(const Dataset& ds,
+                       const Stats& stats,
+                       const DistanceConfig& cfg,
+                       const Instance& tst,
+                       const Instance& trn,
+                       RuleVerifier& verifier) {
+    const int cls = ds.decisionIndex.at(trn.decision);
+    const CompiledGRule rule = CompileGRule(ds, stats, cfg, tst, trn);
+    ++verifier.rules;
+
+    // Witnesses that broke recent rules are the most likely to break this one too.
+    for (const auto& w : verifier.witnesses) {
+        if (w.second != cls) {
+            ++verifier.checks;
+            if (SatisfiesGRule(rule, ds.rows[w.first])) {
+                return false;
+            }
+        }
+    }
+
+    if (verifier.zones) {
+        const ZoneMaps& z = *verifier.zones;
+        const uint64_t own = cls < 64 ? 1ull << cls : 0;
+        const std::vector<uint64_t> folded = FoldAccepted(rule);
+        for (int b : verifier.blockOrder) {
+            if (!(z.classMask[b] & ~own) || !BlockMayMatch(ds, (size_t)b, rule, folded)) {
+                continue;
+            }
+            const size_t end = std::min(z.order.size(), ((size_t)b + 1) * ZoneMaps::kBlockRows);
+            for (size_t p = (size_t)b * ZoneMaps::kBlockRows; p < end; ++p) {
+                const int idx = z.order[p];
+                if (!verifier.member[idx] || z.classOf[idx] == cls) {
+                    continue;
+                }
+                ++verifier.checks;
+                if (SatisfiesGRule(rule, ds.rows[idx])) {
+                    RememberWitness(verifier, idx, z.classOf[idx]);
+                    return false;
+                }
+            }
+        }
+        return true;
+    }
+
+    const size_t n = verifier.order.size();
+    for (size_t p = 0; p < n;) {
+        if (verifier.orderClass[p] == cls) {
+            p = (size_t)verifier.nextOther[p];
+            continue;
+        }
+        const int idx = verifier.order[p];
+        ++verifier.checks;
+        if (SatisfiesGRule(rule, ds.rows[idx])) {
+            RememberWitness(verifier, idx, verifier.orderClass[p]);
             return false;
         }
+        ++p;
     }
     return true;
 }
 
+static bool NearerNeighbor(const Neighbor& a, const Neighbor& b) {
+    if (a.dist != b.dist) return a.dist < b.dist;
+    return a.index < b.index;
+}
+
+// Exact distances, unsorted, of the candidates that can still reach the k-th
+// place (all of them unless a compact or zone path prunes).
+static std::vector<Neighbor> CandidateDistances(const Dataset& ds,
+                                                const Stats& stats,
+                                                const DistanceConfig& cfg,
+                                                const Instance& tst,
+                                                const std::vector<int>& candidates,
+                                                int k) {
+    std::vector<Neighbor> neighbors;
+
+    // --precision f32|u16|u8: rank on the compact columns and recompute exact
+    // distances only for candidates that can still reach the k-th place.
+    const size_t tstRow = static_cast<size_t>(tst.id - 1);
+    const bool inDataset = tstRow < ds.rows.size() && &ds.rows[tstRow] == &tst;
+    if (!stats.pairDist.empty() && inDataset) {
+        // Planner's matrix strategy: distances were computed once for all pairs.
+        neighbors.reserve(candidates.size());
+        for (int idx : candidates) {
+            Neighbor nb;
+            nb.index = idx;
+            nb.dist = PairDistance(stats, ds.rows.size(), tstRow, (size_t)idx);
+            neighbors.push_back(nb);
+        }
+    } else if (!ds.zones.order.empty() && k > 0 && (size_t)k < candidates.size() &&
+               candidates.size() >= 2 * ZoneMaps::kBlockRows && inDataset && stats.kernel.batch &&
+               ds.kernelRows == ds.rows.size()) {
+        // --zone-maps: exact kernel distances, blocks nearest by bound first,
+        // stopping at the first block that cannot reach the k-th place.
+        neighbors = ZoneNeighbors(ds, stats.kernel, tstRow, candidates, k);
+    } else if (ds.precision == Precision::U8 && k > 0 && (size_t)k < candidates.size() && inDataset &&
+               stats.kernel.batch && ds.kernelRows == ds.rows.size()) {
+        // --precision u8: nominal terms from the query's byte tables (whole
+        // columns at once for a near-full candidate list), numeric terms in
+        // float; exact kernel distances for candidates that can reach the k-th place.
+        const NominalQuery query = BuildNominalQuery(ds, stats.kernel, tstRow);
+        std::vector<uint16_t> sums(candidates.size());
+        if (candidates.size() * 2 >= ds.rows.size()) {
+            std::vector<uint16_t> all(ds.rows.size());
+            NominalSums(ds, query, 0, ds.rows.size(), all.data());
+            for (size_t i = 0; i < candidates.size(); ++i) {
+                sums[i] = all[candidates[i]];
+            }
+        } else {
+            for (size_t i = 0; i < candidates.size(); ++i) {
+                sums[i] = NominalSum(ds, query, (size_t)candidates[i]);
+            }
+        }
+        std::vector<double> approx(candidates.size());
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            approx[i] = query.step * sums[i];
+            if (!ds.numericIdx.empty()) {
+                approx[i] += (double)CompactNumericDistance(ds, stats.compact, tstRow, (size_t)candidates[i]);
+            }
+        }
+        std::vector<double> kth = approx;
+        std::nth_element(kth.begin(), kth.begin() + (k - 1), kth.end());
+        const double cutoff = kth[k - 1] + 2.0 * (stats.compact.errorBound + query.errorBound);
+        std::vector<int> near;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if (approx[i] <= cutoff) {
+                near.push_back(candidates[i]);
+            }
+        }
+        std::vector<double> dist(near.size());
+        stats.kernel.batch(ds, stats.kernel, tstRow, near.data(), near.size(), dist.data());
+        neighbors.resize(near.size());
+        for (size_t i = 0; i < near.size(); ++i) {
+            neighbors[i].index = near[i];
+            neighbors[i].dist = dist[i];
+        }
+    } else if (ds.precision != Precision::F64 && ds.precision != Precision::U8 && k > 0 &&
+               (size_t)k < candidates.size() && inDataset) {
+        std::vector<float> approx(candidates.size());
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            approx[i] = CompactDistance(ds, stats.compact, tstRow, (size_t)candidates[i]);
+        }
+        std::vector<float> kth = approx;
+        std::nth_element(kth.begin(), kth.begin() + (k - 1), kth.end());
+        const double cutoff = (double)kth[k - 1] + 2.0 * stats.compact.errorBound;
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            if ((double)approx[i] <= cutoff) {
+                Neighbor nb;
+                nb.index = candidates[i];
+                nb.dist = InstanceDistance(ds, stats, cfg, tst, ds.rows[nb.index]);
+                neighbors.push_back(nb);
+            }
+        }
+    } else if (stats.kernel.batch && inDataset && ds.kernelRows == ds.rows.size()) {
+        // Metric/layout-specialized kernel chosen once for these stats.
+        std::vector<double> dist(candidates.size());
+        stats.kernel.batch(ds, stats.kernel, tstRow, candidates.data(), candidates.size(), dist.data());
+        neighbors.resize(candidates.size());
+        for (size_t i = 0; i < candidates.size(); ++i) {
+            neighbors[i].index = candidates[i];
+            neighbors[i].dist = dist[i];
+        }
+    } else {
+        neighbors.reserve(candidates.size());
+        for (int idx : candidates) {
+            const auto& trn = ds.rows[idx];
+            Neighbor nb;
+            nb.index = idx;
+            nb.dist = InstanceDistance(ds, stats, cfg, tst, trn);
+            neighbors.push_back(nb);
+        }
+    }
+    return neighbors;
+}
+
 std::vector<Neighbor> ComputeNeighbors(const Dataset& ds,
                                        const Stats& stats,
                                        const DistanceConfig& cfg,
                                        const Instance& tst,
                                        const std::vector<int>& candidates,
                                        int k) {
-    std::vector<Neighbor> neighbors;
-    neighbors.reserve(candidates.size());
-
-    for (int idx : candidates) {
-        const auto& trn = ds.rows[idx];
-        Neighbor nb;
-        nb.index = idx;
-        nb.dist = InstanceDistance(ds, stats, cfg, tst, trn);
-        neighbors.push_back(nb);
-    }
-
-    std::sort(neighbors.begin(), neighbors.end(),
-              [](const Neighbor& a, const Neighbor& b) {
-                  if (a.dist != b.dist) return a.dist < b.dist;
-                  return a.index < b.index;
-              });
+    TraceSpan span("neighbors");
+    std::vector<Neighbor> neighbors = CandidateDistances(ds, stats, cfg, tst, candidates, k);
 
+    // (dist, index) is a total order, so sorting only the first k is exact.
     if (k > (int)neighbors.size()) {
         k = static_cast<int>(neighbors.size());
     }
-    neighbors.resize(k);
+    std::partial_sort(neighbors.begin(), neighbors.begin() + std::max(k, 0), neighbors.end(), NearerNeighbor);
+    neighbors.resize(std::max(k, 0));
+    neighbors.shrink_to_fit(); // drivers keep one list per object
     return neighbors;
 }
 
+// --dedup: distances once per (prototype, class) group, expanded to the k
+// nearest rows in ComputeNeighbors order. Every group holds a row, so the k
+// nearest representatives cover k rows; only they and the groups tied with
+// the k-th (which may hold rows of lower index) are sorted.
+static std::vector<Neighbor> NearestInGroups(const Dataset& ds,
+                                             const Stats& stats,
+                                             const DistanceConfig& cfg,
+                                             const Instance& tst,
+                                             const RowGroups& groups,
+                                             int k) {
+    TraceSpan span("neighbors");
+    std::vector<Neighbor> ranked = CandidateDistances(ds, stats, cfg, tst, groups.rows, (int)groups.rows.size());
+    const size_t covered = std::min((size_t)std::max(k, 0), ranked.size());
+    std::partial_sort(ranked.begin(), ranked.begin() + covered, ranked.end(), NearerNeighbor);
+    if (covered > 0) {
+        const double last = ranked[covered - 1].dist;
+        auto tied = std::partition(ranked.begin() + covered, ranked.end(),
+                                   [last](const Neighbor& nb) { return nb.dist == last; });
+        ranked.erase(tied, ranked.end());
+    } else {
+        ranked.clear();
+    }
+    return ExpandNeighbors(ds, groups, ranked, k);
+}
+
+static std::vector<Neighbor> NearestRows(const Dataset& ds,
+                                         const Stats& stats,
+                                         const DistanceConfig& cfg,
+                                         const Instance& tst,
+                                         const std::vector<int>& candidates,
+                                         int k) {
+    if (ds.prototypeOf.empty()) {
+        return ComputeNeighbors(ds, stats, cfg, tst, candidates, k);
+    }
+    return NearestInGroups(ds, stats, cfg, tst, GroupRows(ds, candidates), k);
+}
+
+// --neighbor-cache: the k nearest of all other rows, ranked Depth() deep and
+// stored on a miss (k beyond Depth() is ranked as usual). Other candidate
+// lists (pools, budgets) are not cached. `lookup` gets 1 on a hit, 0 on a miss.
+static std::vector<Neighbor> CachedNearestRows(const Dataset& ds,
+                                               const Stats& stats,
+                                               const DistanceConfig& cfg,
+                                               int tstIdx,
+                                               const std::vector<int>& candidates,
+                                               int k,
+                                               NeighborCache* neighborCache,
+                                               int& lookup) {
+    const Instance& tst = ds.rows[tstIdx];
+    if (!neighborCache || candidates.size() + 1 != ds.rows.size() || k <= 0) {
+        return NearestRows(ds, stats, cfg, tst, candidates, k);
+    }
+    std::vector<Neighbor> ranked;
+    lookup = neighborCache->Find((size_t)tstIdx, (size_t)k, ranked) ? 1 : 0;
+    if (lookup) {
+        return ranked;
+    }
+    if ((size_t)k > neighborCache->Depth()) {
+        return NearestRows(ds, stats, cfg, tst, candidates, k);
+    }
+    ranked = NearestRows(ds, stats, cfg, tst, candidates, (int)neighborCache->Depth());
+    neighborCache->Store((size_t)tstIdx, ranked);
+    if (ranked.size() > (size_t)k) {
+        ranked.resize(k);
+        ranked.shrink_to_fit();
+    }
+    return ranked;
+}
+
+// Wall time and rules of one query measured against its budget.
+class BudgetMeter {
+public:
+    explicit BudgetMeter(const QueryBudget& budget) : budget(budget), start(std::chrono::steady_clock::now()) {}
+
+    bool Spent(size_t rules) const {
+        if (budget.ruleChecks > 0 && rules >= budget.ruleChecks) {
+            return true;
+        }
+        return budget.timeMs > 0.0 &&
+               std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >=
+                   budget.timeMs;
+    }
+
+private:
+    const QueryBudget& budget;
+    std::chrono::steady_clock::time_point start;
+};
+
+// Candidates within the distance budget: budget.distances rows spread evenly
+// over the list (files are often sorted by class, so a prefix would not do).
+static const std::vector<int>& BudgetCandidates(const std::vector<int>& rows,
+                                                const QueryBudget& budget,
+                                                std::vector<int>& kept,
+                                                bool& partial) {
+    if (budget.distances == 0 || rows.size() <= budget.distances) {
+        return rows;
+    }
+    kept.resize(budget.distances);
+    for (size_t j = 0; j < kept.size(); ++j) {
+        kept[j] = rows[j * rows.size() / kept.size()];
+    }
+    partial = true;
+    return kept;
+}
+
+// A partial query without votes decides by its nearest neighbor.
+static void VoteNearestIfEmpty(const Dataset& ds, const std::vector<Neighbor>& ranked, std::vector<int>& support) {
+    if (!ranked.empty() && std::all_of(support.begin(), support.end(), [](int s) { return s == 0; })) {
+        support[ds.decisionIndex.at(ds.rows[ranked.front().index].decision)] = 1;
+    }
+}
+
 std::string ChooseClass(const Dataset& ds,
                         const std::vector<int>& supportCounts,
                         const std::vector<int>& classSizes,
@@ -142,8 +588,16 @@ ClassificationResult ClassifyKPlusNN(const Dataset& ds,
                                      const std::vector<int>& trainingIdx,
                                      int tstIdx,
                                      int k,
-                                     int nLocal) {
+                                     int nLocal,
+                                     const std::vector<int>* neighborPool,
+                                     const QueryBudget& budget,
+                                     NeighborCache* neighborCache) {
+    const BudgetMeter meter(budget);
     const auto& tst = ds.rows[tstIdx];
+    bool partial = false;
+    std::vector<int> kept;
+    const std::vector<int>& candidates =
+        BudgetCandidates(neighborPool ? *neighborPool : trainingIdx, budget, kept, partial);
 
     // Step 1: pick N(x, nLocal) using base (global or local) distance.
     if (nLocal < k) {
@@ -153,18 +607,42 @@ ClassificationResult ClassifyKPlusNN(const Dataset& ds,
         nLocal = static_cast<int>(trainingIdx.size());
     }
 
-    std::vector<Neighbor> neighborsN = ComputeNeighbors(ds, baseStats, cfg, tst, trainingIdx, nLocal);
+    int cacheLookup = -1;
+    std::vector<Neighbor> neighborsN =
+        !neighborPool && !partial
+            ? CachedNearestRows(ds, baseStats, cfg, tstIdx, candidates, nLocal, neighborCache, cacheLookup)
+            : NearestRows(ds, baseStats, cfg, tst, candidates, nLocal);
     std::vector<int> nIdx;
     nIdx.reserve(neighborsN.size());
     for (const auto& nb : neighborsN) {
         nIdx.push_back(nb.index);
     }
 
-    // Step 2: induce local SVDM on N(x, nLocal)
-    Stats localStats = ComputeStats(ds, nIdx, cfg);
+    // Out of time after the ranking: vote with the k nearest under the base
+    // stats instead of re-ranking them with the local SVDM.
+    std::vector<Neighbor> neighborsK;
+    if (meter.Spent(0)) {
+        partial = true;
+        neighborsK.assign(neighborsN.begin(), neighborsN.begin() + std::min((size_t)k, neighborsN.size()));
+    } else {
+        // Step 2: induce local SVDM on N(x, nLocal)
+        const bool collapse = !ds.prototypeOf.empty();
+        RowGroups groups;
+        Stats localStats;
+        {
+            TraceSpan span("stats k+NN local");
+            if (collapse) {
+                groups = GroupRows(ds, nIdx);
+                localStats = ComputeStats(ds, groups.rows, cfg, &groups.weights);
+            } else {
+                localStats = ComputeStats(ds, nIdx, cfg);
+            }
+        }
 
-    // Step 3: choose k nearest neighbors using local SVDM.
-    std::vector<Neighbor> neighborsK = ComputeNeighbors(ds, localStats, cfg, tst, nIdx, k);
+        // Step 3: choose k nearest neighbors using local SVDM.
+        neighborsK = collapse ? NearestInGroups(ds, localStats, cfg, tst, groups, k)
+                              : ComputeNeighbors(ds, localStats, cfg, tst, nIdx, k);
+    }
 
     // Support counts for standard/normalized decisions.
     std::vector<int> support(ds.decisionValues.size(), 0);
@@ -172,11 +650,15 @@ ClassificationResult ClassifyKPlusNN(const Dataset& ds,
         int cls = ds.decisionIndex.at(ds.rows[nb.index].decision);
         support[cls] += 1;
     }
-    std::vector<int> classSizes = ComputeClassSizes(ds, trainingIdx);
-
     ClassificationResult res;
-    res.predictedStandard = ChooseClass(ds, support, classSizes, false);
-    res.predictedNormalized = ChooseClass(ds, support, classSizes, true);
+    {
+        TraceSpan span("vote");
+        std::vector<int> classSizes = ComputeClassSizes(ds, trainingIdx);
+        res.predictedStandard = ChooseClass(ds, support, classSizes, false);
+        res.predictedNormalized = ChooseClass(ds, support, classSizes, true);
+    }
+    res.partial = partial;
+    res.cacheLookup = cacheLookup;
     res.knnList = std::move(neighborsK);
     return res;
 }
@@ -186,63 +668,242 @@ ClassificationResult ClassifyRIA(const Dataset& ds,
                                  const Stats& stats,
                                  const std::vector<int>& trainingIdx,
                                  int tstIdx,
-                                 int kForReport) {
+                                 int kForReport,
+                                 const RiaVerifyLimits& limits,
+                                 ConsistencyCache* cache,
+                                 const QueryBudget& budget) {
+    const BudgetMeter meter(budget);
     const auto& tst = ds.rows[tstIdx];
+    const bool exact = limits.nearest <= 0;
+    bool partial = false;
+    std::vector<int> kept;
+    const std::vector<int>& candidates = BudgetCandidates(trainingIdx, budget, kept, partial);
+
+    // Decided by an earlier RIA run with the same stats: vote from the
+    // cached rules, rank only the neighbors reported for this k.
+    if (cache && exact && !partial && cache->Has(tstIdx)) {
+        std::vector<int> support(ds.decisionValues.size(), 0);
+        for (int idx : trainingIdx) {
+            if (cache->Consistent(tstIdx, idx)) {
+                support[ds.decisionIndex.at(ds.rows[idx].decision)] += 1;
+            }
+        }
+        ClassificationResult res;
+        std::vector<int> classSizes = ComputeClassSizes(ds, trainingIdx);
+        res.predictedStandard = ChooseClass(ds, support, classSizes, false);
+        res.predictedNormalized = ChooseClass(ds, support, classSizes, true);
+        res.knnList = NearestRows(ds, stats, cfg, tst, trainingIdx, kForReport);
+        return res;
+    }
+    if (cache && exact) {
+        cache->Clear(tstIdx);
+    }
+
+    // With --dedup the rules and the ranking run over (prototype, class)
+    // groups; the sampled verifier keeps sampling rows.
+    const bool collapse = !ds.prototypeOf.empty() && exact;
+    RowGroups groups;
+    if (collapse) {
+        groups = GroupRows(ds, candidates);
+    }
+    const std::vector<int>& ruleRows = collapse ? groups.rows : candidates;
+
+    // Full ranking of the training set: drives the verification order
+    // (nearest enemies first) and provides the k nearest neighbors for the report.
+    // With --zone-maps the verifier scans blocks by bound instead, so only the
+    // reported neighbors are ranked (unless a budget needs the rules nearest first).
+    const bool budgeted = budget.Active();
+    const bool zoneScan = exact && !collapse && !budgeted && !ds.zones.order.empty() && stats.kernel.batch &&
+                          ds.kernelRows == ds.rows.size();
+    std::vector<Neighbor> ranked =
+        ComputeNeighbors(ds, stats, cfg, tst, ruleRows, zoneScan ? kForReport : (int)ruleRows.size());
+    RuleVerifier verifier;
+    if (limits.nearest > 0) {
+        verifier = BuildSampledRuleVerifier(ds, ranked, limits, (uint64_t)tstIdx);
+    } else if (zoneScan) {
+        verifier = BuildZoneRuleVerifier(ds, stats, (size_t)tstIdx, ruleRows);
+    } else {
+        verifier = BuildRuleVerifier(ds, ranked);
+    }
 
     std::vector<int> support(ds.decisionValues.size(), 0);
 
-    // For each training example: check if g-rule is consistent with the whole training set.
-    for (int idx : trainingIdx) {
-        const auto& trn = ds.rows[idx];
-        if (IsConsistentGRule(ds, stats, cfg, tst, trn, trainingIdx)) {
-            int cls = ds.decisionIndex.at(trn.decision);
-            support[cls] += 1;
+    // Under a budget the rules go nearest first, so the votes gathered before
+    // it runs out are those of the closest rows.
+    std::vector<size_t> order;
+    if (budgeted) {
+        std::vector<int> position(ds.rows.size(), -1);
+        for (size_t i = 0; i < ruleRows.size(); ++i) {
+            position[ruleRows[i]] = (int)i;
+        }
+        for (const auto& nb : ranked) {
+            order.push_back((size_t)position[nb.index]);
         }
     }
 
-    std::vector<int> classSizes = ComputeClassSizes(ds, trainingIdx);
+    // For each training example: check if g-rule is consistent with the whole training set.
+    {
+        TraceSpan span("consistency");
+        for (size_t r = 0; r < ruleRows.size(); ++r) {
+            if (budgeted && meter.Spent(verifier.rules)) {
+                partial = true;
+                break;
+            }
+            const size_t i = budgeted ? order[r] : r;
+            const auto& trn = ds.rows[ruleRows[i]];
+            if (IsConsistentGRule(ds, stats, cfg, tst, trn, verifier)) {
+                int cls = ds.decisionIndex.at(trn.decision);
+                support[cls] += collapse ? groups.weights[i] : 1;
+                if (cache && exact && collapse) {
+                    for (int j = groups.start[i]; j < groups.start[i + 1]; ++j) {
+                        cache->Set(tstIdx, groups.members[j]);
+                    }
+                } else if (cache && exact) {
+                    cache->Set(tstIdx, ruleRows[i]);
+                }
+            }
+        }
+    }
+    if (cache && exact) {
+        if (partial) {
+            cache->Clear(tstIdx);
+        } else {
+            cache->MarkFilled(tstIdx);
+        }
+    }
+    if (partial) {
+        VoteNearestIfEmpty(ds, ranked, support);
+    }
 
     ClassificationResult res;
-    res.predictedStandard = ChooseClass(ds, support, classSizes, false);
-    res.predictedNormalized = ChooseClass(ds, support, classSizes, true);
+    {
+        TraceSpan span("vote");
+        // Rules vote from the candidates, so normalization uses their class sizes.
+        std::vector<int> classSizes = ComputeClassSizes(ds, candidates);
+        res.predictedStandard = ChooseClass(ds, support, classSizes, false);
+        res.predictedNormalized = ChooseClass(ds, support, classSizes, true);
+    }
+
+    res.ruleChecks = verifier.rules;
+    res.consistencyChecks = verifier.checks;
+    res.partial = partial;
 
     // For the kNN output file we still provide k nearest neighbors.
-    res.knnList = ComputeNeighbors(ds, stats, cfg, tst, trainingIdx, kForReport);
+    if (collapse) {
+        ranked = ExpandNeighbors(ds, groups, ranked, kForReport);
+    } else if (kForReport < (int)ranked.size()) {
+        ranked.resize(kForReport);
+    }
+    res.knnList = std::move(ranked);
     return res;
 }
 
-ClassificationResult ClassifyRIONA(const Dataset& ds,
-                                   const DistanceConfig& cfg,
-                                   const Stats& stats,
-                                   const std::vector<int>& trainingIdx,
-                                   int tstIdx,
-                                   int k) {
-    const auto& tst = ds.rows[tstIdx];
+// tstIdx is the row of tst in ds, or -1 for an object outside ds (no cache).
+static ClassificationResult ClassifyRIONAObject(const Dataset& ds,
+                                                const DistanceConfig& cfg,
+                                                const Stats& stats,
+                                                const std::vector<int>& trainingIdx,
+                                                const Instance& tst,
+                                                int tstIdx,
+                                                int k,
+                                                const std::vector<int>* neighborPool,
+                                                const ConsistencyCache* cache,
+                                                const QueryBudget& budget,
+                                                NeighborCache* neighborCache) {
+    const BudgetMeter meter(budget);
+    bool partial = false;
+    std::vector<int> kept;
+    const std::vector<int>& candidates =
+        BudgetCandidates(neighborPool ? *neighborPool : trainingIdx, budget, kept, partial);
 
     // Neighborhood N(tst, k)
-    std::vector<Neighbor> neighbors = ComputeNeighbors(ds, stats, cfg, tst, trainingIdx, k);
+    int cacheLookup = -1;
+    std::vector<Neighbor> neighbors =
+        tstIdx >= 0 && !neighborPool && !partial
+            ? CachedNearestRows(ds, stats, cfg, tstIdx, candidates, k, neighborCache, cacheLookup)
+            : NearestRows(ds, stats, cfg, tst, candidates, k);
     std::vector<int> nIdx;
     nIdx.reserve(neighbors.size());
     for (const auto& nb : neighbors) {
         nIdx.push_back(nb.index);
     }
 
+    // With --dedup each (prototype, class) group of the neighborhood is one
+    // rule and one verify row; the group representatives keep distance order.
+    const bool collapse = !ds.prototypeOf.empty();
+    RowGroups groups;
+    std::vector<Neighbor> verifyList;
+    if (collapse) {
+        groups = GroupRows(ds, nIdx);
+        for (const auto& nb : neighbors) {
+            if (groups.rows[GroupOf(ds, groups, nb.index)] == nb.index) {
+                verifyList.push_back(nb);
+            }
+        }
+    }
+    const std::vector<int>& ruleRows = collapse ? groups.rows : nIdx;
+    RuleVerifier verifier = BuildRuleVerifier(ds, collapse ? verifyList : neighbors);
+
     std::vector<int> support(ds.decisionValues.size(), 0);
 
-    // For each neighbor, check g-rule consistency with the neighborhood.
-    for (int idx : nIdx) {
-        const auto& trn = ds.rows[idx];
-        if (IsConsistentGRule(ds, stats, cfg, tst, trn, nIdx)) {
-            int cls = ds.decisionIndex.at(trn.decision);
-            support[cls] += 1;
+    // For each neighbor, nearest first, check g-rule consistency with the neighborhood.
+    // Rules consistent with the whole training set (known from RIA) hold here too.
+    const bool cached = cache && tstIdx >= 0 && cache->Has(tstIdx);
+    const bool budgeted = budget.Active();
+    {
+        TraceSpan span("consistency");
+        for (size_t i = 0; i < ruleRows.size(); ++i) {
+            if (budgeted && meter.Spent(verifier.rules)) {
+                partial = true;
+                break;
+            }
+            const auto& trn = ds.rows[ruleRows[i]];
+            if ((cached && cache->Consistent(tstIdx, ruleRows[i])) ||
+                IsConsistentGRule(ds, stats, cfg, tst, trn, verifier)) {
+                int cls = ds.decisionIndex.at(trn.decision);
+                support[cls] += collapse ? groups.weights[i] : 1;
+            }
         }
     }
-
-    std::vector<int> classSizes = ComputeClassSizes(ds, trainingIdx);
+    if (partial) {
+        VoteNearestIfEmpty(ds, neighbors, support);
+    }
 
     ClassificationResult res;
-    res.predictedStandard = ChooseClass(ds, support, classSizes, false);
-    res.predictedNormalized = ChooseClass(ds, support, classSizes, true);
+    {
+        TraceSpan span("vote");
+        std::vector<int> classSizes = ComputeClassSizes(ds, trainingIdx);
+        res.predictedStandard = ChooseClass(ds, support, classSizes, false);
+        res.predictedNormalized = ChooseClass(ds, support, classSizes, true);
+    }
+    res.ruleChecks = verifier.rules;
+    res.consistencyChecks = verifier.checks;
+    res.partial = partial;
+    res.cacheLookup = cacheLookup;
     res.knnList = std::move(neighbors);
     return res;
+}
+
+ClassificationResult ClassifyRIONA(const Dataset& ds,
+                                   const DistanceConfig& cfg,
+                                   const Stats& stats,
+                                   const std::vector<int>& trainingIdx,
+                                   int tstIdx,
+                                   int k,
+                                   const std::vector<int>* neighborPool,
+                                   const ConsistencyCache* cache,
+                                   const QueryBudget& budget,
+                                   NeighborCache* neighborCache) {
+    return ClassifyRIONAObject(ds, cfg, stats, trainingIdx, ds.rows[tstIdx], tstIdx, k, neighborPool, cache, budget,
+                               neighborCache);
+}
+
+ClassificationResult ClassifyRIONA(const Dataset& ds,
+                                   const DistanceConfig& cfg,
+                                   const Stats& stats,
+                                   const std::vector<int>& trainingIdx,
+                                   const Instance& tst,
+                                   int k,
+                                   const QueryBudget& budget) {
+    return ClassifyRIONAObject(ds, cfg, stats, trainingIdx, tst, -1, k, nullptr, nullptr, budget, nullptr);
 }
\ No newline at end of file
@@ -0,0 +1,272 @@
+#include "checkpoint.h"
+
+#include "metrics.h"
+#include "util.h"
+
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#include <io.h>
+#else
+#include <unistd.h>
+#endif
+
+static void WriteMatrix(std::ostream& out, const char* key, const std::vector<std::vector<int>>& conf) {
+    out << key << ":";
+    for (const auto& row : conf) {
+        for (int v : row) {
+            out << " " << v;
+        }
+    }
+    out << "\n";
+}
+
+static bool ReadMatrix(std::istream& ss, size_t d, std::vector<std::vector<int>>& conf) {
+    conf = InitMatrix(d);
+    for (auto& row : conf) {
+        for (int& v : row) {
+            if (!(ss >> v)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+// Writes (or appends) data and syncs it to disk before returning.
+static bool WriteSynced(const std::string& path, const std::string& data, bool append, std::string& err) {
+    std::FILE* f = std::fopen(path.c_str(), append ? "ab" : "wb");
+    if (!f) {
+        err = "Cannot write checkpoint: " + path;
+        return false;
+    }
+    bool ok = std::fwrite(data.data(), 1, data.size(), f) == data.size() && std::fflush(f) == 0;
+#ifdef _WIN32
+    ok = ok && _commit(_fileno(f)) == 0;
+#else
+    ok = ok && fsync(fileno(f)) == 0;
+#endif
+    ok = std::fclose(f) == 0 && ok;
+    if (!ok) {
+        err = "Cannot write checkpoint: " + path;
+    }
+    return ok;
+}
+
+bool SaveCheckpoint(const std::string& path,
+                    const Dataset& ds,
+                    CheckpointState& state,
+                    const std::vector<std::string>& predStd,
+                    const std::vector<std::string>& predNorm,
+                    const std::vector<std::vector<Neighbor>>& knnLists,
+                    std::string& err) {
+    const std::string rowsPath = path + ".rows";
+    if (!state.complete && !state.streaming) {
+        // Drop whatever an interrupted save appended past the recorded size.
+        std::error_code ec;
+        if (state.rowsDone <= state.begin) {
+            state.rowsDone = state.begin;
+            state.rowsBytes = 0;
+        }
+        if (std::filesystem::exists(rowsPath, ec) && std::filesystem::file_size(rowsPath, ec) != state.rowsBytes) {
+            std::filesystem::resize_file(rowsPath, state.rowsBytes, ec);
+            if (ec) {
+                err = "Cannot truncate checkpoint rows " + rowsPath + ": " + ec.message();
+                return false;
+            }
+        }
+        // One line per row: stdClass normClass count (index dist)*
+        std::ostringstream rows;
+        rows.precision(17);
+        for (size_t i = state.rowsDone; i < state.done; ++i) {
+            const size_t slot = i - state.begin;
+            rows << ds.decisionIndex.at(predStd[slot]) << " "
+                 << ds.decisionIndex.at(predNorm[slot]) << " "
+                 << knnLists[slot].size();
+            for (const auto& nb : knnLists[slot]) {
+                rows << " " << nb.index << " " << nb.dist;
+            }
+            rows << "\n";
+        }
+        const std::string appended = rows.str();
+        if (!WriteSynced(rowsPath, appended, state.rowsBytes > 0, err)) {
+            return false;
+        }
+        state.rowsDone = state.done;
+        state.rowsBytes += appended.size();
+    }
+
+    std::ostringstream out;
+    out.precision(17);
+    out << "Cell: " << state.cell << "\n";
+    out << "Key: " << std::hex << state.key << std::dec << "\n";
+    out << "Rows: " << state.begin << " " << state.end << "\n";
+    out << "Done: " << state.done << "\n";
+    out << "Complete: " << (state.complete ? 1 : 0) << "\n";
+    out << "ClassifyMs: " << state.timeClassifyMs << "\n";
+    out << "Partial: " << state.partial << "\n";
+    out << "Times: " << state.timeReadMs << " " << state.timePrepMs << " " << state.timeWriteMs << "\n";
+    out << "Streaming: " << (state.streaming ? 1 : 0) << " " << state.outBytes << " " << state.knnBytes << "\n";
+    out << "RowsFile: " << state.rowsBytes << "\n";
+    WriteMatrix(out, "ConfusionStandard", state.confStd);
+    WriteMatrix(out, "ConfusionNormalized", state.confNorm);
+    out << "Latency: ";
+    state.latency.Write(out);
+    out << "\n";
+    for (const auto& s : state.slowest) {
+        out << "Slow: " << s.row << " " << s.latencyNs << " " << s.neighbors << " " << s.ruleChecks << " "
+            << s.consistencyChecks << "\n";
+    }
+    const auto& ria = state.ria;
+    out << "RiaApprox: " << ria.heldOut << " " << ria.disagreeStd << " " << ria.disagreeNorm << " "
+        << ria.exactCorrectStd << " " << ria.approxCorrectStd << " " << ria.exactCorrectNorm << " "
+        << ria.approxCorrectNorm << "\n";
+    const auto& lsh = state.lsh;
+    out << "Lsh: " << lsh.queries << " " << lsh.fallbacks << " " << lsh.candidateSum << " " << lsh.checked << " "
+        << lsh.exactNeighbors << " " << lsh.foundNeighbors << "\n";
+    out << "NeighborCache: " << state.cacheHits << " " << state.cacheMisses << "\n";
+    out << "End\n";
+
+    const std::string tmpPath = path + ".tmp";
+    if (!WriteSynced(tmpPath, out.str(), false, err)) {
+        return false;
+    }
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec) {
+        err = "Cannot replace checkpoint " + path + ": " + ec.message();
+        return false;
+    }
+    if (state.complete || state.streaming) {
+        std::filesystem::remove(rowsPath, ec);
+    }
+    return true;
+}
+
+bool LoadCheckpoint(const std::string& path,
+                    const Dataset& ds,
+                    CheckpointState& state,
+                    std::vector<std::string>& predStd,
+                    std::vector<std::string>& predNorm,
+                    std::vector<std::vector<Neighbor>>& knnLists,
+                    std::string& err) {
+    std::ifstream in(path);
+    if (!in) {
+        err = "Cannot open checkpoint: " + path;
+        return false;
+    }
+
+    const size_t d = ds.decisionValues.size();
+    CheckpointState loaded;
+    std::string line;
+    int complete = 0;
+    int streaming = 0;
+    bool ended = false;
+    bool rowsFile = false;
+    bool fieldsOk = true;
+    while (!ended && std::getline(in, line)) {
+        std::istringstream ss(line.substr(line.find(':') + 1));
+        if (StartsWithNoCase(line, "Cell:")) {
+            loaded.cell = Trim(ss.str());
+        } else if (StartsWithNoCase(line, "Key:")) {
+            ss >> std::hex >> loaded.key;
+        } else if (StartsWithNoCase(line, "Rows:")) {
+            ss >> loaded.begin >> loaded.end;
+        } else if (StartsWithNoCase(line, "Done:")) {
+            ss >> loaded.done;
+        } else if (StartsWithNoCase(line, "Complete:")) {
+            ss >> complete;
+        } else if (StartsWithNoCase(line, "ClassifyMs:")) {
+            ss >> loaded.timeClassifyMs;
+        } else if (StartsWithNoCase(line, "Partial:")) {
+            ss >> loaded.partial;
+        } else if (StartsWithNoCase(line, "Times:")) {
+            ss >> loaded.timeReadMs >> loaded.timePrepMs >> loaded.timeWriteMs;
+        } else if (StartsWithNoCase(line, "Streaming:")) {
+            ss >> streaming >> loaded.outBytes >> loaded.knnBytes;
+        } else if (StartsWithNoCase(line, "RowsFile:")) {
+            rowsFile = static_cast<bool>(ss >> loaded.rowsBytes);
+        } else if (StartsWithNoCase(line, "ConfusionStandard:")) {
+            fieldsOk = ReadMatrix(ss, d, loaded.confStd) && fieldsOk;
+        } else if (StartsWithNoCase(line, "ConfusionNormalized:")) {
+            fieldsOk = ReadMatrix(ss, d, loaded.confNorm) && fieldsOk;
+        } else if (StartsWithNoCase(line, "Latency:")) {
+            fieldsOk = loaded.latency.Read(ss) && fieldsOk;
+        } else if (StartsWithNoCase(line, "Slow:")) {
+            SlowObject s;
+            fieldsOk = static_cast<bool>(ss >> s.row >> s.latencyNs >> s.neighbors >> s.ruleChecks >>
+                                         s.consistencyChecks) && s.row < ds.rows.size() && fieldsOk;
+            loaded.slowest.push_back(s);
+        } else if (StartsWithNoCase(line, "RiaApprox:")) {
+            auto& ria = loaded.ria;
+            fieldsOk = static_cast<bool>(ss >> ria.heldOut >> ria.disagreeStd >> ria.disagreeNorm >>
+                                         ria.exactCorrectStd >> ria.approxCorrectStd >> ria.exactCorrectNorm >>
+                                         ria.approxCorrectNorm) && fieldsOk;
+        } else if (StartsWithNoCase(line, "Lsh:")) {
+            auto& lsh = loaded.lsh;
+            fieldsOk = static_cast<bool>(ss >> lsh.queries >> lsh.fallbacks >> lsh.candidateSum >> lsh.checked >>
+                                         lsh.exactNeighbors >> lsh.foundNeighbors) && fieldsOk;
+        } else if (StartsWithNoCase(line, "NeighborCache:")) {
+            fieldsOk = static_cast<bool>(ss >> loaded.cacheHits >> loaded.cacheMisses) && fieldsOk;
+        } else if (line == "End") {
+            ended = true;
+        }
+    }
+    loaded.complete = (complete != 0);
+    loaded.streaming = (streaming != 0);
+
+    if (!ended) {
+        err = "Truncated checkpoint: " + path;
+        return false;
+    }
+    if (!rowsFile || !fieldsOk || loaded.confStd.size() != d || loaded.confNorm.size() != d ||
+        loaded.cell != state.cell || loaded.key != state.key || loaded.begin != state.begin || loaded.end != state.end ||
+        loaded.streaming != state.streaming || loaded.done < loaded.begin || loaded.done > loaded.end) {
+        err = "Checkpoint does not match this experiment: " + path;
+        return false;
+    }
+
+    loaded.rowsDone = loaded.done;
+    if (!loaded.complete && !loaded.streaming && loaded.done > loaded.begin) {
+        // Only the recorded part of the rows file belongs to this state.
+        std::ifstream rowsIn(path + ".rows", std::ios::binary);
+        std::string rows(loaded.rowsBytes, '\0');
+        if (!rowsIn.read(&rows[0], (std::streamsize)rows.size())) {
+            err = "Truncated checkpoint: " + path + ".rows";
+            return false;
+        }
+        std::istringstream rowsSs(rows);
+        for (size_t i = loaded.begin; i < loaded.done; ++i) {
+            if (!std::getline(rowsSs, line)) {
+                err = "Truncated checkpoint: " + path + ".rows";
+                return false;
+            }
+            std::istringstream ss(line);
+            int s = -1;
+            int n = -1;
+            size_t count = 0;
+            ss >> s >> n >> count;
+            if (!ss || s < 0 || s >= (int)d || n < 0 || n >= (int)d) {
+                err = "Invalid checkpoint row in " + path + ".rows";
+                return false;
+            }
+            const size_t slot = i - loaded.begin;
+            predStd[slot] = ds.decisionValues[s];
+            predNorm[slot] = ds.decisionValues[n];
+            knnLists[slot].resize(count);
+            for (auto& nb : knnLists[slot]) {
+                ss >> nb.index >> nb.dist;
+            }
+            if (!ss) {
+                err = "Invalid checkpoint row in " + path + ".rows";
+                return false;
+            }
+        }
+    }
+
+    state = loaded;
+    return true;
+}
\ No newline at end of file
@@ -0,0 +1,18 @@
+#include "consistency_cache.h"
+
+#include <algorithm>
+
+void ConsistencyCache::Init(size_t rows) {
+    words = (rows + 63) / 64;
+    bits.assign(rows * words, 0);
+    filled.assign(rows, 0);
+}
+
+uint64_t ConsistencyCache::BytesFor(size_t rows) {
+    return (uint64_t)rows * ((rows + 63) / 64) * sizeof(uint64_t) + rows;
+}
+
+void ConsistencyCache::Clear(size_t tst) {
+    filled[tst] = 0;
+    std::fill(bits.begin() + tst * words, bits.begin() + (tst + 1) * words, 0);
+}
\ No newline at end of file
@@ -1,13 +1,141 @@
 #include "distance.h"
 
+#include "distance_kernel.h"
+
 #include <algorithm>
 #include <cmath>
 #include <limits>
+#include <thread>
 #include <unordered_map>
 
+static constexpr uint16_t kMissingU16 = 0xFFFF;
+
+static const double kUnitRoundoff = std::ldexp(1.0, -24); // float32
+
+static void FillCompactNumeric(const Dataset& ds, const Stats& stats, const DistanceConfig& cfg, CompactMetric& cm, size_t s) {
+    const double u = kUnitRoundoff;
+    const auto& ns = stats.numStats[ds.numericIdx[s]];
+    double weight = 0.0;
+    double err = 0.0;
+    double termMax = cfg.missingNumeric;
+    if (ns.hasValue && ns.range != 0.0) {
+        if (ds.precision == Precision::U16) {
+            weight = ds.numStep[s] / ns.range;
+            err = ds.numStep[s] / ns.range; // both values rounded by at most half a step
+            termMax = std::max(termMax, 65534.0 * weight);
+        } else {
+            weight = 1.0 / ns.range;
+            err = 2.0 * u * ds.numAbsMax[s] / ns.range;
+            termMax = std::max(termMax, 2.0 * ds.numAbsMax[s] / ns.range);
+        }
+    }
+    cm.numWeight[s] = static_cast<float>(weight);
+    cm.termErr[s] = err + 3.0 * u * termMax;
+    cm.termMax[s] = termMax;
+}
+
+static void FillCompactNominal(const Dataset& ds, const Stats& stats, const DistanceConfig& cfg, CompactMetric& cm, size_t s) {
+    const int a = ds.nominalIdx[s];
+    const auto& ns = stats.nomStats[a];
+    const size_t width = ds.nominalValues[a].size() + 1; // last code = missing
+    std::vector<float> table(width * width, static_cast<float>(cfg.missingNominal));
+    double termMax = cfg.missingNominal;
+    for (size_t ci = 0; ci + 1 < width; ++ci) {
+        int i = ci < ns.codeIndex.size() ? ns.codeIndex[ci] : -1;
+        if (i < 0) {
+            continue;
+        }
+        for (size_t cj = 0; cj + 1 < width; ++cj) {
+            int j = cj < ns.codeIndex.size() ? ns.codeIndex[cj] : -1;
+            if (j < 0) {
+                continue;
+            }
+            const double d = ValueDistance(ns, i, j, cfg);
+            table[ci * width + cj] = static_cast<float>(d);
+            termMax = std::max(termMax, d);
+        }
+    }
+    cm.nomTable[s] = std::move(table);
+    cm.termErr[ds.numericIdx.size() + s] = 2.0 * kUnitRoundoff * termMax;
+    cm.termMax[ds.numericIdx.size() + s] = termMax;
+}
+
+static void UpdateCompactBound(const Dataset& ds, CompactMetric& cm) {
+    const double u = kUnitRoundoff;
+    double termErr = 0.0;
+    double termSum = 0.0;
+    for (size_t t = 0; t < cm.termErr.size(); ++t) {
+        termErr += cm.termErr[t];
+        termSum += cm.termMax[t];
+    }
+    const double slots = static_cast<double>(ds.numericIdx.size() + ds.nominalIdx.size());
+    cm.errorBound = 2.0 * (termErr + (slots + 1.0) * u * termSum) + 1e-12 * termSum;
+}
+
+// Float32 tables for the compact columns plus a bound on how far the float
+// distance can drift from the double one (storage, per-term and summation
+// rounding, doubled as a safety margin).
+CompactMetric BuildCompactMetric(const Dataset& ds, const Stats& stats, const DistanceConfig& cfg) {
+    CompactMetric cm;
+    cm.missingNumeric = static_cast<float>(cfg.missingNumeric);
+    // u8 quantizes nominal terms per query (NominalQuery carries that error).
+    const size_t nominal = ds.precision == Precision::U8 ? 0 : ds.nominalIdx.size();
+    cm.slotOf.assign(ds.types.size(), -1);
+    cm.numWeight.resize(ds.numericIdx.size());
+    cm.nomTable.resize(nominal);
+    cm.termErr.resize(ds.numericIdx.size() + nominal);
+    cm.termMax.resize(ds.numericIdx.size() + nominal);
+    for (size_t s = 0; s < ds.numericIdx.size(); ++s) {
+        cm.slotOf[ds.numericIdx[s]] = (int)s;
+        FillCompactNumeric(ds, stats, cfg, cm, s);
+    }
+    for (size_t s = 0; s < nominal; ++s) {
+        cm.slotOf[ds.nominalIdx[s]] = (int)s;
+        FillCompactNominal(ds, stats, cfg, cm, s);
+    }
+    UpdateCompactBound(ds, cm);
+    return cm;
+}
+
+void RefreshCompactAttribute(const Dataset& ds, Stats& stats, const DistanceConfig& cfg, int attr, int code) {
+    CompactMetric& cm = stats.compact;
+    if (ds.precision == Precision::F64 || attr < 0 || attr >= (int)cm.slotOf.size() || cm.slotOf[attr] < 0) {
+        return;
+    }
+    const size_t s = (size_t)cm.slotOf[attr];
+    if (ds.types[attr] == AttrType::Numeric) {
+        FillCompactNumeric(ds, stats, cfg, cm, s);
+        UpdateCompactBound(ds, cm);
+        return;
+    }
+    const size_t width = ds.nominalValues[attr].size() + 1;
+    auto& table = cm.nomTable[s];
+    if (table.size() != width * width) {
+        FillCompactNominal(ds, stats, cfg, cm, s);
+        UpdateCompactBound(ds, cm);
+        return;
+    }
+    const auto& ns = stats.nomStats[attr];
+    auto indexOf = [&](size_t c) { return c < ns.codeIndex.size() ? ns.codeIndex[c] : -1; };
+    const int i = indexOf((size_t)code);
+    double& termMax = cm.termMax[ds.numericIdx.size() + s];
+    for (size_t c = 0; c + 1 < width; ++c) {
+        const int j = indexOf(c);
+        const double d = (i < 0 || j < 0) ? cfg.missingNominal : ValueDistance(ns, i, j, cfg);
+        table[(size_t)code * width + c] = static_cast<float>(d);
+        table[c * width + (size_t)code] = static_cast<float>(d);
+        // Kept as a high-water mark: a stale larger maximum only loosens the bound.
+        termMax = std::max(termMax, d);
+    }
+    cm.termErr[ds.numericIdx.size() + s] = 2.0 * kUnitRoundoff * termMax;
+    UpdateCompactBound(ds, cm);
+}
+
 Stats ComputeStats(const Dataset& ds,
                    const std::vector<int>& indices,
-                   const DistanceConfig& distCfg) {
+                   const DistanceConfig& distCfg,
+                   const std::vector<int>* weights) {
+    auto weightAt = [&](size_t i) { return weights ? (*weights)[i] : 1; };
     const size_t m = ds.types.size();
     Stats stats;
     stats.numStats.resize(m);
@@ -52,8 +180,8 @@ Stats ComputeStats(const Dataset& ds,
         std::unordered_map<std::string, std::vector<int>> counts;
         std::unordered_map<std::string, int> totals;
 
-        for (int idx : indices) {
-            const auto& inst = ds.rows[idx];
+        for (size_t i = 0; i < indices.size(); ++i) {
+            const auto& inst = ds.rows[indices[i]];
             const auto& v = inst.attrs[a];
             if (v.missing) {
                 continue;
@@ -63,8 +191,8 @@ Stats ComputeStats(const Dataset& ds,
                 vec.resize(d, 0);
             }
             int cls = ds.decisionIndex.at(inst.decision);
-            vec[cls] += 1;
-            totals[v.raw] += 1;
+            vec[cls] += weightAt(i);
+            totals[v.raw] += weightAt(i);
         }
 
         NominalStat ns;
@@ -74,13 +202,44 @@ Stats ComputeStats(const Dataset& ds,
             ns.values.push_back(kv.first);
         }
 
+        if (a < ds.nominalValues.size()) {
+            const auto& dict = ds.nominalValues[a];
+            ns.codeIndex.assign(dict.size(), -1);
+            for (size_t code = 0; code < dict.size(); ++code) {
+                auto it = ns.index.find(dict[code]);
+                if (it != ns.index.end()) {
+                    ns.codeIndex[code] = it->second;
+                }
+            }
+        }
+
         const size_t vcount = ns.values.size();
+        ns.onDemand = a < ds.nominalValues.size() && ds.nominalValues[a].size() > distCfg.denseValues;
+        if (ns.onDemand) {
+            // O(V * classes) instead of O(V^2): rows of P(class | value) only.
+            ns.classes = d;
+            ns.prob.assign(vcount * d, 0.0);
+            for (size_t i = 0; i < vcount; ++i) {
+                const int total = totals[ns.values[i]];
+                const auto& cnt = counts[ns.values[i]];
+                for (size_t c = 0; c < d; ++c) {
+                    ns.prob[i * d + c] = (total == 0) ? 0.0 : (double)cnt[c] / (double)total;
+                }
+            }
+            stats.nomStats[a] = std::move(ns);
+            continue;
+        }
         ns.dist.assign(vcount, std::vector<double>(vcount, 0.0));
 
         for (size_t i = 0; i < vcount; ++i) {
             const std::string& valI = ns.values[i];
             for (size_t j = i; j < vcount; ++j) {
                 const std::string& valJ = ns.values[j];
+                if (distCfg.metric == Metric::HEOM) {
+                    // Overlap: any two different values are 1 apart.
+                    ns.dist[i][j] = ns.dist[j][i] = (i == j) ? 0.0 : 1.0;
+                    continue;
+                }
                 double sum = 0.0;
                 int totalI = totals[valI];
                 int totalJ = totals[valJ];
@@ -102,6 +261,44 @@ Stats ComputeStats(const Dataset& ds,
         stats.nomStats[a] = std::move(ns);
     }
 
+    // ---- IVDM: class distributions of equal-width intervals per numeric attribute ----
+    if (distCfg.metric == Metric::IVDM) {
+        stats.ivdm.resize(m);
+        const int intervals = std::max(5, (int)d);
+        for (int a : ds.numericIdx) {
+            const auto& ns = stats.numStats[a];
+            IvdmStat iv;
+            iv.intervals = intervals;
+            iv.prob.assign(intervals + 2, std::vector<double>(d, 0.0));
+            if (ns.hasValue && ns.range > 0.0) {
+                iv.lo = ns.min;
+                iv.width = ns.range / intervals;
+                std::vector<int> totals(intervals + 2, 0);
+                std::vector<std::vector<int>> counts(intervals + 2, std::vector<int>(d, 0));
+                for (size_t i = 0; i < indices.size(); ++i) {
+                    const auto& v = ds.rows[indices[i]].attrs[a];
+                    if (v.missing) {
+                        continue;
+                    }
+                    const int u = std::min(intervals - 1, std::max(0, (int)((v.num - iv.lo) / iv.width)));
+                    counts[u + 1][ds.decisionIndex.at(ds.rows[indices[i]].decision)] += weightAt(i);
+                    totals[u + 1] += weightAt(i);
+                }
+                for (int u = 1; u <= intervals; ++u) {
+                    for (size_t c = 0; c < d && totals[u] > 0; ++c) {
+                        iv.prob[u][c] = (double)counts[u][c] / (double)totals[u];
+                    }
+                }
+            }
+            stats.ivdm[a] = std::move(iv);
+        }
+    }
+
+    if (ds.precision != Precision::F64) {
+        stats.compact = BuildCompactMetric(ds, stats, distCfg);
+    }
+    stats.kernel = BuildDistanceKernel(ds, stats, distCfg);
+
     return stats;
 }
 
@@ -118,7 +315,7 @@ double NominalDistance(const NominalStat& ns,
     if (itA == ns.index.end() || itB == ns.index.end()) {
         return cfg.missingNominal;
     }
-    return ns.dist[itA->second][itB->second];
+    return ValueDistance(ns, itA->second, itB->second, cfg);
 }
 
 double InstanceDistance(const Dataset& ds,
@@ -137,7 +334,9 @@ double InstanceDistance(const Dataset& ds,
                 continue;
             }
             const auto& ns = stats.numStats[a];
-            if (!ns.hasValue || ns.range == 0.0) {
+            if (cfg.metric == Metric::IVDM) {
+                sum += IvdmTerm(stats.ivdm[a], vx.num, vy.num, cfg.svdmPrime ? 0.5 : 1.0);
+            } else if (!ns.hasValue || ns.range == 0.0) {
                 sum += 0.0;
             } else {
                 sum += std::abs(vx.num - vy.num) / ns.range;
@@ -153,4 +352,173 @@ double InstanceDistance(const Dataset& ds,
         }
     }
     return sum;
+}
+
+void BuildPairDistances(const Dataset& ds, Stats& stats, const DistanceConfig& cfg, int threads) {
+    const size_t n = ds.rows.size();
+    stats.pairDist.assign(n < 2 ? 0 : n * (n - 1) / 2, 0.0);
+    // Rows are dealt round-robin so the shrinking triangle rows balance out.
+    const bool kernel = stats.kernel.batch && ds.kernelRows == n;
+    auto fill = [&](size_t first, size_t step) {
+        std::vector<int> later;
+        for (size_t i = first; i < n; i += step) {
+            double* out = stats.pairDist.data() + (i * n - i * (i + 1) / 2);
+            if (kernel) {
+                later.resize(n - i - 1);
+                for (size_t j = i + 1; j < n; ++j) {
+                    later[j - i - 1] = (int)j;
+                }
+                stats.kernel.batch(ds, stats.kernel, i, later.data(), later.size(), out);
+                continue;
+            }
+            for (size_t j = i + 1; j < n; ++j) {
+                *out++ = InstanceDistance(ds, stats, cfg, ds.rows[i], ds.rows[j]);
+            }
+        }
+    };
+    const size_t workers = (size_t)std::max(1, threads);
+    if (workers == 1) {
+        fill(0, 1);
+        return;
+    }
+    std::vector<std::thread> pool;
+    for (size_t t = 0; t < workers; ++t) {
+        pool.emplace_back(fill, t, workers);
+    }
+    for (auto& th : pool) {
+        th.join();
+    }
+}
+
+// ---------------------------------------
+// Compact columns (--precision f32|u16)
+// ---------------------------------------
+
+bool BuildCompactColumns(Dataset& ds, Precision precision, std::string& err) {
+    ds.precision = precision;
+    ds.numF32.clear();
+    ds.numU16.clear();
+    ds.numLo.clear();
+    ds.numStep.clear();
+    ds.numAbsMax.clear();
+    ds.nomCodes.clear();
+    ds.nomU8.clear();
+    if (precision == Precision::F64) {
+        return true;
+    }
+
+    const size_t n = ds.rows.size();
+    const size_t nn = ds.numericIdx.size();
+    const size_t nm = ds.nominalIdx.size();
+
+    for (int a : ds.nominalIdx) {
+        if (precision == Precision::U8 && ds.nominalValues[a].size() > 255) {
+            err = "Attribute " + std::to_string(a + 1) + " has more than 255 values for --precision u8";
+            return false;
+        }
+        if (ds.nominalValues[a].size() >= kMissingU16) {
+            err = "Attribute " + std::to_string(a + 1) + " has too many values for --precision";
+            return false;
+        }
+    }
+
+    ds.numLo.assign(nn, 0.0);
+    ds.numStep.assign(nn, 0.0);
+    ds.numAbsMax.assign(nn, 0.0);
+    for (size_t s = 0; s < nn; ++s) {
+        const int a = ds.numericIdx[s];
+        double lo = std::numeric_limits<double>::infinity();
+        double hi = -std::numeric_limits<double>::infinity();
+        for (const auto& inst : ds.rows) {
+            const auto& v = inst.attrs[a];
+            if (v.missing) {
+                continue;
+            }
+            lo = std::min(lo, v.num);
+            hi = std::max(hi, v.num);
+        }
+        if (lo > hi) {
+            continue;
+        }
+        ds.numLo[s] = lo;
+        ds.numStep[s] = (hi - lo) / 65534.0;
+        ds.numAbsMax[s] = std::max(std::abs(lo), std::abs(hi));
+    }
+
+    if (precision == Precision::U16) {
+        ds.numU16.resize(n * nn);
+    } else {
+        ds.numF32.resize(n * nn);
+    }
+    if (precision == Precision::U8) {
+        ds.nomU8.resize(n * nm);
+    } else {
+        ds.nomCodes.resize(n * nm);
+    }
+    for (size_t r = 0; r < n; ++r) {
+        const auto& inst = ds.rows[r];
+        for (size_t s = 0; s < nn; ++s) {
+            const auto& v = inst.attrs[ds.numericIdx[s]];
+            if (precision != Precision::U16) {
+                ds.numF32[r * nn + s] = v.missing ? std::numeric_limits<float>::quiet_NaN()
+                                                  : static_cast<float>(v.num);
+            } else if (v.missing) {
+                ds.numU16[r * nn + s] = kMissingU16;
+            } else {
+                double q = ds.numStep[s] > 0.0 ? std::round((v.num - ds.numLo[s]) / ds.numStep[s]) : 0.0;
+                ds.numU16[r * nn + s] = static_cast<uint16_t>(std::min(q, 65534.0));
+            }
+        }
+        for (size_t s = 0; s < nm; ++s) {
+            const int a = ds.nominalIdx[s];
+            const auto& v = inst.attrs[a];
+            if (precision == Precision::U8) {
+                ds.nomU8[s * n + r] = static_cast<uint8_t>(v.missing || v.code < 0 ? 0 : v.code + 1);
+                continue;
+            }
+            ds.nomCodes[r * nm + s] = static_cast<uint16_t>(
+                v.missing || v.code < 0 ? ds.nominalValues[a].size() : static_cast<size_t>(v.code));
+        }
+    }
+    return true;
+}
+
+float CompactNumericDistance(const Dataset& ds, const CompactMetric& metric, size_t x, size_t y) {
+    float sum = 0.0f;
+    const size_t nn = ds.numericIdx.size();
+    if (ds.precision == Precision::U16) {
+        const uint16_t* px = ds.numU16.data() + x * nn;
+        const uint16_t* py = ds.numU16.data() + y * nn;
+        for (size_t s = 0; s < nn; ++s) {
+            if (px[s] == kMissingU16 || py[s] == kMissingU16) {
+                sum += metric.missingNumeric;
+            } else {
+                sum += std::abs(static_cast<float>(px[s]) - static_cast<float>(py[s])) * metric.numWeight[s];
+            }
+        }
+    } else {
+        const float* px = ds.numF32.data() + x * nn;
+        const float* py = ds.numF32.data() + y * nn;
+        for (size_t s = 0; s < nn; ++s) {
+            if (std::isnan(px[s]) || std::isnan(py[s])) {
+                sum += metric.missingNumeric;
+            } else {
+                sum += std::abs(px[s] - py[s]) * metric.numWeight[s];
+            }
+        }
+    }
+
+    return sum;
+}
+
+float CompactDistance(const Dataset& ds, const CompactMetric& metric, size_t x, size_t y) {
+    float sum = CompactNumericDistance(ds, metric, x, y);
+    const size_t nm = ds.nominalIdx.size();
+    const uint16_t* cx = ds.nomCodes.data() + x * nm;
+    const uint16_t* cy = ds.nomCodes.data() + y * nm;
+    for (size_t s = 0; s < nm; ++s) {
+        const size_t width = ds.nominalValues[ds.nominalIdx[s]].size() + 1;
+        sum += metric.nomTable[s][cx[s] * width + cy[s]];
+    }
+    return sum;
 }
\ No newline at end of file
@@ -0,0 +1,479 @@
+#include "distance_kernel.h"
+
+#include <algorithm>
+#include <limits>
+
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#include <immintrin.h>
+#define RIONA_X86_SIMD 1
+#endif
+
+void BuildKernelColumns(Dataset& ds) {
+    ds.kernelRows = 0;
+    ds.kernelNum.clear();
+    ds.kernelNom.clear();
+    ds.kernelNum.reserve(ds.rows.size() * ds.numericIdx.size());
+    ds.kernelNom.reserve(ds.rows.size() * ds.nominalIdx.size());
+    for (size_t r = 0; r < ds.rows.size(); ++r) {
+        AppendKernelRow(ds, r);
+    }
+}
+
+void AppendKernelRow(Dataset& ds, size_t row) {
+    if (row != ds.kernelRows) {
+        return; // columns only grow row by row
+    }
+    const auto& attrs = ds.rows[row].attrs;
+    for (int a : ds.numericIdx) {
+        const auto& v = attrs[a];
+        ds.kernelNum.push_back(v.missing ? std::numeric_limits<double>::quiet_NaN() : v.num);
+    }
+    for (int a : ds.nominalIdx) {
+        const auto& v = attrs[a];
+        ds.kernelNom.push_back(v.missing || v.code < 0 ? 0 : v.code + 1);
+    }
+    ++ds.kernelRows;
+}
+
+// ---------------------------------------
+// Specialized kernels
+// ---------------------------------------
+
+enum class Layout { Numeric, Nominal, Mixed };
+
+// Numeric term policies; NaN marks a missing value.
+struct LinearNumeric {
+    static double Term(const DistanceKernel& k, size_t s, double a, double b) {
+        if (std::isnan(a) || std::isnan(b)) {
+            return k.missingNumeric;
+        }
+        const double r = k.range[s];
+        return r == 0.0 ? 0.0 : std::abs(a - b) / r;
+    }
+};
+
+struct IvdmNumeric {
+    static double Term(const DistanceKernel& k, size_t s, double a, double b) {
+        if (std::isnan(a) || std::isnan(b)) {
+            return k.missingNumeric;
+        }
+        return IvdmTerm(k.ivdm[s], a, b, k.ivdmScale);
+    }
+};
+
+// Runs add their terms in attribute order, so sums match InstanceDistance exactly.
+template <class Num>
+static inline double NumericRun(const DistanceKernel& k, const double* x, const double* y,
+                                size_t first, size_t count, double sum) {
+    for (size_t s = first; s < first + count; ++s) {
+        sum += Num::Term(k, s, x[s], y[s]);
+    }
+    return sum;
+}
+
+// Term of an on-demand nominal slot between kernel codes x and y.
+static inline double OnDemandTerm(const DistanceKernel& k, size_t s, size_t x, size_t y) {
+    const double* px = k.nomProb[s].data() + x * k.probStride;
+    const double* py = k.nomProb[s].data() + y * k.probStride;
+    if (std::isnan(px[0]) || std::isnan(py[0])) {
+        return k.missingNominal;
+    }
+    if (k.overlap) {
+        return x == y ? 0.0 : 1.0;
+    }
+    double sum = 0.0;
+    for (size_t c = 0; c < k.probStride; ++c) {
+        sum += std::abs(px[c] - py[c]);
+    }
+    return sum * k.probScale;
+}
+
+static inline double NominalTerm(const DistanceKernel& k, size_t s, size_t x, size_t y) {
+    return k.nomOnDemand[s] ? OnDemandTerm(k, s, x, y) : k.nomTable[s][x * k.nomWidth[s] + y];
+}
+
+static inline double NominalRun(const DistanceKernel& k, const int* x, const int* y,
+                                size_t first, size_t count, double sum) {
+    for (size_t s = first; s < first + count; ++s) {
+        sum += k.nomTable[s][(size_t)x[s] * k.nomWidth[s] + (size_t)y[s]];
+    }
+    return sum;
+}
+
+template <class Num, Layout L>
+static void BatchDistances(const Dataset& ds,
+                           const DistanceKernel& k,
+                           size_t x,
+                           const int* rows,
+                           size_t count,
+                           double* out) {
+    const size_t nn = ds.numericIdx.size();
+    const size_t nm = ds.nominalIdx.size();
+    const double* numX = ds.kernelNum.data() + x * nn;
+    const int* nomX = ds.kernelNom.data() + x * nm;
+    for (size_t i = 0; i < count; ++i) {
+        const size_t y = (size_t)rows[i];
+        const double* numY = ds.kernelNum.data() + y * nn;
+        const int* nomY = ds.kernelNom.data() + y * nm;
+        double sum = 0.0;
+        if constexpr (L == Layout::Numeric) {
+            sum = NumericRun<Num>(k, numX, numY, 0, nn, sum);
+        } else if constexpr (L == Layout::Nominal) {
+            sum = NominalRun(k, nomX, nomY, 0, nm, sum);
+        } else {
+            size_t numSlot = 0;
+            size_t nomSlot = 0;
+            for (const auto& run : k.runs) {
+                if (run.first) {
+                    sum = NominalRun(k, nomX, nomY, nomSlot, run.second, sum);
+                    nomSlot += run.second;
+                } else {
+                    sum = NumericRun<Num>(k, numX, numY, numSlot, run.second, sum);
+                    numSlot += run.second;
+                }
+            }
+        }
+        out[i] = sum;
+    }
+}
+
+// Kernels with on-demand nominal slots. The terms of the query's value are
+// kept in one row per slot for the batch, filled as candidate values appear;
+// batches much smaller than the dictionary compute terms directly.
+template <class Num>
+static void OnDemandDistances(const Dataset& ds,
+                              const DistanceKernel& k,
+                              size_t x,
+                              const int* rows,
+                              size_t count,
+                              double* out) {
+    const size_t nn = ds.numericIdx.size();
+    const size_t nm = ds.nominalIdx.size();
+    const double* numX = ds.kernelNum.data() + x * nn;
+    const int* nomX = ds.kernelNom.data() + x * nm;
+    std::vector<std::vector<double>> row(nm);
+    for (size_t s = 0; s < nm; ++s) {
+        if (k.nomOnDemand[s] && count * 8 >= k.nomWidth[s]) {
+            row[s].assign(k.nomWidth[s], std::numeric_limits<double>::quiet_NaN());
+        }
+    }
+    for (size_t i = 0; i < count; ++i) {
+        const size_t y = (size_t)rows[i];
+        const double* numY = ds.kernelNum.data() + y * nn;
+        const int* nomY = ds.kernelNom.data() + y * nm;
+        double sum = 0.0;
+        size_t numSlot = 0;
+        size_t nomSlot = 0;
+        for (const auto& run : k.runs) {
+            if (!run.first) {
+                sum = NumericRun<Num>(k, numX, numY, numSlot, run.second, sum);
+                numSlot += run.second;
+                continue;
+            }
+            for (size_t s = nomSlot; s < nomSlot + run.second; ++s) {
+                if (!k.nomOnDemand[s]) {
+                    sum += k.nomTable[s][(size_t)nomX[s] * k.nomWidth[s] + (size_t)nomY[s]];
+                } else if (row[s].empty()) {
+                    sum += OnDemandTerm(k, s, (size_t)nomX[s], (size_t)nomY[s]);
+                } else {
+                    double& t = row[s][(size_t)nomY[s]];
+                    if (std::isnan(t)) {
+                        t = OnDemandTerm(k, s, (size_t)nomX[s], (size_t)nomY[s]);
+                    }
+                    sum += t;
+                }
+            }
+            nomSlot += run.second;
+        }
+        out[i] = sum;
+    }
+}
+
+template <class Num>
+static DistanceBatchFn SelectLayout(const Dataset& ds, const DistanceKernel& k) {
+    if (std::any_of(k.nomOnDemand.begin(), k.nomOnDemand.end(), [](char c) { return c != 0; })) {
+        return &OnDemandDistances<Num>;
+    }
+    if (ds.nominalIdx.empty()) {
+        return &BatchDistances<Num, Layout::Numeric>;
+    }
+    if (ds.numericIdx.empty()) {
+        return &BatchDistances<Num, Layout::Nominal>;
+    }
+    return &BatchDistances<Num, Layout::Mixed>;
+}
+
+// ---------------------------------------
+// Kernel tables
+// ---------------------------------------
+
+static void FillNominalTable(const Dataset& ds, const Stats& stats, const DistanceConfig& cfg,
+                             DistanceKernel& k, size_t slot) {
+    const int a = ds.nominalIdx[slot];
+    const auto& ns = stats.nomStats[a];
+    const size_t width = ds.nominalValues[a].size() + 1; // slot 0 = missing, code c at c + 1
+    k.nomWidth[slot] = width;
+    k.nomOnDemand[slot] = ns.onDemand ? 1 : 0;
+    if (ns.onDemand) {
+        // Row c + 1 holds P(class | code c); NaN marks missing or absent codes.
+        k.nomTable[slot].clear();
+        auto& prob = k.nomProb[slot];
+        prob.assign(width * k.probStride, 0.0);
+        for (size_t c = 0; c < width; ++c) {
+            const int i = (c > 0 && c - 1 < ns.codeIndex.size()) ? ns.codeIndex[c - 1] : -1;
+            if (i < 0) {
+                prob[c * k.probStride] = std::numeric_limits<double>::quiet_NaN();
+            } else {
+                std::copy_n(ns.prob.begin() + (size_t)i * ns.classes, ns.classes, prob.begin() + c * k.probStride);
+            }
+        }
+        return;
+    }
+    k.nomProb[slot].clear();
+    k.nomTable[slot].assign(width * width, cfg.missingNominal);
+    for (size_t ci = 0; ci + 1 < width; ++ci) {
+        const int i = ci < ns.codeIndex.size() ? ns.codeIndex[ci] : -1;
+        if (i < 0) {
+            continue;
+        }
+        for (size_t cj = 0; cj + 1 < width; ++cj) {
+            const int j = cj < ns.codeIndex.size() ? ns.codeIndex[cj] : -1;
+            if (j >= 0) {
+                k.nomTable[slot][(ci + 1) * width + (cj + 1)] = ns.dist[i][j];
+            }
+        }
+    }
+}
+
+DistanceKernel BuildDistanceKernel(const Dataset& ds, const Stats& stats, const DistanceConfig& cfg) {
+    DistanceKernel k;
+    k.missingNumeric = cfg.missingNumeric;
+    k.missingNominal = cfg.missingNominal;
+    k.ivdmScale = cfg.svdmPrime ? 0.5 : 1.0;
+    k.probScale = cfg.svdmPrime ? 0.5 : 1.0;
+    k.overlap = cfg.metric == Metric::HEOM;
+    k.probStride = std::max<size_t>(1, ds.decisionValues.size());
+    k.slotOf.assign(ds.types.size(), -1);
+    for (size_t s = 0; s < ds.numericIdx.size(); ++s) {
+        const int a = ds.numericIdx[s];
+        k.slotOf[a] = (int)s;
+        const auto& ns = stats.numStats[a];
+        k.range.push_back(ns.hasValue ? ns.range : 0.0);
+        if (cfg.metric == Metric::IVDM) {
+            k.ivdm.push_back(a < (int)stats.ivdm.size() ? stats.ivdm[a] : IvdmStat());
+        }
+    }
+    k.nomTable.resize(ds.nominalIdx.size());
+    k.nomWidth.resize(ds.nominalIdx.size());
+    k.nomProb.resize(ds.nominalIdx.size());
+    k.nomOnDemand.resize(ds.nominalIdx.size(), 0);
+    for (size_t s = 0; s < ds.nominalIdx.size(); ++s) {
+        k.slotOf[ds.nominalIdx[s]] = (int)s;
+        FillNominalTable(ds, stats, cfg, k, s);
+    }
+    for (size_t a = 0; a < ds.types.size(); ++a) {
+        const bool nominal = ds.types[a] == AttrType::Nominal;
+        if (k.runs.empty() || k.runs.back().first != nominal) {
+            k.runs.push_back({nominal, 0});
+        }
+        ++k.runs.back().second;
+    }
+    k.batch = (cfg.metric == Metric::IVDM) ? SelectLayout<IvdmNumeric>(ds, k) : SelectLayout<LinearNumeric>(ds, k);
+    return k;
+}
+
+void RefreshKernelAttribute(const Dataset& ds, Stats& stats, const DistanceConfig& cfg, int attr, int code) {
+    DistanceKernel& k = stats.kernel;
+    if (!k.batch || attr < 0 || attr >= (int)k.slotOf.size()) {
+        return;
+    }
+    const size_t slot = (size_t)k.slotOf[attr];
+    if (ds.types[attr] == AttrType::Numeric) {
+        const auto& ns = stats.numStats[attr];
+        k.range[slot] = ns.hasValue ? ns.range : 0.0;
+        return;
+    }
+    const size_t width = ds.nominalValues[attr].size() + 1;
+    if (width != k.nomWidth[slot]) {
+        FillNominalTable(ds, stats, cfg, k, slot);
+        return;
+    }
+    const auto& ns = stats.nomStats[attr];
+    auto indexOf = [&](size_t c) { return c < ns.codeIndex.size() ? ns.codeIndex[c] : -1; };
+    const int i = indexOf((size_t)code);
+    if (k.nomOnDemand[slot]) {
+        double* row = k.nomProb[slot].data() + ((size_t)code + 1) * k.probStride;
+        if (i < 0) {
+            row[0] = std::numeric_limits<double>::quiet_NaN();
+        } else {
+            std::copy_n(ns.prob.begin() + (size_t)i * ns.classes, ns.classes, row);
+        }
+        return;
+    }
+    auto& table = k.nomTable[slot];
+    for (size_t c = 0; c + 1 < width; ++c) {
+        const int j = indexOf(c);
+        const double d = (i < 0 || j < 0) ? cfg.missingNominal : ns.dist[i][j];
+        table[((size_t)code + 1) * width + (c + 1)] = d;
+        table[(c + 1) * width + ((size_t)code + 1)] = d;
+    }
+}
+
+// ---------------------------------------
+// Byte-coded nominal ranking (--precision u8)
+// ---------------------------------------
+
+NominalQuery BuildNominalQuery(const Dataset& ds, const DistanceKernel& k, size_t row) {
+    const size_t n = ds.rows.size();
+    const size_t nm = ds.nominalIdx.size();
+    NominalQuery q;
+    double maxTerm = 0.0;
+    for (size_t s = 0; s < nm; ++s) {
+        const size_t width = k.nomWidth[s];
+        const size_t x = ds.nomU8[s * n + row];
+        for (size_t c = 0; c < width; ++c) {
+            maxTerm = std::max(maxTerm, NominalTerm(k, s, x, c));
+        }
+    }
+    // Sums of nm terms must fit in 16 bits.
+    const int levels = (int)std::min<size_t>(255, 65535 / std::max<size_t>(1, nm));
+    q.step = maxTerm > 0.0 ? maxTerm / levels : 0.0;
+    q.errorBound = 0.5 * q.step * nm * (1.0 + 1e-9) + 1e-12 * maxTerm * nm;
+
+    q.offset.resize(nm);
+    q.parts.resize(nm);
+    for (size_t s = 0; s < nm; ++s) {
+        const size_t width = k.nomWidth[s];
+        const size_t x = ds.nomU8[s * n + row];
+        q.offset[s] = q.tables.size();
+        q.parts[s] = (uint8_t)((width + 15) / 16);
+        q.tables.resize(q.tables.size() + 16 * q.parts[s], 0);
+        for (size_t c = 0; c < width; ++c) {
+            const double d = NominalTerm(k, s, x, c);
+            const long level = q.step > 0.0 ? std::lround(d / q.step) : 0;
+            q.tables[q.offset[s] + c] = (uint8_t)std::min<long>(levels, std::max<long>(0, level));
+        }
+    }
+    return q;
+}
+
+uint16_t NominalSum(const Dataset& ds, const NominalQuery& q, size_t row) {
+    const size_t n = ds.rows.size();
+    uint16_t sum = 0;
+    for (size_t s = 0; s < q.parts.size(); ++s) {
+        sum += q.tables[q.offset[s] + ds.nomU8[s * n + row]];
+    }
+    return sum;
+}
+
+#ifdef RIONA_X86_SIMD
+#ifdef _WIN32
+// No runtime CPU detection with every Windows toolchain; use what the build targets.
+static bool CpuHasAvx2() {
+#ifdef __AVX2__
+    return true;
+#else
+    return false;
+#endif
+}
+static bool CpuHasSsse3() {
+#ifdef __SSSE3__
+    return true;
+#else
+    return false;
+#endif
+}
+#else
+static bool CpuHasAvx2() {
+    static const bool has = __builtin_cpu_supports("avx2");
+    return has;
+}
+static bool CpuHasSsse3() {
+    static const bool has = __builtin_cpu_supports("ssse3");
+    return has;
+}
+#endif
+
+// Attributes with more than 16 codes look up each 16-entry part and keep the
+// bytes whose high nibble selects it.
+__attribute__((target("avx2"))) static size_t NominalSumsAvx2(const Dataset& ds, const NominalQuery& q,
+                                                              size_t first, size_t count, uint16_t* out) {
+    const size_t n = ds.rows.size();
+    const __m256i lowNibble = _mm256_set1_epi8(0x0F);
+    size_t r = 0;
+    for (; r + 32 <= count; r += 32) {
+        __m256i lo = _mm256_setzero_si256();
+        __m256i hi = _mm256_setzero_si256();
+        for (size_t s = 0; s < q.parts.size(); ++s) {
+            const uint8_t* table = q.tables.data() + q.offset[s];
+            const __m256i codes = _mm256_loadu_si256((const __m256i*)(ds.nomU8.data() + s * n + first + r));
+            __m256i vals;
+            if (q.parts[s] == 1) {
+                vals = _mm256_shuffle_epi8(_mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)table)), codes);
+            } else {
+                const __m256i index = _mm256_and_si256(codes, lowNibble);
+                const __m256i part = _mm256_and_si256(_mm256_srli_epi16(codes, 4), lowNibble);
+                vals = _mm256_setzero_si256();
+                for (int p = 0; p < q.parts[s]; ++p) {
+                    const __m256i t = _mm256_broadcastsi128_si256(_mm_loadu_si128((const __m128i*)(table + 16 * p)));
+                    const __m256i hit = _mm256_cmpeq_epi8(part, _mm256_set1_epi8((char)p));
+                    vals = _mm256_or_si256(vals, _mm256_and_si256(_mm256_shuffle_epi8(t, index), hit));
+                }
+            }
+            lo = _mm256_add_epi16(lo, _mm256_cvtepu8_epi16(_mm256_castsi256_si128(vals)));
+            hi = _mm256_add_epi16(hi, _mm256_cvtepu8_epi16(_mm256_extracti128_si256(vals, 1)));
+        }
+        _mm256_storeu_si256((__m256i*)(out + r), lo);
+        _mm256_storeu_si256((__m256i*)(out + r + 16), hi);
+    }
+    return r;
+}
+
+__attribute__((target("ssse3"))) static size_t NominalSumsSsse3(const Dataset& ds, const NominalQuery& q,
+                                                                size_t first, size_t count, uint16_t* out) {
+    const size_t n = ds.rows.size();
+    const __m128i lowNibble = _mm_set1_epi8(0x0F);
+    const __m128i zero = _mm_setzero_si128();
+    size_t r = 0;
+    for (; r + 16 <= count; r += 16) {
+        __m128i lo = zero;
+        __m128i hi = zero;
+        for (size_t s = 0; s < q.parts.size(); ++s) {
+            const uint8_t* table = q.tables.data() + q.offset[s];
+            const __m128i codes = _mm_loadu_si128((const __m128i*)(ds.nomU8.data() + s * n + first + r));
+            __m128i vals;
+            if (q.parts[s] == 1) {
+                vals = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i*)table), codes);
+            } else {
+                const __m128i index = _mm_and_si128(codes, lowNibble);
+                const __m128i part = _mm_and_si128(_mm_srli_epi16(codes, 4), lowNibble);
+                vals = zero;
+                for (int p = 0; p < q.parts[s]; ++p) {
+                    const __m128i t = _mm_loadu_si128((const __m128i*)(table + 16 * p));
+                    const __m128i hit = _mm_cmpeq_epi8(part, _mm_set1_epi8((char)p));
+                    vals = _mm_or_si128(vals, _mm_and_si128(_mm_shuffle_epi8(t, index), hit));
+                }
+            }
+            lo = _mm_add_epi16(lo, _mm_unpacklo_epi8(vals, zero));
+            hi = _mm_add_epi16(hi, _mm_unpackhi_epi8(vals, zero));
+        }
+        _mm_storeu_si128((__m128i*)(out + r), lo);
+        _mm_storeu_si128((__m128i*)(out + r + 8), hi);
+    }
+    return r;
+}
+#endif
+
+void NominalSums(const Dataset& ds, const NominalQuery& q, size_t first, size_t count, uint16_t* out) {
+    size_t done = 0;
+#ifdef RIONA_X86_SIMD
+    if (CpuHasAvx2()) {
+        done = NominalSumsAvx2(ds, q, first, count, out);
+    } else if (CpuHasSsse3()) {
+        done = NominalSumsSsse3(ds, q, first, count, out);
+    }
+#endif
+    for (size_t r = done; r < count; ++r) {
+        out[r] = NominalSum(ds, q, first + r);
+    }
+}
\ No newline at end of file
@@ -0,0 +1,343 @@
+#include "knn_binary.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+
+static const char kMagic[4] = {'R', 'K', 'N', 'N'};
+static const char kFooterMagic[4] = {'R', 'K', 'N', 'E'};
+static const uint32_t kVersion = 1;
+static const uint64_t kHeaderBytes = 24;
+static const uint64_t kFooterBytes = 20;
+
+// ---- little-endian / varint helpers ----
+
+static void PutU32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+static void PutU64(std::string& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+static void PutVarint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+static uint32_t GetU32(const unsigned char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(p[i]) << (8 * i);
+    return v;
+}
+
+static uint64_t GetU64(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= static_cast<uint64_t>(p[i]) << (8 * i);
+    return v;
+}
+
+static bool GetVarint(const unsigned char*& p, const unsigned char* end, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; p < end && shift < 64; shift += 7) {
+        unsigned char b = *p++;
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if (!(b & 0x80)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static uint64_t ZigZag(int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+static int64_t UnZigZag(uint64_t v) {
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+static bool ReadExact(std::istream& in, unsigned char* buf, size_t n) {
+    in.read(reinterpret_cast<char*>(buf), static_cast<std::streamsize>(n));
+    return static_cast<size_t>(in.gcount()) == n;
+}
+
+// ---- writer ----
+
+bool KnnBinaryWriter::Open(const std::string& path,
+                           size_t firstRow,
+                           bool useFloat32,
+                           uint64_t resumeBytes,
+                           std::string& err) {
+    float32 = useFloat32;
+    index.clear();
+    block.clear();
+    blockRows = 0;
+    blockFirstRow = firstRow;
+
+    if (resumeBytes == 0) {
+        file.open(path, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            err = "Cannot open kNN file: " + path;
+            return false;
+        }
+        std::string header(kMagic, 4);
+        PutU32(header, kVersion);
+        PutU32(header, float32 ? 1u : 0u);
+        PutU64(header, firstRow);
+        PutU32(header, kRowsPerBlock);
+        file.write(header.data(), header.size());
+        offset = kHeaderBytes;
+        return true;
+    }
+
+    // Rebuild the block index of the part written before the checkpoint.
+    {
+        std::ifstream in(path, std::ios::binary);
+        unsigned char hdr[kHeaderBytes];
+        if (!in || !ReadExact(in, hdr, kHeaderBytes) || std::memcmp(hdr, kMagic, 4) != 0 ||
+            (GetU32(hdr + 8) & 1u) != (float32 ? 1u : 0u) || GetU64(hdr + 12) != firstRow) {
+            err = "kNN file does not match checkpoint: " + path;
+            return false;
+        }
+        offset = kHeaderBytes;
+        while (offset < resumeBytes) {
+            unsigned char bh[8];
+            in.seekg(static_cast<std::streamoff>(offset));
+            if (!ReadExact(in, bh, 8)) {
+                break;
+            }
+            index.emplace_back(blockFirstRow, offset);
+            blockFirstRow += GetU32(bh);
+            offset += 8 + GetU32(bh + 4);
+        }
+        if (offset != resumeBytes) {
+            err = "kNN file does not match checkpoint: " + path;
+            return false;
+        }
+    }
+    std::error_code ec;
+    std::filesystem::resize_file(path, resumeBytes, ec);
+    if (ec) {
+        err = "Cannot truncate kNN file to checkpoint: " + ec.message();
+        return false;
+    }
+    file.open(path, std::ios::binary | std::ios::app);
+    if (!file) {
+        err = "Cannot open kNN file: " + path;
+        return false;
+    }
+    return true;
+}
+
+void KnnBinaryWriter::Write(size_t row, const std::vector<Neighbor>& list) {
+    if (blockRows == 0) {
+        blockFirstRow = row;
+    }
+    PutVarint(block, list.size());
+    int64_t prev = static_cast<int64_t>(row);
+    for (const auto& nb : list) {
+        PutVarint(block, ZigZag(static_cast<int64_t>(nb.index) - prev));
+        prev = nb.index;
+    }
+    for (const auto& nb : list) {
+        if (float32) {
+            float f = static_cast<float>(nb.dist);
+            uint32_t bits;
+            std::memcpy(&bits, &f, sizeof(bits));
+            PutU32(block, bits);
+        } else {
+            uint64_t bits;
+            std::memcpy(&bits, &nb.dist, sizeof(bits));
+            PutU64(block, bits);
+        }
+    }
+    if (++blockRows == kRowsPerBlock) {
+        EndBlock();
+    }
+}
+
+void KnnBinaryWriter::EndBlock() {
+    if (blockRows == 0) {
+        return;
+    }
+    std::string head;
+    PutU32(head, blockRows);
+    PutU32(head, static_cast<uint32_t>(block.size()));
+    file.write(head.data(), head.size());
+    file.write(block.data(), block.size());
+    index.emplace_back(blockFirstRow, offset);
+    offset += head.size() + block.size();
+    blockFirstRow += blockRows;
+    blockRows = 0;
+    block.clear();
+}
+
+uint64_t KnnBinaryWriter::Flush() {
+    EndBlock();
+    file.flush();
+    return offset;
+}
+
+bool KnnBinaryWriter::Close(std::string& err) {
+    EndBlock();
+    std::string tail;
+    for (const auto& entry : index) {
+        PutU64(tail, entry.first);
+        PutU64(tail, entry.second);
+    }
+    PutU64(tail, offset);
+    PutU64(tail, index.size());
+    tail.append(kFooterMagic, 4);
+    file.write(tail.data(), tail.size());
+    file.close();
+    if (!file) {
+        err = "Cannot write kNN file.";
+        return false;
+    }
+    return true;
+}
+
+// ---- reader ----
+
+bool KnnBinaryReader::Open(const std::string& path, std::string& err) {
+    file.open(path, std::ios::binary);
+    unsigned char hdr[kHeaderBytes];
+    if (!file || !ReadExact(file, hdr, kHeaderBytes) || std::memcmp(hdr, kMagic, 4) != 0 ||
+        GetU32(hdr + 4) != kVersion) {
+        err = "Not a binary kNN file: " + path;
+        return false;
+    }
+    float32 = (GetU32(hdr + 8) & 1u) != 0;
+    firstRow = GetU64(hdr + 12);
+
+    unsigned char footer[kFooterBytes];
+    file.seekg(-static_cast<std::streamoff>(kFooterBytes), std::ios::end);
+    if (!ReadExact(file, footer, kFooterBytes) || std::memcmp(footer + 16, kFooterMagic, 4) != 0) {
+        err = "Truncated binary kNN file: " + path;
+        return false;
+    }
+    const uint64_t indexOffset = GetU64(footer);
+    const uint64_t blocks = GetU64(footer + 8);
+
+    std::vector<unsigned char> buf(blocks * 16);
+    file.seekg(static_cast<std::streamoff>(indexOffset));
+    if (!ReadExact(file, buf.data(), buf.size())) {
+        err = "Truncated binary kNN file: " + path;
+        return false;
+    }
+    index.resize(blocks);
+    for (uint64_t b = 0; b < blocks; ++b) {
+        index[b] = {GetU64(&buf[16 * b]), GetU64(&buf[16 * b + 8])};
+    }
+
+    rowCount = 0;
+    if (!index.empty()) {
+        unsigned char bh[8];
+        file.seekg(static_cast<std::streamoff>(index.back().second));
+        if (!ReadExact(file, bh, 8)) {
+            err = "Truncated binary kNN file: " + path;
+            return false;
+        }
+        rowCount = index.back().first + GetU32(bh) - firstRow;
+    }
+    return true;
+}
+
+bool KnnBinaryReader::LoadBlock(size_t b, std::string& err) {
+    if (b == cachedBlock) {
+        return true;
+    }
+    unsigned char bh[8];
+    file.clear();
+    file.seekg(static_cast<std::streamoff>(index[b].second));
+    if (!ReadExact(file, bh, 8)) {
+        err = "Truncated binary kNN block.";
+        return false;
+    }
+    const uint32_t rows = GetU32(bh);
+    std::vector<unsigned char> payload(GetU32(bh + 4));
+    if (!ReadExact(file, payload.data(), payload.size())) {
+        err = "Truncated binary kNN block.";
+        return false;
+    }
+
+    const unsigned char* p = payload.data();
+    const unsigned char* end = p + payload.size();
+    const size_t distBytes = float32 ? 4 : 8;
+    cached.assign(rows, {});
+    for (uint32_t r = 0; r < rows; ++r) {
+        uint64_t count = 0;
+        if (!GetVarint(p, end, count)) {
+            err = "Corrupt binary kNN block.";
+            return false;
+        }
+        auto& list = cached[r];
+        list.resize(count);
+        int64_t prev = static_cast<int64_t>(index[b].first + r);
+        for (auto& nb : list) {
+            uint64_t z = 0;
+            if (!GetVarint(p, end, z)) {
+                err = "Corrupt binary kNN block.";
+                return false;
+            }
+            prev += UnZigZag(z);
+            nb.index = static_cast<int>(prev);
+        }
+        if (static_cast<size_t>(end - p) < count * distBytes) {
+            err = "Corrupt binary kNN block.";
+            return false;
+        }
+        for (auto& nb : list) {
+            if (float32) {
+                uint32_t bits = GetU32(p);
+                float f;
+                std::memcpy(&f, &bits, sizeof(f));
+                nb.dist = f;
+            } else {
+                uint64_t bits = GetU64(p);
+                std::memcpy(&nb.dist, &bits, sizeof(bits));
+            }
+            p += distBytes;
+        }
+    }
+    cachedBlock = b;
+    return true;
+}
+
+bool KnnBinaryReader::ReadRow(size_t row, std::vector<Neighbor>& list, std::string& err) {
+    if (row < firstRow || row >= firstRow + rowCount) {
+        err = "Row out of range in binary kNN file.";
+        return false;
+    }
+    auto it = std::upper_bound(index.begin(), index.end(), row,
+                               [](size_t r, const std::pair<uint64_t, uint64_t>& e) { return r < e.first; });
+    const size_t b = static_cast<size_t>(it - index.begin()) - 1;
+    if (!LoadBlock(b, err)) {
+        return false;
+    }
+    list = cached[row - index[b].first];
+    return true;
+}
+
+bool WriteKnnBinaryFile(const std::string& path,
+                        const std::vector<std::vector<Neighbor>>& knnLists,
+                        size_t firstRow,
+                        bool float32,
+                        std::string& err) {
+    KnnBinaryWriter writer;
+    if (!writer.Open(path, firstRow, float32, 0, err)) {
+        return false;
+    }
+    for (size_t i = 0; i < knnLists.size(); ++i) {
+        writer.Write(firstRow + i, knnLists[i]);
+    }
+    if (!writer.Close(err)) {
+        err = "Cannot write kNN file: " + path;
+        return false;
+    }
+    return true;
+}
\ No newline at end of file
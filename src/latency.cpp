@@ -0,0 +1,97 @@
+#include "latency.h"
+
+#include <algorithm>
+#include <cmath>
+#include <istream>
+#include <ostream>
+
+static constexpr int kSubBucketBits = 6;                       // 64 sub-buckets per power of two
+static constexpr uint64_t kSubBuckets = 1ull << kSubBucketBits;
+
+size_t LatencyHistogram::BucketOf(uint64_t ns) {
+    if (ns < 2 * kSubBuckets) {
+        return static_cast<size_t>(ns);
+    }
+    int msb = 63;
+    while (!(ns >> msb)) {
+        --msb;
+    }
+    const int shift = msb - kSubBucketBits;                    // >= 1
+    return static_cast<size_t>(shift) * kSubBuckets + static_cast<size_t>(ns >> shift);
+}
+
+uint64_t LatencyHistogram::BucketHigh(size_t bucket) {
+    if (bucket < 2 * kSubBuckets) {
+        return bucket;
+    }
+    const int shift = static_cast<int>(bucket / kSubBuckets) - 1;
+    const uint64_t mantissa = bucket % kSubBuckets + kSubBuckets;
+    return ((mantissa + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t ns) {
+    const size_t bucket = BucketOf(ns);
+    if (bucket >= counts.size()) {
+        counts.resize(bucket + 1, 0);
+    }
+    ++counts[bucket];
+    ++total;
+    max = std::max(max, ns);
+}
+
+uint64_t LatencyHistogram::Percentile(double p) const {
+    if (total == 0) {
+        return 0;
+    }
+    const double clamped = std::min(100.0, std::max(0.0, p));
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(clamped / 100.0 * total)));
+    uint64_t seen = 0;
+    for (size_t b = 0; b < counts.size(); ++b) {
+        seen += counts[b];
+        if (seen >= rank) {
+            return std::min(BucketHigh(b), max);
+        }
+    }
+    return max;
+}
+
+void LatencyHistogram::Merge(const LatencyHistogram& other) {
+    if (other.counts.size() > counts.size()) {
+        counts.resize(other.counts.size(), 0);
+    }
+    for (size_t b = 0; b < other.counts.size(); ++b) {
+        counts[b] += other.counts[b];
+    }
+    total += other.total;
+    max = std::max(max, other.max);
+}
+
+void LatencyHistogram::Write(std::ostream& out) const {
+    out << max;
+    for (size_t b = 0; b < counts.size(); ++b) {
+        if (counts[b] != 0) {
+            out << " " << b << ":" << counts[b];
+        }
+    }
+}
+
+bool LatencyHistogram::Read(std::istream& in) {
+    *this = LatencyHistogram();
+    if (!(in >> max)) {
+        return false;
+    }
+    size_t bucket = 0;
+    char colon = 0;
+    uint64_t count = 0;
+    while (in >> bucket >> colon >> count) {
+        if (colon != ':' || bucket > BucketOf(UINT64_MAX)) {
+            return false;
+        }
+        if (bucket >= counts.size()) {
+            counts.resize(bucket + 1, 0);
+        }
+        counts[bucket] += count;
+        total += count;
+    }
+    return in.eof();
+}
\ No newline at end of file
@@ -0,0 +1,260 @@
+#include "lsh.h"
+
+#include "distance_kernel.h"
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+#include <utility>
+
+void LshIndex::Build(const Dataset& ds,
+                     const Stats& stats,
+                     const DistanceConfig& cfg,
+                     int tables,
+                     int hashes,
+                     double bucketWidth,
+                     uint64_t seed) {
+    const size_t d = ds.decisionValues.size();
+    classes = d;
+    rows = ds.rows.size();
+    hashCount = std::max(1, hashes);
+
+    metric = cfg.metric;
+    numLo.clear();
+    numRange.clear();
+    ivdm.clear();
+    for (int a : ds.numericIdx) {
+        numLo.push_back(stats.numStats[a].min);
+        numRange.push_back(stats.numStats[a].range);
+        if (metric == Metric::IVDM) {
+            ivdm.push_back(a < (int)stats.ivdm.size() ? stats.ivdm[a] : IvdmStat());
+        }
+    }
+    ivdmScale = cfg.svdmPrime ? 0.5 : 1.0;
+
+    // Class distribution per nominal value (over all rows); HEOM overlap
+    // embeds a value as half a one-hot vector instead.
+    const float scale = cfg.svdmPrime ? 0.5f : 1.0f;
+    classProb.clear();
+    nomDim.clear();
+    for (int a : ds.nominalIdx) {
+        if (metric == Metric::HEOM) {
+            const size_t values = ds.nominalValues[a].size();
+            std::vector<std::vector<float>> onehot(values, std::vector<float>(values, 0.0f));
+            for (size_t code = 0; code < values; ++code) {
+                onehot[code][code] = 0.5f;
+            }
+            classProb.push_back(std::move(onehot));
+            nomDim.push_back(values);
+            continue;
+        }
+        std::vector<std::vector<double>> counts(ds.nominalValues[a].size(), std::vector<double>(d, 0.0));
+        std::vector<double> totals(ds.nominalValues[a].size(), 0.0);
+        for (const auto& inst : ds.rows) {
+            const auto& v = inst.attrs[a];
+            if (v.missing || v.code < 0) {
+                continue;
+            }
+            counts[v.code][ds.decisionIndex.at(inst.decision)] += 1.0;
+            totals[v.code] += 1.0;
+        }
+        std::vector<std::vector<float>> probs(counts.size(), std::vector<float>(d, 0.0f));
+        for (size_t code = 0; code < totals.size(); ++code) {
+            for (size_t c = 0; c < d && totals[code] > 0.0; ++c) {
+                probs[code][c] = scale * (float)(counts[code][c] / totals[code]);
+            }
+        }
+        classProb.push_back(std::move(probs));
+        nomDim.push_back(d);
+    }
+
+    dim = ds.numericIdx.size() * (metric == Metric::IVDM ? d : 1);
+    for (size_t w : nomDim) {
+        dim += w;
+    }
+    embedding.assign(rows * dim, 0.0f);
+    for (size_t r = 0; r < rows; ++r) {
+        Embed(ds, ds.rows[r], embedding.data() + r * dim);
+    }
+
+    width = bucketWidth > 0.0 ? bucketWidth : std::max(1e-6, 2.0 * TypicalDistance(8, 64, seed));
+
+    const double pi = std::acos(-1.0);
+    std::mt19937_64 rng(Mix64(seed));
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    tableList.assign(std::max(1, tables), Table());
+    for (auto& t : tableList) {
+        t.a.resize((size_t)hashCount * dim);
+        t.b.resize(hashCount);
+        for (float& x : t.a) {
+            x = (float)std::tan(pi * (unit(rng) - 0.5)); // standard Cauchy
+        }
+        for (float& x : t.b) {
+            x = (float)(unit(rng) * width);
+        }
+        for (size_t r = 0; r < rows; ++r) {
+            t.buckets[RowKey(t, r)].push_back((int)r);
+        }
+    }
+}
+
+void LshIndex::Embed(const Dataset& ds, const Instance& inst, float* e) const {
+    const auto& attrs = inst.attrs;
+    size_t pos = 0;
+    for (size_t s = 0; s < ds.numericIdx.size(); ++s) {
+        const auto& v = attrs[ds.numericIdx[s]];
+        if (metric == Metric::IVDM) {
+            // Interpolated class distribution; missing values embed as zeros.
+            const bool known = !v.missing && ivdm[s].width != 0.0;
+            for (size_t c = 0; c < classes; ++c) {
+                e[pos++] = known ? (float)(ivdmScale * IvdmProbability(ivdm[s], v.num, c)) : 0.0f;
+            }
+            continue;
+        }
+        // Missing values sit in the middle of the range.
+        e[pos++] = (v.missing || numRange[s] == 0.0) ? 0.5f : (float)((v.num - numLo[s]) / numRange[s]);
+    }
+    for (size_t s = 0; s < ds.nominalIdx.size(); ++s) {
+        const auto& v = attrs[ds.nominalIdx[s]];
+        // Values unseen at build time embed like missing ones.
+        const bool known = !v.missing && v.code >= 0 && (size_t)v.code < classProb[s].size();
+        for (size_t c = 0; c < nomDim[s]; ++c) {
+            e[pos++] = known ? classProb[s][v.code][c] : 0.0f;
+        }
+    }
+}
+
+uint64_t LshIndex::RowKey(const Table& t, size_t row) const {
+    std::vector<double> proj;
+    std::vector<int64_t> h(hashCount);
+    Project(t, embedding.data() + row * dim, proj);
+    for (int j = 0; j < hashCount; ++j) {
+        h[j] = (int64_t)std::floor(proj[j]);
+    }
+    return BucketKey(h);
+}
+
+void LshIndex::Insert(const Dataset& ds, size_t row) {
+    if (row >= rows) {
+        rows = row + 1;
+        embedding.resize(rows * dim, 0.0f);
+    }
+    Embed(ds, ds.rows[row], embedding.data() + row * dim);
+    for (auto& t : tableList) {
+        t.buckets[RowKey(t, row)].push_back((int)row);
+    }
+}
+
+void LshIndex::Erase(size_t row) {
+    if (row >= rows) {
+        return;
+    }
+    for (auto& t : tableList) {
+        auto it = t.buckets.find(RowKey(t, row));
+        if (it == t.buckets.end()) {
+            continue;
+        }
+        auto& list = it->second;
+        list.erase(std::remove(list.begin(), list.end(), (int)row), list.end());
+        if (list.empty()) {
+            t.buckets.erase(it);
+        }
+    }
+}
+
+void LshIndex::Project(const Table& t, const float* e, std::vector<double>& out) const {
+    out.assign(hashCount, 0.0);
+    for (int j = 0; j < hashCount; ++j) {
+        const float* a = t.a.data() + (size_t)j * dim;
+        double dot = t.b[j];
+        for (size_t i = 0; i < dim; ++i) {
+            dot += (double)a[i] * e[i];
+        }
+        out[j] = dot / width;
+    }
+}
+
+uint64_t LshIndex::BucketKey(const std::vector<int64_t>& h) {
+    uint64_t key = 0;
+    for (int64_t v : h) {
+        key = Mix64(key ^ (uint64_t)v);
+    }
+    return key;
+}
+
+std::vector<int> LshIndex::Candidates(size_t row, int probes) const {
+    std::vector<int> out = Probe(embedding.data() + row * dim, probes);
+    out.erase(std::remove(out.begin(), out.end(), (int)row), out.end());
+    return out;
+}
+
+std::vector<int> LshIndex::Candidates(const Dataset& ds, const Instance& query, int probes) const {
+    std::vector<float> e(dim);
+    Embed(ds, query, e.data());
+    return Probe(e.data(), probes);
+}
+
+std::vector<int> LshIndex::Probe(const float* e, int probes) const {
+    std::vector<int> out;
+    std::vector<double> proj;
+    std::vector<int64_t> h(hashCount);
+    std::vector<std::pair<double, int>> steps; // (distance to the boundary, +-(j + 1))
+    auto collect = [&](const Table& t) {
+        auto it = t.buckets.find(BucketKey(h));
+        if (it != t.buckets.end()) {
+            out.insert(out.end(), it->second.begin(), it->second.end());
+        }
+    };
+    for (const auto& t : tableList) {
+        Project(t, e, proj);
+        steps.clear();
+        for (int j = 0; j < hashCount; ++j) {
+            h[j] = (int64_t)std::floor(proj[j]);
+            const double frac = proj[j] - (double)h[j];
+            steps.push_back({frac, -(j + 1)});
+            steps.push_back({1.0 - frac, j + 1});
+        }
+        collect(t);
+
+        // Multi-probe: the buckets one step away across the closest boundaries.
+        const size_t n = std::min(steps.size(), (size_t)std::max(0, probes));
+        std::partial_sort(steps.begin(), steps.begin() + n, steps.end());
+        for (size_t p = 0; p < n; ++p) {
+            const int j = std::abs(steps[p].second) - 1;
+            const int64_t delta = steps[p].second > 0 ? 1 : -1;
+            h[j] += delta;
+            collect(t);
+            h[j] -= delta;
+        }
+    }
+    std::sort(out.begin(), out.end());
+    out.erase(std::unique(out.begin(), out.end()), out.end());
+    return out;
+}
+
+double LshIndex::TypicalDistance(int k, int sample, uint64_t seed) const {
+    if (rows < 2) {
+        return 1.0;
+    }
+    const size_t kk = std::min((size_t)std::max(1, k), rows - 1);
+    const size_t count = std::min(rows, (size_t)std::max(1, sample));
+    std::vector<double> dist(rows);
+    double sum = 0.0;
+    for (size_t s = 0; s < count; ++s) {
+        const size_t r = Mix64(seed ^ Mix64(s)) % rows;
+        const float* x = embedding.data() + r * dim;
+        for (size_t o = 0; o < rows; ++o) {
+            const float* y = embedding.data() + o * dim;
+            double l1 = 0.0;
+            for (size_t i = 0; i < dim; ++i) {
+                l1 += std::abs((double)x[i] - y[i]);
+            }
+            dist[o] = l1;
+        }
+        // dist[r] == 0 takes the first slot, so slot kk is the k-th other row.
+        std::nth_element(dist.begin(), dist.begin() + kk, dist.end());
+        sum += dist[kk];
+    }
+    return sum / (double)count;
+}
\ No newline at end of file
@@ -1,19 +1,43 @@
 #include <algorithm>
+#include <atomic>
 #include <chrono>
 #include <cmath>
+#include <cstring>
 #include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <random>
 #include <sstream>
 #include <string>
+#include <thread>
+#include <unordered_map>
 #include <vector>
 
+#include "aggregate.h"
 #include "algorithms.h"
 #include "arff_reader.h"
+#include "checkpoint.h"
 #include "dataset.h"
 #include "distance.h"
+#include "distance_kernel.h"
+#include "knn_binary.h"
+#include "latency.h"
+#include "lsh.h"
 #include "metrics.h"
+#include "model.h"
+#include "neighbor_cache.h"
 #include "output.h"
+#include "planner.h"
+#include "prototypes.h"
+#include "reorder_buffer.h"
+#include "snapshot.h"
+#include "trace.h"
 #include "util.h"
+#include "worker_slots.h"
+#include "zone_map.h"
 
 // Parse attribute types string (e.g., "n,c,n" or "ncn").
 static std::vector<AttrType> ParseTypes(const std::string& spec) {
@@ -42,6 +66,28 @@ static void BuildTypeIndices(Dataset& ds) {
     }
 }
 
+// Assign dataset-wide codes to nominal values (in order of first appearance).
+static void BuildNominalCodes(Dataset& ds) {
+    const size_t m = ds.types.size();
+    ds.nominalValues.assign(m, {});
+    std::vector<std::unordered_map<std::string, int>> codes(m);
+    for (auto& inst : ds.rows) {
+        for (size_t a = 0; a < m; ++a) {
+            auto& v = inst.attrs[a];
+            v.code = -1;
+            if (ds.types[a] != AttrType::Nominal || v.missing) {
+                continue;
+            }
+            auto it = codes[a].find(v.raw);
+            if (it == codes[a].end()) {
+                it = codes[a].emplace(v.raw, (int)ds.nominalValues[a].size()).first;
+                ds.nominalValues[a].push_back(v.raw);
+            }
+            v.code = it->second;
+        }
+    }
+}
+
 static std::string SanitizePathPart(const std::string& s) {
     std::string out = s;
     for (char& ch : out) {
@@ -53,38 +99,177 @@ static std::string SanitizePathPart(const std::string& s) {
     return out;
 }
 
+// Path of shard segment i/N of an output file: "OUT_x.csv" -> "OUT_x.shard1of4.csv".
+static std::string ShardPath(const std::string& path, int index, int count) {
+    std::filesystem::path p(path);
+    std::string name = p.stem().string() + ".shard" + std::to_string(index) +
+                       "of" + std::to_string(count) + p.extension().string();
+    return (p.parent_path() / name).string();
+}
+
+// Reads the summaries of all shards of one experiment and checks that they
+// tile the whole dataset.
+static bool ReadShards(const std::string& statFile,
+                       int shardCount,
+                       const Dataset& ds,
+                       std::vector<ShardSummary>& shards,
+                       std::string& err) {
+    shards.assign(shardCount, {});
+    size_t next = 0;
+    for (int s = 0; s < shardCount; ++s) {
+        std::string path = ShardPath(statFile, s, shardCount);
+        if (!ReadShardFile(path, shards[s], err)) {
+            return false;
+        }
+        if (shards[s].index != s || shards[s].count != shardCount ||
+            shards[s].begin != next || shards[s].confStd.size() != ds.decisionValues.size()) {
+            err = "Shard file does not match this experiment: " + path;
+            return false;
+        }
+        next = shards[s].end;
+    }
+    if (next != ds.rows.size()) {
+        err = "Shards do not cover the whole dataset: " + statFile;
+        return false;
+    }
+    return true;
+}
+
+// Concatenates shard segments (in shard order) into the final output file.
+static void ConcatShardSegments(const std::string& path, int shardCount) {
+    std::ofstream out(path, std::ios::binary);
+    for (int s = 0; s < shardCount; ++s) {
+        std::ifstream in(ShardPath(path, s, shardCount), std::ios::binary);
+        if (in.peek() != std::ifstream::traits_type::eof()) {
+            out << in.rdbuf();
+        }
+    }
+}
+
+// Re-encodes binary shard segments (in shard order) into one binary kNN file.
+static bool ConcatKnnBinarySegments(const std::string& path, int shardCount, bool float32, std::string& err) {
+    KnnBinaryWriter writer;
+    if (!writer.Open(path, 0, float32, 0, err)) {
+        return false;
+    }
+    std::vector<Neighbor> list;
+    for (int s = 0; s < shardCount; ++s) {
+        KnnBinaryReader reader;
+        if (!reader.Open(ShardPath(path, s, shardCount), err)) {
+            return false;
+        }
+        for (size_t r = reader.FirstRow(); r < reader.FirstRow() + reader.RowCount(); ++r) {
+            if (!reader.ReadRow(r, list, err)) {
+                return false;
+            }
+            writer.Write(r, list);
+        }
+    }
+    return writer.Close(err);
+}
+
+// `riona export-knn <file.bin> [<out.csv>]`: regenerates the text kNN file.
+static int ExportKnn(int argc, char** argv) {
+    if (argc < 3) {
+        std::cerr << "Usage: riona.exe export-knn <kNN_file.bin> [<out.csv>]\n";
+        return 1;
+    }
+    std::string inPath = argv[2];
+    std::string outPath = (argc > 3) ? argv[3]
+                                     : std::filesystem::path(inPath).replace_extension(".csv").string();
+    std::string err;
+    KnnBinaryReader reader;
+    if (!reader.Open(inPath, err)) {
+        std::cerr << err << "\n";
+        return 1;
+    }
+    std::ofstream out(outPath);
+    std::vector<Neighbor> list;
+    for (size_t r = reader.FirstRow(); r < reader.FirstRow() + reader.RowCount(); ++r) {
+        if (!reader.ReadRow(r, list, err)) {
+            std::cerr << err << "\n";
+            return 1;
+        }
+        WriteKnnRow(out, r, list);
+    }
+    return 0;
+}
+
 static void PrintUsage() {
     std::cout
         << "Usage: riona.exe --input <file.arff> [--types <spec>] [options]\n"
+        << "       riona.exe merge --shards <N> --input <file.arff> [options]\n"
+        << "       riona.exe export-knn <kNN_file.bin> [<out.csv>]\n"
+        << "       riona.exe batch <manifest.txt> [options]\n"
+        << "       riona.exe serve --input <train.arff> [options]   (queries on stdin, !reload [<file>],\n"
+        << "                                                        !insert <row>, !erase <id>, !check)\n"
         << "Options:\n"
         << "  --types <spec>                Optional override types (e.g., n,c,n)\n"
         << "  --algo riona|ria|knn|all      Algorithm (default: all)\n"
         << "  --mode g|l|both               Distance stats mode (default: g)\n"
         << "  --svdm svdm|svdmprime         Nominal distance (default: svdm)\n"
+        << "  --metric svdm|heom|ivdm       Attribute distances (default: svdm)\n"
+        << "  --svdm-dense-max <V>          Attributes with more values compute SVDM on demand (default: 1024)\n"
         << "  --k 1,3,log                   k values (default: 1,3,log2(n))\n"
         << "  --n <int>                     n for k+NN local neighborhood (default: n-1)\n"
         << "  --missing <token>             Missing value token (default: ?)\n"
-        << "  --outdir <dir>                Output directory (default: .)\n";
+        << "  --outdir <dir>                Output directory (default: .)\n"
+        << "  --shard <i>/<N>               Classify only slice i (0-based) of N; writes shard segments\n"
+        << "  --shards <N>                  (merge) Number of shards to combine\n"
+        << "  --checkpoint <sec>            Save progress of each experiment every <sec> seconds\n"
+        << "  --resume                      Skip finished experiments, continue partial ones\n"
+        << "  --stream                      Write rows as they are classified (bounded memory)\n"
+        << "  --threads <int>               Classification threads (default: 1)\n"
+        << "  --knn-format csv|bin|bin32    kNN output: text, binary, binary with float32 distances\n"
+        << "  --precision f64|f32|u16|u8    Compact storage for neighbor ranking (default: planner)\n"
+        << "  --memory-limit <size>         Memory budget of the planner, e.g. 512M, 4G (default: 2G)\n"
+        << "  --explain-plan                Print the chosen strategies and exit\n"
+        << "  --force-strategy <list>       Override the planner: scan|matrix|f32|u16|u8, exact|sampled\n"
+        << "  --dedup                       Collapse duplicate rows into weighted prototypes\n"
+        << "  --zone-maps                   Scan rows in 64-row blocks, skipping blocks by min/max bounds\n"
+        << "  --neighbor-cache <dir>        Keep RIONA/k+NN neighbor lists in <dir> for later runs\n"
+        << "  --neighbor-cache-local        Also cache the neighbor lists of local mode\n"
+        << "  --ria-approx                  RIA verifies rules on a bounded class-stratified set\n"
+        << "  --ria-verify <near>,<sample>  Rows per class in that set (default: 64,64)\n"
+        << "  --ria-holdout <fraction>      Objects also classified exactly for comparison (default: 0.05)\n"
+        << "  --lsh <tables>                RIONA and k+NN (with --n) search LSH candidates only\n"
+        << "  --lsh-hashes <int>            Hash functions per LSH table (default: 4)\n"
+        << "  --lsh-probes <int>            Extra buckets probed per table (default: 0)\n"
+        << "  --lsh-width <w>               LSH bucket width (default: auto)\n"
+        << "  --lsh-check <fraction>        Objects also searched exactly for recall@k (default: 0.05)\n"
+        << "  --budget-ms <ms>              Per-query time budget; over it the result is partial (default: none)\n"
+        << "  --budget-rules <N>            Per-query budget of verified rules (default: none)\n"
+        << "  --budget-distances <N>        Per-query budget of distance evaluations (default: none)\n"
+        << "  --loo-sample <N>              Leave-one-out over N class-stratified objects, with intervals\n"
+        << "  --seed <int>                  Seed for sampling (default: 1)\n"
+        << "  --slow <int>                  Slowest objects listed in SLOW_*.csv (default: 20, 0 = off)\n"
+        << "  --trace <file.json>           Record a Chrome trace-event timeline of the run\n"
+        << "  --aggregate <dir>             (batch) Aggregated tables (default: <outdir>/_aggregated)\n";
 }
 
-int main(int argc, char** argv) {
-    Config cfg;
-
-    // Simple CLI parsing
-    for (int i = 1; i < argc; ++i) {
-        std::string arg = argv[i];
-        if (arg == "--input" && i + 1 < argc) {
-            cfg.inputFile = argv[++i];
-        } else if (arg == "--types" && i + 1 < argc) {
-            cfg.typesSpec = argv[++i];
-        } else if (arg == "--algo" && i + 1 < argc) {
-            cfg.algo = argv[++i];
-        } else if (arg == "--mode" && i + 1 < argc) {
-            cfg.mode = argv[++i];
-        } else if (arg == "--svdm" && i + 1 < argc) {
-            cfg.svdm = argv[++i];
-        } else if (arg == "--k" && i + 1 < argc) {
-            std::string kSpec = argv[++i];
+// Parses options args[first..] into cfg. Returns -1 to continue, otherwise the exit code.
+static int ParseArgs(const std::vector<std::string>& args, size_t first, Config& cfg) {
+    for (size_t i = first; i < args.size(); ++i) {
+        const std::string& arg = args[i];
+        if (arg == "--input" && i + 1 < args.size()) {
+            cfg.inputFile = args[++i];
+        } else if (arg == "--types" && i + 1 < args.size()) {
+            cfg.typesSpec = args[++i];
+        } else if (arg == "--algo" && i + 1 < args.size()) {
+            cfg.algo = args[++i];
+        } else if (arg == "--mode" && i + 1 < args.size()) {
+            cfg.mode = args[++i];
+        } else if (arg == "--svdm" && i + 1 < args.size()) {
+            cfg.svdm = args[++i];
+        } else if (arg == "--metric" && i + 1 < args.size()) {
+            cfg.metric = ToLower(args[++i]);
+        } else if (arg == "--svdm-dense-max" && i + 1 < args.size()) {
+            if (!ParseCount(args[++i], cfg.svdmDenseMax)) {
+                std::cerr << "Invalid --svdm-dense-max: " << args[i] << "\n";
+                return 1;
+            }
+        } else if (arg == "--k" && i + 1 < args.size()) {
+            std::string kSpec = args[++i];
             std::stringstream ss(kSpec);
             std::string token;
             while (std::getline(ss, token, ',')) {
@@ -96,12 +281,112 @@ int main(int argc, char** argv) {
                     cfg.kValues.push_back(std::stoi(token));
                 }
             }
-        } else if (arg == "--n" && i + 1 < argc) {
-            cfg.nForKPlusNN = std::stoi(argv[++i]);
-        } else if (arg == "--missing" && i + 1 < argc) {
-            cfg.missingToken = argv[++i];
-        } else if (arg == "--outdir" && i + 1 < argc) {
-            cfg.outDir = argv[++i];
+        } else if (arg == "--n" && i + 1 < args.size()) {
+            cfg.nForKPlusNN = std::stoi(args[++i]);
+        } else if (arg == "--missing" && i + 1 < args.size()) {
+            cfg.missingToken = args[++i];
+        } else if (arg == "--outdir" && i + 1 < args.size()) {
+            cfg.outDir = args[++i];
+        } else if (arg == "--shard" && i + 1 < args.size() && !cfg.mergeShards) {
+            std::string spec = args[++i];
+            size_t sep = spec.find('/');
+            if (sep == std::string::npos) {
+                std::cerr << "Invalid --shard (expected i/N): " << spec << "\n";
+                return 1;
+            }
+            cfg.shardIndex = std::stoi(spec.substr(0, sep));
+            cfg.shardCount = std::stoi(spec.substr(sep + 1));
+        } else if (arg == "--shards" && i + 1 < args.size() && cfg.mergeShards) {
+            cfg.shardCount = std::stoi(args[++i]);
+        } else if (arg == "--checkpoint" && i + 1 < args.size()) {
+            cfg.checkpointSec = std::stod(args[++i]);
+        } else if (arg == "--resume") {
+            cfg.resume = true;
+        } else if (arg == "--knn-format" && i + 1 < args.size()) {
+            cfg.knnFormat = args[++i];
+            if (cfg.knnFormat != "csv" && cfg.knnFormat != "bin" && cfg.knnFormat != "bin32") {
+                std::cerr << "Unknown kNN format: " << cfg.knnFormat << "\n";
+                return 1;
+            }
+        } else if (arg == "--precision" && i + 1 < args.size()) {
+            cfg.precision = args[++i];
+            if (cfg.precision != "f64" && cfg.precision != "f32" && cfg.precision != "u16" &&
+                cfg.precision != "u8") {
+                std::cerr << "Unknown precision: " << cfg.precision << "\n";
+                return 1;
+            }
+        } else if (arg == "--memory-limit" && i + 1 < args.size()) {
+            if (!ParseByteSize(args[++i], cfg.memoryLimit)) {
+                std::cerr << "Invalid --memory-limit: " << args[i] << "\n";
+                return 1;
+            }
+        } else if (arg == "--explain-plan") {
+            cfg.explainPlan = true;
+        } else if (arg == "--force-strategy" && i + 1 < args.size()) {
+            cfg.forceStrategy = args[++i];
+        } else if (arg == "--dedup") {
+            cfg.dedup = true;
+        } else if (arg == "--zone-maps") {
+            cfg.zoneMaps = true;
+        } else if (arg == "--neighbor-cache" && i + 1 < args.size()) {
+            cfg.neighborCacheDir = args[++i];
+        } else if (arg == "--neighbor-cache-local") {
+            cfg.neighborCacheLocal = true;
+        } else if (arg == "--ria-approx") {
+            cfg.riaApprox = true;
+        } else if (arg == "--ria-verify" && i + 1 < args.size()) {
+            std::string spec = args[++i];
+            size_t sep = spec.find(',');
+            cfg.riaNearest = std::stoi(spec.substr(0, sep));
+            cfg.riaSample = (sep == std::string::npos) ? 0 : std::stoi(spec.substr(sep + 1));
+            if (cfg.riaNearest < 1 || cfg.riaSample < 0) {
+                std::cerr << "Invalid --ria-verify (expected nearest,sample): " << spec << "\n";
+                return 1;
+            }
+        } else if (arg == "--ria-holdout" && i + 1 < args.size()) {
+            cfg.riaHoldout = std::stod(args[++i]);
+        } else if (arg == "--lsh" && i + 1 < args.size()) {
+            cfg.lshTables = std::stoi(args[++i]);
+        } else if (arg == "--lsh-hashes" && i + 1 < args.size()) {
+            cfg.lshHashes = std::stoi(args[++i]);
+        } else if (arg == "--lsh-probes" && i + 1 < args.size()) {
+            cfg.lshProbes = std::stoi(args[++i]);
+        } else if (arg == "--lsh-width" && i + 1 < args.size()) {
+            cfg.lshWidth = std::stod(args[++i]);
+        } else if (arg == "--lsh-check" && i + 1 < args.size()) {
+            cfg.lshCheck = std::stod(args[++i]);
+        } else if (arg == "--budget-ms" && i + 1 < args.size()) {
+            if (!ParseNonNegative(args[++i], cfg.budgetMs)) {
+                std::cerr << "Invalid --budget-ms: " << args[i] << "\n";
+                return 1;
+            }
+        } else if (arg == "--budget-rules" && i + 1 < args.size()) {
+            if (!ParseCount(args[++i], cfg.budgetRules)) {
+                std::cerr << "Invalid --budget-rules: " << args[i] << "\n";
+                return 1;
+            }
+        } else if (arg == "--budget-distances" && i + 1 < args.size()) {
+            if (!ParseCount(args[++i], cfg.budgetDistances)) {
+                std::cerr << "Invalid --budget-distances: " << args[i] << "\n";
+                return 1;
+            }
+        } else if (arg == "--loo-sample" && i + 1 < args.size()) {
+            if (!ParseCount(args[++i], cfg.looSample)) {
+                std::cerr << "Invalid --loo-sample: " << args[i] << "\n";
+                return 1;
+            }
+        } else if (arg == "--seed" && i + 1 < args.size()) {
+            cfg.seed = std::stoull(args[++i]);
+        } else if (arg == "--slow" && i + 1 < args.size()) {
+            cfg.slowCount = std::stoi(args[++i]);
+        } else if (arg == "--aggregate" && i + 1 < args.size()) {
+            cfg.aggregateDir = args[++i];
+        } else if (arg == "--trace" && i + 1 < args.size()) {
+            cfg.traceFile = args[++i];
+        } else if (arg == "--stream") {
+            cfg.stream = true;
+        } else if (arg == "--threads" && i + 1 < args.size()) {
+            cfg.threads = std::stoi(args[++i]);
         } else if (arg == "--help") {
             PrintUsage();
             return 0;
@@ -111,14 +396,12 @@ int main(int argc, char** argv) {
             return 1;
         }
     }
+    return -1;
+}
 
-    if (cfg.inputFile.empty()) {
-        PrintUsage();
-        return 1;
-    }
-
-    // Prepare distance config
-    DistanceConfig distCfg;
+// Distance settings of --svdm and --metric.
+static bool MakeDistanceConfig(const Config& cfg, DistanceConfig& distCfg, std::string& err) {
+    distCfg = DistanceConfig();
     if (cfg.svdm == "svdmprime" || cfg.svdm == "svdm'" || cfg.svdm == "svdmp") {
         distCfg.svdmPrime = true;
         distCfg.missingNominal = 1.0;
@@ -127,15 +410,218 @@ int main(int argc, char** argv) {
         distCfg.missingNominal = 2.0;
     }
     distCfg.missingNumeric = 1.0;
+    distCfg.denseValues = cfg.svdmDenseMax;
+    if (cfg.metric == "heom") {
+        distCfg.metric = Metric::HEOM;
+        distCfg.missingNominal = 1.0;
+    } else if (cfg.metric == "ivdm") {
+        distCfg.metric = Metric::IVDM;
+    } else if (cfg.metric != "svdm") {
+        err = "Unknown metric: " + cfg.metric;
+        return false;
+    }
+    return true;
+}
+
+// Types (with the --types override), numeric values, nominal codes, kernel
+// columns and class labels of a dataset as read.
+static bool PrepareDataset(const Config& cfg, Dataset& ds, std::string& err) {
+    // Optional override of attribute types
+    if (!cfg.typesSpec.empty()) {
+        ds.types = ParseTypes(cfg.typesSpec);
+        if (ds.types.size() != ds.rows[0].attrs.size()) {
+            err = "Types count does not match number of attributes.";
+            return false;
+        }
+    }
+    BuildTypeIndices(ds);
+
+    {
+        TraceSpan span("convert types");
+
+        // Convert numeric values to doubles for numeric attributes
+        for (auto& inst : ds.rows) {
+            for (size_t a = 0; a < ds.types.size(); ++a) {
+                if (ds.types[a] != AttrType::Numeric) {
+                    continue;
+                }
+                auto& v = inst.attrs[a];
+                if (v.missing) {
+                    continue;
+                }
+                try {
+                    v.num = std::stod(v.raw);
+                } catch (...) {
+                    v.missing = true;
+                }
+            }
+        }
+
+        BuildNominalCodes(ds);
+        BuildKernelColumns(ds);
+
+        // Build decision label mapping
+        for (const auto& inst : ds.rows) {
+            if (ds.decisionIndex.find(inst.decision) == ds.decisionIndex.end()) {
+                int idx = static_cast<int>(ds.decisionValues.size());
+                ds.decisionValues.push_back(inst.decision);
+                ds.decisionIndex[inst.decision] = idx;
+            }
+        }
+    }
+    return true;
+}
+
+// Adds the report counters of one object (or of a checkpoint) to an experiment's.
+static void AddCounters(RiaApproxReport& sum, const RiaApproxReport& add) {
+    sum.heldOut += add.heldOut;
+    sum.disagreeStd += add.disagreeStd;
+    sum.disagreeNorm += add.disagreeNorm;
+    sum.exactCorrectStd += add.exactCorrectStd;
+    sum.approxCorrectStd += add.approxCorrectStd;
+    sum.exactCorrectNorm += add.exactCorrectNorm;
+    sum.approxCorrectNorm += add.approxCorrectNorm;
+}
+
+static void AddCounters(LshReport& sum, const LshReport& add) {
+    sum.queries += add.queries;
+    sum.fallbacks += add.fallbacks;
+    sum.candidateSum += add.candidateSum;
+    sum.checked += add.checked;
+    sum.exactNeighbors += add.exactNeighbors;
+    sum.foundNeighbors += add.foundNeighbors;
+}
+
+// Per-query limits of --budget-ms, --budget-rules and --budget-distances.
+static QueryBudget MakeQueryBudget(const Config& cfg) {
+    QueryBudget budget;
+    budget.timeMs = cfg.budgetMs;
+    budget.ruleChecks = cfg.budgetRules;
+    budget.distances = cfg.budgetDistances;
+    return budget;
+}
+
+// Checkpoint key of one experiment: dataKey (the rows, distance settings and
+// mode, as NeighborCacheKey hashes them) plus every option that changes the
+// results of `algo` beyond its cell name, so --resume never continues a
+// checkpoint written under another configuration.
+static uint64_t CheckpointKey(const Config& cfg, uint64_t dataKey, const std::string& algo) {
+    uint64_t h = dataKey;
+    auto mix = [&h](uint64_t v) { h = Mix64(h ^ v); };
+    auto mixDouble = [&mix](double v) {
+        uint64_t bits = 0;
+        std::memcpy(&bits, &v, sizeof(bits));
+        mix(bits);
+    };
+    auto mixString = [&mix](const std::string& s) {
+        mix(s.size());
+        for (unsigned char ch : s) {
+            mix(ch);
+        }
+    };
+    mixString(cfg.knnFormat);
+    mixString(cfg.missingToken);
+    mixDouble(cfg.budgetMs);
+    mix(cfg.budgetRules);
+    mix(cfg.budgetDistances);
+    mix(cfg.looSample);
+    if (cfg.looSample > 0) {
+        mix(cfg.seed);
+    }
+    if (algo == "KNN" || algo == "KNNlsh") {
+        mix((uint64_t)(int64_t)cfg.nForKPlusNN);
+    }
+    if (algo == "RIAapprox") {
+        mix((uint64_t)cfg.riaNearest);
+        mix((uint64_t)cfg.riaSample);
+        mixDouble(cfg.riaHoldout);
+        mix(cfg.seed);
+    }
+    if (algo == "RIONAlsh" || algo == "KNNlsh") {
+        mix((uint64_t)cfg.lshTables);
+        mix((uint64_t)cfg.lshHashes);
+        mix((uint64_t)cfg.lshProbes);
+        mixDouble(cfg.lshWidth);
+        mixDouble(cfg.lshCheck);
+        mix(cfg.seed);
+    }
+    return h;
+}
+
+// --loo-sample: `count` test objects, allocated to classes in proportion to
+// their sizes (largest remainders) and drawn without replacement within each
+// class. Returned in row order; drawn receives the count per class.
+static std::vector<size_t> StratifiedLooSample(const Dataset& ds, size_t count, uint64_t seed, std::vector<int>& drawn) {
+    const size_t d = ds.decisionValues.size();
+    std::vector<std::vector<size_t>> strata(d);
+    for (size_t r = 0; r < ds.rows.size(); ++r) {
+        strata[ds.decisionIndex.at(ds.rows[r].decision)].push_back(r);
+    }
+
+    drawn.assign(d, 0);
+    std::vector<std::pair<double, size_t>> remainders;
+    size_t allocated = 0;
+    for (size_t c = 0; c < d; ++c) {
+        const double quota = (double)count * strata[c].size() / ds.rows.size();
+        drawn[c] = (int)std::floor(quota);
+        allocated += drawn[c];
+        remainders.push_back({quota - drawn[c], c});
+    }
+    std::stable_sort(remainders.begin(), remainders.end(),
+                     [](const std::pair<double, size_t>& a, const std::pair<double, size_t>& b) {
+                         return a.first > b.first;
+                     });
+    for (size_t i = 0; allocated < count && i < remainders.size(); ++i, ++allocated) {
+        ++drawn[remainders[i].second];
+    }
+
+    std::vector<size_t> rows;
+    std::mt19937_64 rng(Mix64(seed));
+    for (size_t c = 0; c < d; ++c) {
+        auto& stratum = strata[c];
+        for (int i = 0; i < drawn[c]; ++i) {
+            std::uniform_int_distribution<size_t> pick((size_t)i, stratum.size() - 1);
+            std::swap(stratum[i], stratum[pick(rng)]);
+        }
+        rows.insert(rows.end(), stratum.begin(), stratum.begin() + drawn[c]);
+    }
+    std::sort(rows.begin(), rows.end());
+    return rows;
+}
+
+// Runs all experiments of one dataset. Each finished experiment is appended to
+// summaries when given (riona batch). Parallel phases use --threads workers;
+// a batch job (shared != null) runs on one thread of its own and adds
+// whatever slots of the shared pool are idle when the phase starts.
+static int RunExperiments(const Config& cfgIn, std::vector<ExperimentSummary>* summaries,
+                          WorkerSlots* shared = nullptr) {
+    Config cfg = cfgIn;
+    const int maxThreads = std::max(1, cfg.threads);
+    auto acquireWorkers = [&]() { return 1 + (shared ? shared->TryAcquire(maxThreads - 1) : maxThreads - 1); };
+    auto releaseWorkers = [&](int workers) {
+        if (shared) {
+            shared->Release(workers - 1);
+        }
+    };
+    DistanceConfig distCfg;
+    std::string err;
+    if (!MakeDistanceConfig(cfg, distCfg, err)) {
+        std::cerr << err << "\n";
+        return 1;
+    }
 
     // Read dataset (ARFF)
     Dataset ds;
     auto t0 = std::chrono::high_resolution_clock::now();
     auto tReadStart = t0;
 
-    std::string err;
     ArffReader reader;
-    if (!reader.Read(cfg.inputFile, cfg, ds, err)) {
+    bool readOk = false;
+    {
+        TraceSpan span("read");
+        readOk = reader.Read(cfg.inputFile, cfg, ds, err);
+    }
+    if (!readOk) {
         std::cerr << err << "\n";
         return 1;
     }
@@ -146,41 +632,17 @@ int main(int argc, char** argv) {
         return 1;
     }
 
-    // Optional override of attribute types
-    if (!cfg.typesSpec.empty()) {
-        ds.types = ParseTypes(cfg.typesSpec);
-        if (ds.types.size() != ds.rows[0].attrs.size()) {
-            std::cerr << "Types count does not match number of attributes.\n";
-            return 1;
-        }
+    if (!PrepareDataset(cfg, ds, err)) {
+        std::cerr << err << "\n";
+        return 1;
     }
-    BuildTypeIndices(ds);
-
-    // Convert numeric values to doubles for numeric attributes
-    for (auto& inst : ds.rows) {
-        for (size_t a = 0; a < ds.types.size(); ++a) {
-            if (ds.types[a] != AttrType::Numeric) {
-                continue;
-            }
-            auto& v = inst.attrs[a];
-            if (v.missing) {
-                continue;
-            }
-            try {
-                v.num = std::stod(v.raw);
-            } catch (...) {
-                v.missing = true;
-            }
-        }
+    if (cfg.dedup) {
+        TraceSpan span("dedup");
+        BuildPrototypes(ds);
     }
-
-    // Build decision label mapping
-    for (const auto& inst : ds.rows) {
-        if (ds.decisionIndex.find(inst.decision) == ds.decisionIndex.end()) {
-            int idx = static_cast<int>(ds.decisionValues.size());
-            ds.decisionValues.push_back(inst.decision);
-            ds.decisionIndex[inst.decision] = idx;
-        }
+    if (cfg.zoneMaps) {
+        TraceSpan span("zone maps");
+        BuildZoneMaps(ds);
     }
 
     // Compute global stats on the full dataset (used in global mode and for reporting)
@@ -189,8 +651,11 @@ int main(int argc, char** argv) {
         allIndices[i] = static_cast<int>(i);
     }
     auto tPrepStart = std::chrono::high_resolution_clock::now();
-    Stats globalStats = ComputeStats(ds, allIndices, distCfg);
-    auto tPrepEnd = std::chrono::high_resolution_clock::now();
+    Stats globalStats;
+    {
+        TraceSpan span("stats global");
+        globalStats = ComputeStats(ds, allIndices, distCfg);
+    }
 
     // Prepare k values
     if (cfg.kValues.empty()) {
@@ -228,7 +693,6 @@ int main(int argc, char** argv) {
         std::cerr << "Unknown algorithm: " << cfg.algo << "\n";
         return 1;
     }
-
     std::vector<std::string> modes;
     if (cfg.mode == "both") {
         modes = {"g", "l"};
@@ -239,7 +703,177 @@ int main(int argc, char** argv) {
         return 1;
     }
 
+    // Sampled leave-one-out: the drawn objects are classified against all
+    // other rows. A sample as large as the dataset is plain leave-one-out.
+    std::vector<size_t> looRows;
+    LooSampleReport looReport;
+    if (cfg.looSample > 0 && cfg.looSample < ds.rows.size()) {
+        if (cfg.shardCount > 1 || cfg.checkpointSec > 0.0 || cfg.resume || cfg.knnFormat != "csv") {
+            std::cerr << "--loo-sample cannot be combined with --shard, --checkpoint, --resume or a binary --knn-format.\n";
+            return 1;
+        }
+        looRows = StratifiedLooSample(ds, cfg.looSample, cfg.seed, looReport.drawn);
+        looReport.objects = looRows.size();
+        looReport.seed = cfg.seed;
+    }
+
+    // Planner: neighbor-search and consistency strategies for this dataset.
+    ExecutionPlan plan;
+    if (!PlanExecution(ds, globalStats, cfg, algos, modes, kList, plan, err)) {
+        std::cerr << err << "\n";
+        return 1;
+    }
+    if (cfg.explainPlan) {
+        std::cout << cfg.inputFile << "\n";
+        PrintPlan(std::cout, ds, plan);
+        return 0;
+    }
+    cfg.riaApprox = plan.sampledConsistency;
+    // The rule cache is filled by RIA, so RIA runs before RIONA (summaries are sorted anyway).
+    std::map<std::string, ConsistencyCache> ruleCaches;
+    if (plan.consistencyCache && !cfg.mergeShards) {
+        std::stable_partition(algos.begin(), algos.end(), [](const std::string& a) { return a == "RIA"; });
+        for (const auto& mode : modes) {
+            ruleCaches[mode].Init(ds.rows.size());
+        }
+    }
+    {
+        TraceSpan span("plan");
+        Precision precision = plan.precision == "f32" ? Precision::F32
+                            : plan.precision == "u16" ? Precision::U16
+                            : plan.precision == "u8"  ? Precision::U8
+                                                      : Precision::F64;
+        if (!BuildCompactColumns(ds, precision, err)) {
+            std::cerr << "Error: " << err << "\n";
+            return 1;
+        }
+        if (precision != Precision::F64) {
+            globalStats.compact = BuildCompactMetric(ds, globalStats, distCfg);
+        }
+        if (plan.distanceMatrix && !cfg.mergeShards) {
+            const int workers = acquireWorkers();
+            BuildPairDistances(ds, globalStats, distCfg, workers);
+            releaseWorkers(workers);
+        }
+    }
+
+    // Approximate RIA results get their own experiment name so they never
+    // overwrite the exact ones.
+    if (cfg.riaApprox) {
+        std::replace(algos.begin(), algos.end(), std::string("RIA"), std::string("RIAapprox"));
+    }
+    // Likewise for neighborhoods searched among LSH candidates; k+NN only
+    // qualifies with a bounded --n.
+    if (cfg.lshTables > 0) {
+        std::replace(algos.begin(), algos.end(), std::string("RIONA"), std::string("RIONAlsh"));
+        if (cfg.nForKPlusNN >= 0) {
+            std::replace(algos.begin(), algos.end(), std::string("KNN"), std::string("KNNlsh"));
+        }
+    }
+    RiaVerifyLimits riaLimits;
+    riaLimits.nearest = cfg.riaNearest;
+    riaLimits.sample = cfg.riaSample;
+    riaLimits.seed = cfg.seed;
+    const QueryBudget budget = MakeQueryBudget(cfg);
+
+    // Persistent neighbor lists per mode, as deep as the planner's budget
+    // allows (rankings of "l" differ per object, so that mode is cached only
+    // on request).
+    std::map<std::string, NeighborCache> neighborCaches;
+    if (!cfg.neighborCacheDir.empty() && !cfg.mergeShards) {
+        const size_t depth = plan.neighborCacheDepth;
+        for (const auto& mode : modes) {
+            if (depth == 0 || (mode == "l" && !cfg.neighborCacheLocal)) {
+                continue;
+            }
+            if (!neighborCaches[mode].Open(cfg.neighborCacheDir, NeighborCacheKey(ds, distCfg, mode), ds.rows.size(),
+                                           depth, err)) {
+                std::cerr << err << "\n";
+                return 1;
+            }
+        }
+    }
+
+    // Local mode: per-worker stats of all rows; each test object is removed
+    // and re-added instead of recomputing the stats of the other n-1 rows.
+    // IVDM intervals follow the extrema, so that metric recomputes them.
+    const bool incrementalLocal = distCfg.metric != Metric::IVDM;
+    std::vector<IncrementalStats> localStats;
+    if (cfg.mode != "g" && incrementalLocal) {
+        TraceSpan span("stats local");
+        localStats.resize(maxThreads);
+        for (auto& local : localStats) {
+            local.Init(ds, allIndices, distCfg);
+        }
+    }
+    // One index for both modes: it only proposes candidates, which are ranked
+    // (and checked for recall) with the mode's stats. Local stats differ from
+    // the global ones by a single object, so the embedding is shared.
+    LshIndex lsh;
+    if (cfg.lshTables > 0) {
+        TraceSpan span("lsh build");
+        lsh.Build(ds, globalStats, distCfg, cfg.lshTables, cfg.lshHashes, cfg.lshWidth, cfg.seed);
+    }
+    auto tPrepEnd = std::chrono::high_resolution_clock::now();
+
+    // Build output base name
+    std::string inputBase = cfg.inputFile;
+    size_t slash = inputBase.find_last_of("/\\");
+    if (slash != std::string::npos) {
+        inputBase = inputBase.substr(slash + 1);
+    }
+    size_t dot = inputBase.find_last_of('.');
+    if (dot != std::string::npos) {
+        inputBase = inputBase.substr(0, dot);
+    }
+    // Metric label of the output names: SVDM[prime], HEOM or IVDM[prime].
+    std::string svdmLabel = distCfg.metric == Metric::HEOM ? "HEOM"
+                          : distCfg.metric == Metric::IVDM ? "IVDM"
+                                                           : "SVDM";
+    if (distCfg.svdmPrime && distCfg.metric != Metric::HEOM) {
+        svdmLabel += "prime";
+    }
+    const bool binaryKnn = (cfg.knnFormat != "csv");
+
+    // Slice of test objects classified by this process (whole dataset unless sharded)
+    size_t rowBegin = 0;
+    size_t rowEnd = ds.rows.size();
+    if (cfg.shardCount > 1 && !cfg.mergeShards) {
+        rowBegin = ds.rows.size() * cfg.shardIndex / cfg.shardCount;
+        rowEnd = ds.rows.size() * (cfg.shardIndex + 1) / cfg.shardCount;
+    }
+    // With --loo-sample the slice is over positions in looRows.
+    if (!looRows.empty()) {
+        rowEnd = looRows.size();
+    }
+    auto rowAt = [&](size_t pos) { return looRows.empty() ? pos : looRows[pos]; };
+
+    auto recordSummary = [&](const std::string& algo, const std::string& mode, int k,
+                             double readMs, double prepMs, double classifyMs, double writeMs, double totalMs,
+                             const std::vector<std::vector<int>>& confStd,
+                             const std::vector<std::vector<int>>& confNorm) {
+        if (!summaries) {
+            return;
+        }
+        ExperimentSummary sum;
+        sum.dataset = inputBase;
+        sum.algorithm = algo;
+        sum.mode = mode;
+        sum.svdm = svdmLabel;
+        sum.k = k;
+        sum.timeReadMs = readMs;
+        sum.timePrepMs = prepMs;
+        sum.timeClassifyMs = classifyMs;
+        sum.timeWriteMs = writeMs;
+        sum.timeTotalMs = totalMs;
+        sum.classes = ds.decisionValues;
+        sum.metricsStd = ComputeMetrics(confStd);
+        sum.metricsNorm = ComputeMetrics(confNorm);
+        summaries->push_back(std::move(sum));
+    };
+
     // Run experiments
+    std::map<std::string, uint64_t> dataKeys;                   // mode -> NeighborCacheKey (checkpoint keys)
     for (const auto& algo : algos) {
         for (const auto& mode : modes) {
             for (int k : kList) {
@@ -248,17 +882,189 @@ int main(int argc, char** argv) {
                 if (kEff < 1) {
                     continue;
                 }
-                // Prepare output buffers
-                std::vector<std::string> predStd(ds.rows.size());
-                std::vector<std::string> predNorm(ds.rows.size());
-                std::vector<std::vector<Neighbor>> knnLists(ds.rows.size());
+                const int traceExperiment = TraceSetExperiment(inputBase, algo, mode, kEff);
+                TraceSpan experimentSpan("experiment");
+
+                // Build output filenames
+                int D = static_cast<int>(ds.types.size());
+                int R = static_cast<int>(ds.rows.size());
+
+                std::stringstream suffix;
+                suffix << algo << "_" << inputBase
+                       << "_D" << D
+                       << "_R" << R;
+                if (!looRows.empty()) {
+                    suffix << "_S" << looRows.size();
+                }
+                suffix << "_k" << kEff
+                       << "_" << svdmLabel
+                       << "_" << mode;
+
+                std::string baseFolderName = SanitizePathPart(inputBase);
+                std::filesystem::path baseDir = std::filesystem::path(cfg.outDir) / baseFolderName;
+                std::filesystem::create_directories(baseDir);
+
+                std::string expFolderName = "EXP_" + SanitizePathPart(suffix.str());
+                std::filesystem::path expDir = baseDir / expFolderName;
+                std::filesystem::create_directories(expDir);
+
+                std::string outFile = (expDir / ("OUT_" + suffix.str() + ".csv")).string();
+                std::string statFile = (expDir / ("STAT_" + suffix.str() + ".txt")).string();
+                std::string knnFile = (expDir / ("kNN_" + suffix.str() + (binaryKnn ? ".bin" : ".csv"))).string();
+
+                if (cfg.mergeShards) {
+                    std::vector<ShardSummary> shards;
+                    if (!ReadShards(statFile, cfg.shardCount, ds, shards, err)) {
+                        std::cerr << err << "\n";
+                        return 1;
+                    }
+                    ConcatShardSegments(outFile, cfg.shardCount);
+                    if (binaryKnn) {
+                        if (!ConcatKnnBinarySegments(knnFile, cfg.shardCount, cfg.knnFormat == "bin32", err)) {
+                            std::cerr << err << "\n";
+                            return 1;
+                        }
+                    } else {
+                        ConcatShardSegments(knnFile, cfg.shardCount);
+                    }
+
+                    // Times are summed over shards; the slowest shard is reported separately.
+                    ShardSummary sum = shards.front();
+                    for (size_t s = 1; s < shards.size(); ++s) {
+                        sum.timeReadMs += shards[s].timeReadMs;
+                        sum.timePrepMs += shards[s].timePrepMs;
+                        sum.timeClassifyMs += shards[s].timeClassifyMs;
+                        sum.timeWriteMs += shards[s].timeWriteMs;
+                        sum.timeTotalMs += shards[s].timeTotalMs;
+                        for (size_t r = 0; r < sum.confStd.size(); ++r) {
+                            for (size_t c = 0; c < sum.confStd.size(); ++c) {
+                                sum.confStd[r][c] += shards[s].confStd[r][c];
+                                sum.confNorm[r][c] += shards[s].confNorm[r][c];
+                            }
+                        }
+                        sum.latency.Merge(shards[s].latency);
+                        sum.partial += shards[s].partial;
+                        sum.slowest.insert(sum.slowest.end(), shards[s].slowest.begin(), shards[s].slowest.end());
+                    }
+                    if (cfg.slowCount > 0) {
+                        std::stable_sort(sum.slowest.begin(), sum.slowest.end(),
+                                         [](const SlowObject& a, const SlowObject& b) { return a.latencyNs > b.latencyNs; });
+                        sum.slowest.resize(std::min(sum.slowest.size(), (size_t)cfg.slowCount));
+                        WriteSlowFile((expDir / ("SLOW_" + suffix.str() + ".csv")).string(), ds, sum.slowest);
+                    }
+                    WriteStatFile(statFile,
+                                  ds,
+                                  globalStats,
+                                  cfg.inputFile,
+                                  algo,
+                                  mode,
+                                  svdmLabel,
+                                  kEff,
+                                  sum.timeReadMs,
+                                  sum.timePrepMs,
+                                  sum.timeClassifyMs,
+                                  sum.timeWriteMs,
+                                  sum.timeTotalMs,
+                                  sum.confStd,
+                                  sum.confNorm);
+                    AppendLatency(statFile, sum.latency);
+                    if (budget.Active()) {
+                        AppendBudgetReport(statFile, cfg, sum.partial, ds.rows.size());
+                    }
+                    AppendShardTimes(statFile, shards);
+                    recordSummary(algo, mode, kEff, sum.timeReadMs, sum.timePrepMs, sum.timeClassifyMs,
+                                  sum.timeWriteMs, sum.timeTotalMs, sum.confStd, sum.confNorm);
+                    continue;
+                }
+
+                if (cfg.shardCount > 1) {
+                    outFile = ShardPath(outFile, cfg.shardIndex, cfg.shardCount);
+                    knnFile = ShardPath(knnFile, cfg.shardIndex, cfg.shardCount);
+                }
+
+                // Prepare output buffers (streaming mode writes rows as they are committed)
+                const size_t rowCount = cfg.stream ? 0 : rowEnd - rowBegin;
+                std::vector<std::string> predStd(rowCount);
+                std::vector<std::string> predNorm(rowCount);
+                std::vector<std::vector<Neighbor>> knnLists(rowCount);
+
+                // Checkpointing: restore progress of this cell when resuming
+                std::string ckptFile = (expDir / ("CKPT_" + suffix.str() + ".txt")).string();
+                if (cfg.shardCount > 1) {
+                    ckptFile = ShardPath(ckptFile, cfg.shardIndex, cfg.shardCount);
+                }
+                CheckpointState ckpt;
+                ckpt.cell = suffix.str();
+                if (!dataKeys.count(mode)) {
+                    dataKeys[mode] = NeighborCacheKey(ds, distCfg, mode);
+                }
+                ckpt.key = CheckpointKey(cfg, dataKeys[mode], algo);
+                ckpt.begin = rowBegin;
+                ckpt.end = rowEnd;
+                ckpt.done = rowBegin;
+                ckpt.streaming = cfg.stream;
+                ckpt.confStd = InitMatrix(ds.decisionValues.size());
+                ckpt.confNorm = InitMatrix(ds.decisionValues.size());
+                if (cfg.resume && std::filesystem::exists(ckptFile)) {
+                    if (!LoadCheckpoint(ckptFile, ds, ckpt, predStd, predNorm, knnLists, err)) {
+                        std::cerr << err << " (starting over)\n";
+                    } else if (ckpt.complete) {
+                        std::cout << "Skipping finished experiment " << suffix.str() << "\n";
+                        recordSummary(algo, mode, kEff, ckpt.timeReadMs, ckpt.timePrepMs, ckpt.timeClassifyMs,
+                                      ckpt.timeWriteMs,
+                                      ckpt.timeReadMs + ckpt.timePrepMs + ckpt.timeClassifyMs + ckpt.timeWriteMs,
+                                      ckpt.confStd, ckpt.confNorm);
+                        continue;
+                    }
+                }
+                std::vector<std::vector<int>> confStd = ckpt.confStd;
+                std::vector<std::vector<int>> confNorm = ckpt.confNorm;
+                const bool checkpointing = cfg.checkpointSec > 0.0 || cfg.resume;
+                const double checkpointMs = 1000.0 * (cfg.checkpointSec > 0.0 ? cfg.checkpointSec : 60.0);
+                const double priorClassifyMs = ckpt.timeClassifyMs;
+
+                StreamingResultWriter writer;
+                if (cfg.stream &&
+                    !writer.Open(outFile, knnFile, cfg.knnFormat, rowBegin, ckpt.outBytes, ckpt.knnBytes, err)) {
+                    std::cerr << err << "\n";
+                    return 1;
+                }
+
+                // Report counters of the committed rows (restored from the checkpoint).
+                RiaApproxReport riaReport;
+                riaReport.nearest = riaLimits.nearest;
+                riaReport.sample = riaLimits.sample;
+                riaReport.seed = riaLimits.seed;
+                riaReport.holdout = cfg.riaHoldout;
+                AddCounters(riaReport, ckpt.ria);
+
+                LshReport lshReport;
+                lshReport.tables = cfg.lshTables;
+                lshReport.hashes = cfg.lshHashes;
+                lshReport.probes = cfg.lshProbes;
+                lshReport.width = lsh.Width();
+                AddCounters(lshReport, ckpt.lsh);
+
+                // Per-object latency: histogram plus a min-heap of the slowest rows.
+                LatencyHistogram latency = ckpt.latency;
+                size_t partialCount = ckpt.partial;
+                std::vector<SlowObject> slowest = ckpt.slowest;
+                auto slowerFirst = [](const SlowObject& a, const SlowObject& b) {
+                    return a.latencyNs > b.latencyNs;
+                };
+                std::make_heap(slowest.begin(), slowest.end(), slowerFirst);
+                size_t cacheHits = ckpt.cacheHits;
+                size_t cacheMisses = ckpt.cacheMisses;
 
                 auto tClassifyStart = std::chrono::high_resolution_clock::now();
+                auto tLastCheckpoint = tClassifyStart;
 
-                std::vector<std::vector<int>> confStd = InitMatrix(ds.decisionValues.size());
-                std::vector<std::vector<int>> confNorm = InitMatrix(ds.decisionValues.size());
+                ConsistencyCache* ruleCache = ruleCaches.count(mode) ? &ruleCaches[mode] : nullptr;
+                // k+NN with the default n ranks every row, which is not cached.
+                const bool cachedAlgo = algo == "RIONA" || (algo == "KNN" && cfg.nForKPlusNN >= 0);
+                NeighborCache* neighborCache = cachedAlgo && neighborCaches.count(mode) ? &neighborCaches[mode] : nullptr;
 
-                for (size_t i = 0; i < ds.rows.size(); ++i) {
+                auto classifyWith = [&](size_t i, const Stats& baseStats) {
                     // Build training index list for leave-one-out
                     std::vector<int> trainingIdx;
                     trainingIdx.reserve(ds.rows.size() - 1);
@@ -267,100 +1073,756 @@ int main(int argc, char** argv) {
                         trainingIdx.push_back(static_cast<int>(j));
                     }
 
-                    // Choose base stats: global or local
-                    Stats baseStats = (mode == "g") ? globalStats : ComputeStats(ds, trainingIdx, distCfg);
+                    // KNN => k+NN
+                    int nLocal = (cfg.nForKPlusNN < 0) ? (int)trainingIdx.size() : cfg.nForKPlusNN;
+                    if (nLocal < kEff) {
+                        nLocal = kEff;
+                    }
+
+                    if (algo == "RIONAlsh" || algo == "KNNlsh") {
+                        // Search the LSH candidates unless there are too few of them.
+                        const int needed = (algo == "RIONAlsh") ? kEff : nLocal;
+                        std::vector<int> pool = lsh.Candidates(i, cfg.lshProbes);
+                        const bool usePool = pool.size() >= (size_t)needed;
+                        size_t exactCount = 0;
+                        size_t found = 0;
+                        const bool check = usePool &&
+                            (double)(Mix64(cfg.seed ^ Mix64(i)) >> 11) * 0x1.0p-53 < cfg.lshCheck;
+                        if (check) {
+                            const Instance& tst = ds.rows[i];
+                            auto exact = ComputeNeighbors(ds, baseStats, distCfg, tst, trainingIdx, needed);
+                            auto approx = ComputeNeighbors(ds, baseStats, distCfg, tst, pool, needed);
+                            exactCount = exact.size();
+                            // recall@k by row: rows nearer than the exact k-th distance
+                            // count when returned; rows tied with it are interchangeable
+                            // and fill the remaining places.
+                            if (!exact.empty()) {
+                                const double kth = exact.back().dist;
+                                std::vector<int> nearer;
+                                for (const auto& nb : exact) {
+                                    if (nb.dist < kth) {
+                                        nearer.push_back(nb.index);
+                                    }
+                                }
+                                std::sort(nearer.begin(), nearer.end());
+                                size_t tied = 0;
+                                for (const auto& nb : approx) {
+                                    if (std::binary_search(nearer.begin(), nearer.end(), nb.index)) {
+                                        ++found;
+                                    } else if (nb.dist == kth) {
+                                        ++tied;
+                                    }
+                                }
+                                found += std::min(tied, exactCount - nearer.size());
+                            }
+                        }
+                        const std::vector<int>* neighborPool = usePool ? &pool : nullptr;
+                        ClassificationResult res =
+                            algo == "RIONAlsh"
+                                ? ClassifyRIONA(ds, distCfg, baseStats, trainingIdx, (int)i, kEff, neighborPool,
+                                                ruleCache, budget)
+                                : ClassifyKPlusNN(ds, distCfg, baseStats, trainingIdx, (int)i, kEff, nLocal,
+                                                  neighborPool, budget);
+                        res.lsh.queries = 1;
+                        res.lsh.candidateSum = pool.size();
+                        res.lsh.fallbacks = !usePool;
+                        res.lsh.checked = check;
+                        res.lsh.exactNeighbors = exactCount;
+                        res.lsh.foundNeighbors = found;
+                        return res;
+                    }
 
-                    ClassificationResult res;
                     if (algo == "RIONA") {
-                        res = ClassifyRIONA(ds, distCfg, baseStats, trainingIdx, (int)i, kEff);
+                        return ClassifyRIONA(ds, distCfg, baseStats, trainingIdx, (int)i, kEff, nullptr, ruleCache,
+                                             budget, neighborCache);
                     } else if (algo == "RIA") {
-                        res = ClassifyRIA(ds, distCfg, baseStats, trainingIdx, (int)i, kEff);
-                    } else { // KNN => k+NN
-                        int nLocal = (cfg.nForKPlusNN < 0) ? (int)trainingIdx.size() : cfg.nForKPlusNN;
-                        if (nLocal < kEff) {
-                            nLocal = kEff;
+                        return ClassifyRIA(ds, distCfg, baseStats, trainingIdx, (int)i, kEff, RiaVerifyLimits(),
+                                           ruleCache, budget);
+                    } else if (algo == "RIAapprox") {
+                        ClassificationResult res =
+                            ClassifyRIA(ds, distCfg, baseStats, trainingIdx, (int)i, kEff, riaLimits, nullptr, budget);
+                        // Held-out objects are also classified exactly to measure the disagreement.
+                        if ((double)(Mix64(cfg.seed ^ Mix64(i)) >> 11) * 0x1.0p-53 < cfg.riaHoldout) {
+                            ClassificationResult exact = ClassifyRIA(ds, distCfg, baseStats, trainingIdx, (int)i, kEff);
+                            const std::string& truth = ds.rows[i].decision;
+                            res.ria.heldOut = 1;
+                            res.ria.disagreeStd = (res.predictedStandard != exact.predictedStandard);
+                            res.ria.disagreeNorm = (res.predictedNormalized != exact.predictedNormalized);
+                            res.ria.exactCorrectStd = (exact.predictedStandard == truth);
+                            res.ria.approxCorrectStd = (res.predictedStandard == truth);
+                            res.ria.exactCorrectNorm = (exact.predictedNormalized == truth);
+                            res.ria.approxCorrectNorm = (res.predictedNormalized == truth);
+                        }
+                        return res;
+                    }
+                    return ClassifyKPlusNN(ds, distCfg, baseStats, trainingIdx, (int)i, kEff, nLocal, nullptr, budget,
+                                           neighborCache);
+                };
+
+                // Local stats: the worker's incremental stats of all rows, with the
+                // test object taken out for its classification.
+                auto classifyRow = [&](size_t i, int slot) {
+                    if (mode == "g") {
+                        return classifyWith(i, globalStats);
+                    }
+                    if (!incrementalLocal) {
+                        std::vector<int> trainingIdx;
+                        trainingIdx.reserve(ds.rows.size() - 1);
+                        for (size_t j = 0; j < ds.rows.size(); ++j) {
+                            if (j != i) {
+                                trainingIdx.push_back(static_cast<int>(j));
+                            }
                         }
-                        res = ClassifyKPlusNN(ds, distCfg, baseStats, trainingIdx, (int)i, kEff, nLocal);
+                        Stats local;
+                        {
+                            TraceSpan span("stats local");
+                            local = ComputeStats(ds, trainingIdx, distCfg);
+                        }
+                        return classifyWith(i, local);
+                    }
+                    IncrementalStats& local = localStats[slot];
+                    {
+                        TraceSpan span("stats local");
+                        local.Remove(ds, (int)i);
                     }
+                    ClassificationResult res = classifyWith(i, local.Get());
+                    local.Add(ds, (int)i);
+                    return res;
+                };
 
-                    predStd[i] = res.predictedStandard;
-                    predNorm[i] = res.predictedNormalized;
-                    knnLists[i] = std::move(res.knnList);
+                // Everything the committed rows add to the reports, for the checkpoint.
+                auto keepCommitted = [&]() {
+                    ckpt.partial = partialCount;
+                    ckpt.confStd = confStd;
+                    ckpt.confNorm = confNorm;
+                    ckpt.latency = latency;
+                    ckpt.slowest = slowest;
+                    ckpt.ria = riaReport;
+                    ckpt.lsh = lshReport;
+                    ckpt.cacheHits = cacheHits;
+                    ckpt.cacheMisses = cacheMisses;
+                };
 
+                // Called in row order (under the reorder buffer's lock).
+                auto commitRow = [&](size_t pos, ClassificationResult& res) {
+                    const size_t i = rowAt(pos);
                     int trueIdx = ds.decisionIndex.at(ds.rows[i].decision);
-                    int predStdIdx = ds.decisionIndex.at(predStd[i]);
-                    int predNormIdx = ds.decisionIndex.at(predNorm[i]);
+                    int predStdIdx = ds.decisionIndex.at(res.predictedStandard);
+                    int predNormIdx = ds.decisionIndex.at(res.predictedNormalized);
                     confStd[trueIdx][predStdIdx] += 1;
                     confNorm[trueIdx][predNormIdx] += 1;
+
+                    latency.Record(res.latencyNs);
+                    partialCount += res.partial;
+                    AddCounters(riaReport, res.ria);
+                    AddCounters(lshReport, res.lsh);
+                    cacheHits += res.cacheLookup == 1;
+                    cacheMisses += res.cacheLookup == 0;
+                    if (cfg.slowCount > 0) {
+                        SlowObject slow;
+                        slow.row = i;
+                        slow.latencyNs = res.latencyNs;
+                        slow.neighbors = res.knnList.size();
+                        slow.ruleChecks = res.ruleChecks;
+                        slow.consistencyChecks = res.consistencyChecks;
+                        if (slowest.size() < (size_t)cfg.slowCount) {
+                            slowest.push_back(slow);
+                            std::push_heap(slowest.begin(), slowest.end(), slowerFirst);
+                        } else if (slow.latencyNs > slowest.front().latencyNs) {
+                            std::pop_heap(slowest.begin(), slowest.end(), slowerFirst);
+                            slowest.back() = slow;
+                            std::push_heap(slowest.begin(), slowest.end(), slowerFirst);
+                        }
+                    }
+
+                    if (cfg.stream) {
+                        writer.Write(ds, i, res, cfg.missingToken);
+                    } else {
+                        const size_t slot = pos - rowBegin;
+                        predStd[slot] = std::move(res.predictedStandard);
+                        predNorm[slot] = std::move(res.predictedNormalized);
+                        knnLists[slot] = std::move(res.knnList);
+                    }
+
+                    if (checkpointing && pos + 1 < rowEnd) {
+                        auto now = std::chrono::high_resolution_clock::now();
+                        if (std::chrono::duration<double, std::milli>(now - tLastCheckpoint).count() >= checkpointMs) {
+                            ckpt.done = pos + 1;
+                            ckpt.timeClassifyMs = priorClassifyMs +
+                                std::chrono::duration<double, std::milli>(now - tClassifyStart).count();
+                            keepCommitted();
+                            if (cfg.stream) {
+                                writer.Flush(ckpt.outBytes, ckpt.knnBytes);
+                            }
+                            if (!SaveCheckpoint(ckptFile, ds, ckpt, predStd, predNorm, knnLists, err)) {
+                                std::cerr << err << "\n";
+                            }
+                            tLastCheckpoint = now;
+                        }
+                    }
+                };
+
+                // Workers take rows in increasing order; the reorder buffer commits
+                // them in order and keeps at most a few rows per thread in flight.
+                const int threads = acquireWorkers();
+                ReorderBuffer reorder(ckpt.done, 4 * (size_t)threads, commitRow);
+                std::atomic<size_t> nextRow(ckpt.done);
+                auto worker = [&](int slot) {
+                    TraceUseExperiment(traceExperiment);
+                    for (;;) {
+                        size_t pos = nextRow.fetch_add(1);
+                        if (pos >= rowEnd) {
+                            break;
+                        }
+                        reorder.WaitForTurn(pos);
+                        ClassificationResult res;
+                        {
+                            TraceSpan span("classify", (int)rowAt(pos));
+                            auto tRow = std::chrono::high_resolution_clock::now();
+                            res = classifyRow(rowAt(pos), slot);
+                            res.latencyNs = (uint64_t)std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::high_resolution_clock::now() - tRow).count();
+                        }
+                        reorder.Push(pos, std::move(res));
+                    }
+                };
+                if (threads == 1) {
+                    worker(0);
+                } else {
+                    std::vector<std::thread> pool;
+                    for (int t = 0; t < threads; ++t) {
+                        pool.emplace_back(worker, t);
+                    }
+                    for (auto& th : pool) {
+                        th.join();
+                    }
                 }
+                releaseWorkers(threads);
 
                 auto tClassifyEnd = std::chrono::high_resolution_clock::now();
                 auto tWriteStart = tClassifyEnd;
 
-                // Build output filenames
-                std::string inputBase = cfg.inputFile;
-                size_t slash = inputBase.find_last_of("/\\");
-                if (slash != std::string::npos) {
-                    inputBase = inputBase.substr(slash + 1);
+                TraceSpan writeSpan("write");
+                if (cfg.stream) {
+                    if (!writer.Close(err)) {
+                        std::cerr << err << "\n";
+                        return 1;
+                    }
+                } else {
+                    const std::vector<size_t>* rows = looRows.empty() ? nullptr : &looRows;
+                    WriteOutFile(outFile, ds, predStd, predNorm, cfg.missingToken, rowBegin, rows);
+                    if (binaryKnn) {
+                        if (!WriteKnnBinaryFile(knnFile, knnLists, rowBegin, cfg.knnFormat == "bin32", err)) {
+                            std::cerr << err << "\n";
+                            return 1;
+                        }
+                    } else {
+                        WriteKnnFile(knnFile, knnLists, rowBegin, rows);
+                    }
                 }
-                size_t dot = inputBase.find_last_of('.');
-                if (dot != std::string::npos) {
-                    inputBase = inputBase.substr(0, dot);
+                if (cfg.slowCount > 0) {
+                    std::sort_heap(slowest.begin(), slowest.end(), slowerFirst);
+                    std::string slowFile = (expDir / ("SLOW_" + suffix.str() + ".csv")).string();
+                    if (cfg.shardCount > 1) {
+                        slowFile = ShardPath(slowFile, cfg.shardIndex, cfg.shardCount);
+                    }
+                    WriteSlowFile(slowFile, ds, slowest);
                 }
 
-                std::string svdmLabel = distCfg.svdmPrime ? "SVDMprime" : "SVDM";
-                int D = static_cast<int>(ds.types.size());
-                int R = static_cast<int>(ds.rows.size());
+                auto tWriteEnd = std::chrono::high_resolution_clock::now();
+                double timeReadMs = std::chrono::duration<double, std::milli>(tReadEnd - tReadStart).count();
+                double timePrepMs = std::chrono::duration<double, std::milli>(tPrepEnd - tPrepStart).count();
+                double timeClassifyMs = priorClassifyMs +
+                    std::chrono::duration<double, std::milli>(tClassifyEnd - tClassifyStart).count();
+                double timeWriteMs = std::chrono::duration<double, std::milli>(tWriteEnd - tWriteStart).count();
+                double timeTotalMs = timeReadMs + timePrepMs + timeClassifyMs + timeWriteMs;
 
-                std::stringstream suffix;
-                suffix << algo << "_" << inputBase
-                       << "_D" << D
-                       << "_R" << R
-                       << "_k" << kEff
-                       << "_" << svdmLabel
-                       << "_" << mode;
+                if (cfg.shardCount > 1) {
+                    ShardSummary shard;
+                    shard.index = cfg.shardIndex;
+                    shard.count = cfg.shardCount;
+                    shard.begin = rowBegin;
+                    shard.end = rowEnd;
+                    shard.timeReadMs = timeReadMs;
+                    shard.timePrepMs = timePrepMs;
+                    shard.timeClassifyMs = timeClassifyMs;
+                    shard.timeWriteMs = timeWriteMs;
+                    shard.timeTotalMs = timeTotalMs;
+                    shard.confStd = confStd;
+                    shard.confNorm = confNorm;
+                    shard.latency = latency;
+                    shard.slowest = slowest;
+                    shard.partial = partialCount;
+                    WriteShardFile(ShardPath(statFile, cfg.shardIndex, cfg.shardCount), shard);
+                } else {
+                    WriteStatFile(statFile,
+                                  ds,
+                                  globalStats,
+                                  cfg.inputFile,
+                                  algo,
+                                  mode,
+                                  svdmLabel,
+                                  kEff,
+                                  timeReadMs,
+                                  timePrepMs,
+                                  timeClassifyMs,
+                                  timeWriteMs,
+                                  timeTotalMs,
+                                  confStd,
+                                  confNorm);
+                    AppendLatency(statFile, latency);
+                    if (cfg.dedup) {
+                        AppendDedupReport(statFile, ds);
+                    }
+                    if (!looRows.empty()) {
+                        AppendLooSampleReport(statFile, ds, looReport, confStd, confNorm);
+                    }
+                    if (budget.Active()) {
+                        AppendBudgetReport(statFile, cfg, partialCount, rowEnd - rowBegin);
+                    }
+                    if (neighborCache) {
+                        AppendNeighborCacheReport(statFile, neighborCache->Depth(), cacheHits, cacheMisses);
+                    }
+                    if (algo == "RIAapprox") {
+                        AppendRiaApproxReport(statFile, riaReport);
+                    }
+                    if (algo == "RIONAlsh" || algo == "KNNlsh") {
+                        AppendLshReport(statFile, lshReport);
+                    }
+                    recordSummary(algo, mode, kEff, timeReadMs, timePrepMs, timeClassifyMs,
+                                  timeWriteMs, timeTotalMs, confStd, confNorm);
+                }
+                if (neighborCache && !neighborCache->Save(err)) {
+                    std::cerr << err << "\n";
+                }
 
-                std::string baseFolderName = SanitizePathPart(inputBase);
-                std::filesystem::path baseDir = std::filesystem::path(cfg.outDir) / baseFolderName;
-                std::filesystem::create_directories(baseDir);
+                if (checkpointing) {
+                    ckpt.done = rowEnd;
+                    ckpt.complete = true;
+                    ckpt.timeClassifyMs = timeClassifyMs;
+                    ckpt.timeReadMs = timeReadMs;
+                    ckpt.timePrepMs = timePrepMs;
+                    ckpt.timeWriteMs = timeWriteMs;
+                    keepCommitted();
+                    if (!SaveCheckpoint(ckptFile, ds, ckpt, predStd, predNorm, knnLists, err)) {
+                        std::cerr << err << "\n";
+                    }
+                }
+            }
+        }
+    }
+    return 0;
+}
 
-                std::string expFolderName = "EXP_" + SanitizePathPart(suffix.str());
-                std::filesystem::path expDir = baseDir / expFolderName;
-                std::filesystem::create_directories(expDir);
+// Splits a manifest line into arguments; double quotes group words.
+static std::vector<std::string> SplitManifestLine(const std::string& line) {
+    std::vector<std::string> tokens;
+    std::string cur;
+    bool quoted = false;
+    bool any = false;
+    for (char ch : line) {
+        if (ch == '"') {
+            quoted = !quoted;
+            any = true;
+        } else if (!quoted && (ch == ' ' || ch == '\t')) {
+            if (any) {
+                tokens.push_back(cur);
+                cur.clear();
+                any = false;
+            }
+        } else {
+            cur += ch;
+            any = true;
+        }
+    }
+    if (any) {
+        tokens.push_back(cur);
+    }
+    return tokens;
+}
 
-                std::string outFile = (expDir / ("OUT_" + suffix.str() + ".csv")).string();
-                std::string statFile = (expDir / ("STAT_" + suffix.str() + ".txt")).string();
-                std::string knnFile = (expDir / ("kNN_" + suffix.str() + ".csv")).string();
+// `riona batch <manifest.txt> [options]`: every manifest line holds the options
+// of one job (a bare path is taken as --input); command-line options are the
+// defaults. Jobs run side by side on a shared pool of --threads workers,
+// largest input first so that small jobs fill the gaps at the end; a job
+// borrows idle workers for its parallel phases (see RunExperiments), so the
+// last large jobs get the cores the others leave. The aggregated tables are
+// written once all jobs are done.
+static int RunBatch(const std::vector<std::string>& args) {
+    if (args.size() < 3) {
+        std::cerr << "Usage: riona.exe batch <manifest.txt> [options]\n";
+        return 1;
+    }
+    Config base;
+    int parsed = ParseArgs(args, 3, base);
+    if (parsed >= 0) {
+        return parsed;
+    }
+    if (!base.traceFile.empty()) {
+        TraceEnable();
+    }
 
-                WriteOutFile(outFile, ds, predStd, predNorm, cfg.missingToken);
-                WriteKnnFile(knnFile, knnLists);
+    std::ifstream manifest(args[2]);
+    if (!manifest) {
+        std::cerr << "Cannot open manifest: " << args[2] << "\n";
+        return 1;
+    }
+    std::vector<Config> jobs;
+    std::string line;
+    for (int lineNo = 1; std::getline(manifest, line); ++lineNo) {
+        line = Trim(line);
+        if (line.empty() || line[0] == '#') {
+            continue;
+        }
+        std::vector<std::string> tokens = SplitManifestLine(line);
+        if (!tokens.empty() && tokens[0].rfind("--", 0) != 0) {
+            tokens.insert(tokens.begin(), "--input");
+        }
+        Config job = base;
+        if (ParseArgs(tokens, 0, job) >= 0 || job.inputFile.empty() || job.shardCount != 1) {
+            std::cerr << "Invalid manifest line " << lineNo << ": " << line << "\n";
+            return 1;
+        }
+        jobs.push_back(job);
+    }
 
-                auto tWriteEnd = std::chrono::high_resolution_clock::now();
-                double timeReadMs = std::chrono::duration<double, std::milli>(tReadEnd - tReadStart).count();
-                double timePrepMs = std::chrono::duration<double, std::milli>(tPrepEnd - tPrepStart).count();
-                double timeClassifyMs = std::chrono::duration<double, std::milli>(tClassifyEnd - tClassifyStart).count();
-                double timeWriteMs = std::chrono::duration<double, std::milli>(tWriteEnd - tWriteStart).count();
-                double timeTotalMs = timeReadMs + timePrepMs + timeClassifyMs + timeWriteMs;
+    // Leave-one-out cost grows with the square of the dataset size.
+    std::vector<double> cost(jobs.size(), 0.0);
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        std::error_code ec;
+        double bytes = static_cast<double>(std::filesystem::file_size(jobs[j].inputFile, ec));
+        cost[j] = ec ? 0.0 : bytes * bytes;
+    }
+    std::vector<size_t> order(jobs.size());
+    for (size_t j = 0; j < order.size(); ++j) {
+        order[j] = j;
+    }
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return cost[a] > cost[b]; });
 
-                WriteStatFile(statFile,
-                              ds,
-                              globalStats,
-                              cfg.inputFile,
-                              algo,
-                              mode,
-                              svdmLabel,
-                              kEff,
-                              timeReadMs,
-                              timePrepMs,
-                              timeClassifyMs,
-                              timeWriteMs,
-                              timeTotalMs,
-                              confStd,
-                              confNorm);
+    std::vector<std::vector<ExperimentSummary>> results(jobs.size());
+    std::vector<int> codes(jobs.size(), 0);
+    std::atomic<size_t> next(0);
+    std::atomic<size_t> finished(0);
+    std::mutex printMutex;
+    const int threads = std::max(1, std::min(base.threads, (int)jobs.size()));
+    WorkerSlots shared(std::max(1, base.threads) - threads);
+    auto worker = [&]() {
+        for (;;) {
+            size_t slot = next.fetch_add(1);
+            if (slot >= order.size()) {
+                // Out of jobs: this worker becomes an idle slot for the rest.
+                shared.Release(1);
+                break;
             }
+            const size_t j = order[slot];
+            auto tStart = std::chrono::high_resolution_clock::now();
+            codes[j] = RunExperiments(jobs[j], &results[j], &shared);
+            double ms = std::chrono::duration<double, std::milli>(
+                std::chrono::high_resolution_clock::now() - tStart).count();
+            std::lock_guard<std::mutex> lock(printMutex);
+            std::cout << "[" << ++finished << "/" << jobs.size() << "] " << jobs[j].inputFile
+                      << (codes[j] == 0 ? " done in " : " FAILED after ") << ms << " ms\n";
+        }
+    };
+    if (threads == 1) {
+        worker();
+    } else {
+        std::vector<std::thread> pool;
+        for (int t = 0; t < threads; ++t) {
+            pool.emplace_back(worker);
+        }
+        for (auto& th : pool) {
+            th.join();
         }
     }
 
-    std::cout << "Done.\n";
+    std::vector<ExperimentSummary> summaries;
+    int rc = 0;
+    for (size_t j = 0; j < jobs.size(); ++j) {
+        rc = std::max(rc, codes[j]);
+        for (auto& s : results[j]) {
+            summaries.push_back(std::move(s));
+        }
+    }
+
+    std::string err;
+    std::string aggregateDir = base.aggregateDir.empty()
+        ? (std::filesystem::path(base.outDir) / "_aggregated").string()
+        : base.aggregateDir;
+    if (!WriteAggregatedReport(aggregateDir, std::move(summaries), err)) {
+        std::cerr << err << "\n";
+        return 1;
+    }
+    std::cout << "Aggregated tables: " << aggregateDir << "\n";
+    if (!base.traceFile.empty() && !WriteTrace(base.traceFile, err)) {
+        std::cerr << err << "\n";
+        return 1;
+    }
+    return rc;
+}
+
+// `riona serve --input <train.arff> [options]`: answers RIONA queries from
+// standard input until it ends. A query line holds the conditional attribute
+// values of one object (a trailing decision is ignored) and gets one line
+// back: <standard>,<normalized>,<model version>. `!reload [<file.arff>]`
+// builds a new model (default: from the last file) on a background thread;
+// queries keep using the current model and switch once it is published.
+// `!insert <row>` (attributes and decision) and `!erase <id>` edit the
+// training set in place through a Model and publish the result; `!check`
+// compares its stats with a full ComputeStats.
+static int RunServe(const std::vector<std::string>& args) {
+    Config cfg;
+    int parsed = ParseArgs(args, 2, cfg);
+    if (parsed >= 0) {
+        return parsed;
+    }
+    if (cfg.inputFile.empty()) {
+        std::cerr << "Usage: riona.exe serve --input <train.arff> [options]\n";
+        return 1;
+    }
+    if (cfg.algo != "all" && cfg.algo != "riona") {
+        std::cerr << "serve classifies with RIONA only.\n";
+        return 1;
+    }
+    DistanceConfig distCfg;
+    std::string err;
+    if (!MakeDistanceConfig(cfg, distCfg, err)) {
+        std::cerr << err << "\n";
+        return 1;
+    }
+    const int kSpec = cfg.kValues.empty() ? -1 : cfg.kValues.front();
+    const QueryBudget budget = MakeQueryBudget(cfg);
+
+    auto neighborhood = [kSpec](size_t n) {
+        return kSpec == -1 ? std::max(1, (int)std::floor(std::log2(std::max<size_t>(1, n)))) : std::max(1, kSpec);
+    };
+    auto build = [&cfg, distCfg, neighborhood](const std::string& path, ModelSnapshot& snap, std::string& buildErr) {
+        ArffReader reader;
+        if (!reader.Read(path, cfg, snap.ds, buildErr)) {
+            return false;
+        }
+        if (snap.ds.rows.empty()) {
+            buildErr = "Training set " + path + " has no objects.";
+            return false;
+        }
+        if (!PrepareDataset(cfg, snap.ds, buildErr)) {
+            return false;
+        }
+        snap.cfg = distCfg;
+        snap.rows.resize(snap.ds.rows.size());
+        for (size_t i = 0; i < snap.rows.size(); ++i) {
+            snap.rows[i] = static_cast<int>(i);
+        }
+        snap.stats = ComputeStats(snap.ds, snap.rows, snap.cfg);
+        snap.codes.assign(snap.ds.types.size(), {});
+        for (size_t a = 0; a < snap.ds.nominalValues.size(); ++a) {
+            for (size_t code = 0; code < snap.ds.nominalValues[a].size(); ++code) {
+                snap.codes[a][snap.ds.nominalValues[a][code]] = (int)code;
+            }
+        }
+        if (cfg.lshTables > 0) {
+            auto index = std::make_shared<LshIndex>();
+            index->Build(snap.ds, snap.stats, snap.cfg, cfg.lshTables, cfg.lshHashes, cfg.lshWidth, cfg.seed);
+            snap.lsh = std::move(index);
+        }
+        snap.k = neighborhood(snap.rows.size());
+        snap.source = path;
+        return true;
+    };
+
+    SnapshotStore store;
+    {
+        auto first = std::make_shared<ModelSnapshot>();
+        if (!build(cfg.inputFile, *first, err)) {
+            std::cerr << err << "\n";
+            return 1;
+        }
+        store.PublishNext(std::move(first));
+    }
+    auto current = store.Current();
+    std::cerr << "Model v1 loaded from " << current->source << " (" << current->rows.size() << " objects, k="
+              << current->k << ")\n";
+    current.reset();
+
+    SnapshotReloader reloader(store, build, [&store](const std::string& path, const std::string& buildErr) {
+        auto snap = store.Current();
+        if (buildErr.empty()) {
+            std::cerr << "Model v" << snap->version << " loaded from " << path << " (" << snap->rows.size()
+                      << " objects, k=" << snap->k << ")\n";
+        } else {
+            std::cerr << "Reload failed, keeping model v" << snap->version << ": " << buildErr << "\n";
+        }
+    });
+
+    // Edits go to a Model copied from the current snapshot (again after a
+    // reload) and each one publishes a new snapshot, so queries never see a
+    // half-applied edit. An edit racing a reload is dropped.
+    Model model;
+    uint64_t modelVersion = 0;
+    auto editModel = [&](const ModelSnapshot& snap, std::string& editErr) {
+        if (modelVersion == snap.version) {
+            return true;
+        }
+        modelVersion = 0;
+        if (!model.Init(snap.ds, snap.cfg, editErr)) {
+            return false;
+        }
+        std::vector<char> kept(snap.ds.rows.size(), 0);
+        for (int r : snap.rows) {
+            kept[r] = 1;
+        }
+        for (size_t r = 0; r < kept.size(); ++r) {
+            if (!kept[r] && !model.Erase((int)r, editErr)) {
+                return false;
+            }
+        }
+        if (cfg.lshTables > 0) {
+            model.EnableLsh(cfg.lshTables, cfg.lshHashes, cfg.lshWidth, cfg.seed);
+        }
+        modelVersion = snap.version;
+        return true;
+    };
+    auto publishModel = [&](const ModelSnapshot& base, std::string& editErr) {
+        auto next = std::make_shared<ModelSnapshot>();
+        next->ds = model.Data();
+        next->cfg = model.Distance();
+        next->stats = model.CurrentStats();
+        next->rows = model.LiveRows();
+        next->codes = model.Codes();
+        if (model.Index()) {
+            next->lsh = std::make_shared<LshIndex>(*model.Index());
+        }
+        next->k = neighborhood(next->rows.size());
+        next->source = base.source;
+        if (!store.PublishNext(next, base.version)) {
+            modelVersion = 0;
+            editErr = "The model was reloaded meanwhile; the edit was not applied.";
+            return false;
+        }
+        modelVersion = next->version;
+        return true;
+    };
+
+    std::string line;
+    std::string lastPath = cfg.inputFile;
+    while (std::getline(std::cin, line)) {
+        line = Trim(line);
+        if (line.empty() || IsCommentLine(line)) {
+            continue;
+        }
+        if (line.compare(0, 7, "!reload") == 0) {
+            const std::string path = Trim(line.substr(7));
+            if (!path.empty()) {
+                lastPath = path;
+            }
+            reloader.Request(lastPath);
+            continue;
+        }
+        if (line.compare(0, 7, "!insert") == 0) {
+            const auto snap = store.Current();
+            Instance inst;
+            int row = -1;
+            if (!editModel(*snap, err) || !SplitTrainingRow(snap->ds, Trim(line.substr(7)), cfg.missingToken, inst, err) ||
+                !model.Insert(std::move(inst), row, err) || !publishModel(*snap, err)) {
+                std::cout << "error: " << err << std::endl;
+                continue;
+            }
+            std::cout << "inserted," << row + 1 << "," << modelVersion << std::endl;
+            continue;
+        }
+        if (line.compare(0, 6, "!erase") == 0) {
+            const auto snap = store.Current();
+            size_t id = 0;
+            if (!ParseCount(Trim(line.substr(6)), id) || id == 0) {
+                std::cout << "error: !erase needs an object id." << std::endl;
+                continue;
+            }
+            if (!editModel(*snap, err) || !model.Erase((int)id - 1, err) || !publishModel(*snap, err)) {
+                std::cout << "error: " << err << std::endl;
+                continue;
+            }
+            std::cout << "erased," << id << "," << modelVersion << std::endl;
+            continue;
+        }
+        if (line == "!check") {
+            const auto snap = store.Current();
+            if (!editModel(*snap, err) || !model.CheckStats(err)) {
+                std::cout << "error: " << err << std::endl;
+                continue;
+            }
+            std::cout << "checked," << model.LiveRows().size() << "," << snap->version << std::endl;
+            continue;
+        }
+        // One snapshot for the whole query, even if a reload lands meanwhile.
+        const auto snap = store.Current();
+        Instance query;
+        if (!EncodeQuery(*snap, line, cfg.missingToken, query, err)) {
+            std::cout << "error: " << err << std::endl;
+            continue;
+        }
+        // --lsh: search the query's candidates unless there are too few of them.
+        std::vector<int> pool;
+        if (snap->lsh) {
+            pool = snap->lsh->Candidates(snap->ds, query, cfg.lshProbes);
+        }
+        const bool usePool = snap->lsh && pool.size() >= (size_t)snap->k;
+        ClassificationResult res =
+            ClassifyRIONA(snap->ds, snap->cfg, snap->stats, usePool ? pool : snap->rows, query, snap->k, budget);
+        std::cout << res.predictedStandard << "," << res.predictedNormalized << "," << snap->version
+                  << (res.partial ? ",partial" : "") << std::endl;
+    }
     return 0;
 }
+
+int main(int argc, char** argv) {
+    Config cfg;
+
+    if (argc > 1 && std::string(argv[1]) == "export-knn") {
+        return ExportKnn(argc, argv);
+    }
+
+    // Simple CLI parsing
+    std::vector<std::string> args(argv, argv + argc);
+    if (argc > 1 && args[1] == "batch") {
+        return RunBatch(args);
+    }
+    if (argc > 1 && args[1] == "serve") {
+        return RunServe(args);
+    }
+    size_t firstArg = 1;
+    if (argc > 1 && args[1] == "merge") {
+        cfg.mergeShards = true;
+        firstArg = 2;
+    }
+    int parsed = ParseArgs(args, firstArg, cfg);
+    if (parsed >= 0) {
+        return parsed;
+    }
+
+    if (cfg.inputFile.empty()) {
+        PrintUsage();
+        return 1;
+    }
+    if (cfg.shardCount < 1 || cfg.shardIndex < 0 || cfg.shardIndex >= cfg.shardCount) {
+        std::cerr << "Invalid shard: " << cfg.shardIndex << "/" << cfg.shardCount << "\n";
+        return 1;
+    }
+
+    if (!cfg.traceFile.empty()) {
+        TraceEnable();
+    }
+
+    int rc = RunExperiments(cfg, nullptr);
+    if (rc != 0) {
+        return rc;
+    }
+
+    std::string err;
+    if (!cfg.traceFile.empty() && !WriteTrace(cfg.traceFile, err)) {
+        std::cerr << err << "\n";
+        return 1;
+    }
+
+    std::cout << "Done.\n";
+    return 0;
+}
\ No newline at end of file
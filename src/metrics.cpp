@@ -1,5 +1,11 @@
 #include "metrics.h"
 
+#include "util.h"
+
+#include <algorithm>
+#include <cmath>
+#include <random>
+
 std::vector<std::vector<int>> InitMatrix(size_t d) {
     return std::vector<std::vector<int>>(d, std::vector<int>(d, 0));
 }
@@ -41,4 +47,66 @@ MetricsPerClass ComputeBalanced(const std::vector<MetricsPerClass>& perClass) {
     bal.recall /= d;
     bal.f1 /= d;
     return bal;
+}
+
+std::pair<double, double> WilsonInterval(int successes, int trials, double z) {
+    if (trials <= 0) {
+        return {0.0, 1.0};
+    }
+    const double n = (double)trials;
+    const double p = (double)successes / n;
+    const double z2 = z * z;
+    const double center = (p + z2 / (2.0 * n)) / (1.0 + z2 / n);
+    const double half = z * std::sqrt(p * (1.0 - p) / n + z2 / (4.0 * n * n)) / (1.0 + z2 / n);
+    return {std::max(0.0, center - half), std::min(1.0, center + half)};
+}
+
+std::pair<MetricsPerClass, MetricsPerClass> BootstrapBalanced(const std::vector<std::vector<int>>& conf,
+                                                              int replicates,
+                                                              uint64_t seed) {
+    const size_t d = conf.size();
+    std::mt19937_64 rng(Mix64(seed));
+    std::vector<double> precision, recall, f1;
+    std::vector<std::vector<int>> draw = InitMatrix(d);
+    for (int b = 0; b < replicates; ++b) {
+        for (size_t r = 0; r < d; ++r) {
+            int size = 0;
+            for (int c : conf[r]) {
+                size += c;
+            }
+            std::fill(draw[r].begin(), draw[r].end(), 0);
+            if (size == 0) {
+                continue;
+            }
+            std::uniform_int_distribution<int> pick(0, size - 1);
+            for (int i = 0; i < size; ++i) {
+                int x = pick(rng);
+                size_t c = 0;
+                while (x >= conf[r][c]) {
+                    x -= conf[r][c++];
+                }
+                ++draw[r][c];
+            }
+        }
+        const MetricsPerClass bal = ComputeBalanced(ComputeMetrics(draw));
+        precision.push_back(bal.precision);
+        recall.push_back(bal.recall);
+        f1.push_back(bal.f1);
+    }
+
+    std::pair<MetricsPerClass, MetricsPerClass> interval;
+    if (replicates <= 0) {
+        return interval;
+    }
+    const size_t lo = (size_t)std::floor(0.025 * (replicates - 1));
+    const size_t hi = (size_t)std::ceil(0.975 * (replicates - 1));
+    auto bounds = [&](std::vector<double>& v, double& low, double& high) {
+        std::sort(v.begin(), v.end());
+        low = v[lo];
+        high = v[hi];
+    };
+    bounds(precision, interval.first.precision, interval.second.precision);
+    bounds(recall, interval.first.recall, interval.second.recall);
+    bounds(f1, interval.first.f1, interval.second.f1);
+    return interval;
 }
\ No newline at end of file
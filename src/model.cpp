@@ -0,0 +1,402 @@
+#include "model.h"
+
+#include "distance.h"
+#include "distance_kernel.h"
+
+#include <algorithm>
+#include <cmath>
+#include <utility>
+
+void IncrementalStats::Init(const Dataset& ds, const std::vector<int>& indices, const DistanceConfig& distCfg) {
+    const size_t m = ds.types.size();
+    cfg = distCfg;
+    classes = ds.decisionValues.size();
+    numValues.assign(m, {});
+    counts.assign(m, {});
+    totals.assign(m, {});
+    valueCodes.assign(m, {});
+    stats = Stats();
+    stats.numStats.resize(m);
+    stats.nomStats.resize(m);
+    for (size_t a = 0; a < m; ++a) {
+        if (ds.types[a] == AttrType::Nominal) {
+            stats.nomStats[a].codeIndex.assign(ds.nominalValues[a].size(), -1);
+            stats.nomStats[a].onDemand = ds.nominalValues[a].size() > cfg.denseValues;
+            stats.nomStats[a].classes = classes;
+        }
+    }
+
+    // Counts first, then each SVDM matrix once.
+    for (int idx : indices) {
+        const auto& inst = ds.rows[idx];
+        const int cls = ds.decisionIndex.at(inst.decision);
+        for (size_t a = 0; a < m; ++a) {
+            const auto& v = inst.attrs[a];
+            if (v.missing) {
+                continue;
+            }
+            if (ds.types[a] == AttrType::Numeric) {
+                numValues[a][v.num] += 1;
+            } else if (v.code >= 0) {
+                if ((size_t)v.code >= totals[a].size()) {
+                    counts[a].resize(v.code + 1, std::vector<int>(classes, 0));
+                    totals[a].resize(v.code + 1, 0);
+                }
+                counts[a][v.code][cls] += 1;
+                totals[a][v.code] += 1;
+            }
+        }
+    }
+    for (size_t a = 0; a < m; ++a) {
+        if (ds.types[a] == AttrType::Numeric) {
+            RefreshNumeric(a);
+            continue;
+        }
+        for (size_t code = 0; code < totals[a].size(); ++code) {
+            if (totals[a][code] > 0) {
+                AddValue(ds, a, (int)code);
+            }
+        }
+    }
+    if (ds.precision != Precision::F64) {
+        stats.compact = BuildCompactMetric(ds, stats, cfg);
+    }
+    stats.kernel = BuildDistanceKernel(ds, stats, cfg);
+}
+
+void IncrementalStats::Add(const Dataset& ds, int row) {
+    Update(ds, row, 1);
+}
+
+void IncrementalStats::Remove(const Dataset& ds, int row) {
+    Update(ds, row, -1);
+}
+
+void IncrementalStats::Update(const Dataset& ds, int row, int delta) {
+    const auto& inst = ds.rows[row];
+    const int cls = ds.decisionIndex.at(inst.decision);
+    if ((size_t)cls >= classes) {
+        // A new class adds a zero to every distribution: distances are unchanged.
+        classes = ds.decisionValues.size();
+        for (auto& attr : counts) {
+            for (auto& vec : attr) {
+                vec.resize(classes, 0);
+            }
+        }
+        // On-demand probability rows widen to the new class count.
+        bool onDemand = false;
+        for (auto& ns : stats.nomStats) {
+            if (!ns.onDemand) {
+                continue;
+            }
+            std::vector<double> prob(ns.values.size() * classes, 0.0);
+            for (size_t i = 0; i < ns.values.size(); ++i) {
+                std::copy_n(ns.prob.begin() + i * ns.classes, ns.classes, prob.begin() + i * classes);
+            }
+            ns.prob = std::move(prob);
+            ns.classes = classes;
+            onDemand = true;
+        }
+        if (onDemand) {
+            stats.kernel = BuildDistanceKernel(ds, stats, cfg);
+        }
+    }
+
+    for (size_t a = 0; a < ds.types.size(); ++a) {
+        const auto& v = inst.attrs[a];
+        if (v.missing) {
+            continue;
+        }
+        if (ds.types[a] == AttrType::Numeric) {
+            auto& values = numValues[a];
+            if (delta > 0) {
+                values[v.num] += 1;
+            } else {
+                auto it = values.find(v.num);
+                if (it != values.end() && --it->second == 0) {
+                    values.erase(it);
+                }
+            }
+            RefreshNumeric(a);
+            RefreshKernelAttribute(ds, stats, cfg, (int)a, -1);
+            RefreshCompactAttribute(ds, stats, cfg, (int)a, -1);
+            continue;
+        }
+        if (v.code < 0) {
+            continue;
+        }
+        if ((size_t)v.code >= totals[a].size()) {
+            counts[a].resize(v.code + 1, std::vector<int>(classes, 0));
+            totals[a].resize(v.code + 1, 0);
+        }
+        counts[a][v.code][cls] += delta;
+        totals[a][v.code] += delta;
+        if (delta > 0 && totals[a][v.code] == 1) {
+            AddValue(ds, a, v.code);
+        } else if (totals[a][v.code] == 0) {
+            DropValue(a, v.code);
+        } else {
+            RefreshSvdm(a, v.code);
+        }
+        RefreshKernelAttribute(ds, stats, cfg, (int)a, v.code);
+        RefreshCompactAttribute(ds, stats, cfg, (int)a, v.code);
+    }
+}
+
+void IncrementalStats::RefreshNumeric(size_t a) {
+    NumericStat& ns = stats.numStats[a];
+    const auto& values = numValues[a];
+    ns.hasValue = !values.empty();
+    if (!ns.hasValue) {
+        ns.min = ns.max = ns.range = 0.0;
+        return;
+    }
+    ns.min = values.begin()->first;
+    ns.max = values.rbegin()->first;
+    ns.range = ns.max - ns.min;
+}
+
+// Recomputes the SVDM row and column of one value, term by term as ComputeStats does.
+void IncrementalStats::RefreshSvdm(size_t a, int code) {
+    NominalStat& ns = stats.nomStats[a];
+    const int i = ns.codeIndex[code];
+    const auto& ci = counts[a][code];
+    const int totalI = totals[a][code];
+    if (ns.onDemand) {
+        for (size_t c = 0; c < classes; ++c) {
+            ns.prob[(size_t)i * classes + c] = (totalI == 0) ? 0.0 : (double)ci[c] / (double)totalI;
+        }
+        return;
+    }
+    for (size_t j = 0; j < ns.values.size(); ++j) {
+        if (cfg.metric == Metric::HEOM) {
+            ns.dist[i][j] = ns.dist[j][i] = ((int)j == i) ? 0.0 : 1.0;
+            continue;
+        }
+        const int codeJ = valueCodes[a][j];
+        const auto& cj = counts[a][codeJ];
+        const int totalJ = totals[a][codeJ];
+        double sum = 0.0;
+        for (size_t c = 0; c < classes; ++c) {
+            double pi = (totalI == 0) ? 0.0 : (double)ci[c] / (double)totalI;
+            double pj = (totalJ == 0) ? 0.0 : (double)cj[c] / (double)totalJ;
+            sum += std::abs(pi - pj);
+        }
+        if (cfg.svdmPrime) {
+            sum *= 0.5; // normalize to [0,1]
+        }
+        ns.dist[i][j] = ns.dist[j][i] = sum;
+    }
+}
+
+void IncrementalStats::AddValue(const Dataset& ds, size_t a, int code) {
+    NominalStat& ns = stats.nomStats[a];
+    const int i = static_cast<int>(ns.values.size());
+    ns.values.push_back(ds.nominalValues[a][code]);
+    ns.index[ns.values.back()] = i;
+    if ((size_t)code >= ns.codeIndex.size()) {
+        ns.codeIndex.resize(ds.nominalValues[a].size(), -1);
+    }
+    ns.codeIndex[code] = i;
+    valueCodes[a].push_back(code);
+    if (ns.onDemand) {
+        ns.prob.resize(ns.values.size() * classes, 0.0);
+    } else {
+        for (auto& r : ns.dist) {
+            r.push_back(0.0);
+        }
+        ns.dist.emplace_back(ns.values.size(), 0.0);
+    }
+    RefreshSvdm(a, code);
+}
+
+// A value no row has any more leaves the stats (distance => missingNominal),
+// as it would from ComputeStats; the last value moves into its slot.
+void IncrementalStats::DropValue(size_t a, int code) {
+    NominalStat& ns = stats.nomStats[a];
+    const int i = ns.codeIndex[code];
+    const int last = static_cast<int>(ns.values.size()) - 1;
+    ns.index.erase(ns.values[i]);
+    if (i != last) {
+        const int lastCode = valueCodes[a][last];
+        ns.values[i] = ns.values[last];
+        ns.index[ns.values[i]] = i;
+        ns.codeIndex[lastCode] = i;
+        valueCodes[a][i] = lastCode;
+        if (ns.onDemand) {
+            std::copy_n(ns.prob.begin() + (size_t)last * classes, classes, ns.prob.begin() + (size_t)i * classes);
+        } else {
+            std::swap(ns.dist[i], ns.dist[last]);
+            for (auto& r : ns.dist) {
+                std::swap(r[i], r[last]);
+            }
+        }
+    }
+    ns.values.pop_back();
+    valueCodes[a].pop_back();
+    ns.codeIndex[code] = -1;
+    if (ns.onDemand) {
+        ns.prob.resize(ns.values.size() * classes);
+        return;
+    }
+    ns.dist.pop_back();
+    for (auto& r : ns.dist) {
+        r.pop_back();
+    }
+}
+
+bool Model::Init(Dataset data, const DistanceConfig& distCfg, std::string& err) {
+    if (data.precision != Precision::F64) {
+        err = "Incremental model updates need --precision f64.";
+        return false;
+    }
+    if (distCfg.metric == Metric::IVDM) {
+        err = "Incremental model updates support the svdm and heom metrics.";
+        return false;
+    }
+    ds = std::move(data);
+    cfg = distCfg;
+    ds.prototypeOf.clear(); // prototypes are not maintained across updates
+    ds.prototypeCount = 0;
+    ds.zones = ZoneMaps(); // nor zone maps
+    if (ds.kernelRows != ds.rows.size()) {
+        BuildKernelColumns(ds);
+    }
+    live.assign(ds.rows.size(), 1);
+    codes.assign(ds.types.size(), {});
+    for (size_t a = 0; a < ds.nominalValues.size(); ++a) {
+        for (size_t code = 0; code < ds.nominalValues[a].size(); ++code) {
+            codes[a][ds.nominalValues[a][code]] = (int)code;
+        }
+    }
+    stats.Init(ds, LiveRows(), cfg);
+    lsh.reset();
+    return true;
+}
+
+void Model::EnableLsh(int tables, int hashes, double width, uint64_t seed) {
+    lsh = std::make_unique<LshIndex>();
+    lsh->Build(ds, stats.Get(), cfg, tables, hashes, width, seed);
+    for (size_t r = 0; r < live.size(); ++r) {
+        if (!live[r]) {
+            lsh->Erase(r);
+        }
+    }
+}
+
+bool Model::Insert(Instance inst, int& row, std::string& err) {
+    if (inst.attrs.size() != ds.types.size()) {
+        err = "Inserted row has " + std::to_string(inst.attrs.size()) + " attributes, expected " +
+              std::to_string(ds.types.size()) + ".";
+        return false;
+    }
+    for (size_t a = 0; a < ds.types.size(); ++a) {
+        auto& v = inst.attrs[a];
+        v.code = -1;
+        if (v.missing) {
+            continue;
+        }
+        if (ds.types[a] == AttrType::Numeric) {
+            try {
+                v.num = std::stod(v.raw);
+            } catch (...) {
+                v.missing = true;
+            }
+            continue;
+        }
+        auto it = codes[a].find(v.raw);
+        if (it == codes[a].end()) {
+            it = codes[a].emplace(v.raw, (int)ds.nominalValues[a].size()).first;
+            ds.nominalValues[a].push_back(v.raw);
+        }
+        v.code = it->second;
+    }
+    if (ds.decisionIndex.find(inst.decision) == ds.decisionIndex.end()) {
+        ds.decisionIndex[inst.decision] = static_cast<int>(ds.decisionValues.size());
+        ds.decisionValues.push_back(inst.decision);
+    }
+
+    row = static_cast<int>(ds.rows.size());
+    inst.id = row + 1;
+    ds.rows.push_back(std::move(inst));
+    AppendKernelRow(ds, (size_t)row);
+    live.push_back(1);
+    stats.Add(ds, row);
+    if (lsh) {
+        lsh->Insert(ds, row);
+    }
+    return true;
+}
+
+bool Model::Erase(int row, std::string& err) {
+    if (!IsLive(row)) {
+        err = "Object " + std::to_string(row + 1) + " is not in the model.";
+        return false;
+    }
+    live[row] = 0;
+    stats.Remove(ds, row);
+    if (lsh) {
+        lsh->Erase(row);
+    }
+    return true;
+}
+
+std::vector<int> Model::LiveRows() const {
+    std::vector<int> out;
+    out.reserve(live.size());
+    for (size_t r = 0; r < live.size(); ++r) {
+        if (live[r]) {
+            out.push_back(static_cast<int>(r));
+        }
+    }
+    return out;
+}
+
+std::vector<int> Model::Candidates(int row, int probes) const {
+    if (lsh) {
+        return lsh->Candidates(row, probes);
+    }
+    std::vector<int> out = LiveRows();
+    out.erase(std::remove(out.begin(), out.end(), row), out.end());
+    return out;
+}
+
+bool Model::CheckStats(std::string& err) const {
+    const Stats full = ComputeStats(ds, LiveRows(), cfg);
+    const Stats& kept = stats.Get();
+    for (size_t a = 0; a < ds.types.size(); ++a) {
+        const std::string name = "attribute " + std::to_string(a + 1);
+        if (ds.types[a] == AttrType::Numeric) {
+            const auto& x = kept.numStats[a];
+            const auto& y = full.numStats[a];
+            if (x.hasValue != y.hasValue || x.min != y.min || x.max != y.max || x.range != y.range) {
+                err = "Numeric stats of " + name + " differ from ComputeStats.";
+                return false;
+            }
+            continue;
+        }
+        // Value indices may be ordered differently: compare by code.
+        const auto& x = kept.nomStats[a];
+        const auto& y = full.nomStats[a];
+        auto indexOf = [](const NominalStat& ns, size_t c) { return c < ns.codeIndex.size() ? ns.codeIndex[c] : -1; };
+        const size_t values = ds.nominalValues[a].size();
+        for (size_t ci = 0; ci < values; ++ci) {
+            const int xi = indexOf(x, ci);
+            const int yi = indexOf(y, ci);
+            if ((xi < 0) != (yi < 0)) {
+                err = "Values of " + name + " differ from ComputeStats (" + ds.nominalValues[a][ci] + ").";
+                return false;
+            }
+            for (size_t cj = 0; cj < values && xi >= 0; ++cj) {
+                const int xj = indexOf(x, cj);
+                const int yj = indexOf(y, cj);
+                if (xj >= 0 && yj >= 0 && ValueDistance(x, xi, xj, cfg) != ValueDistance(y, yi, yj, cfg)) {
+                    err = "SVDM of " + name + " differs from ComputeStats (" + ds.nominalValues[a][ci] + ", " +
+                          ds.nominalValues[a][cj] + ").";
+                    return false;
+                }
+            }
+        }
+    }
+    return true;
+}
\ No newline at end of file
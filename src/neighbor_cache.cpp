@@ -0,0 +1,321 @@
+#include "neighbor_cache.h"
+
+#include "util.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <sstream>
+
+#ifdef _WIN32
+#define NOMINMAX
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+static const char kMagic[4] = {'R', 'N', 'B', 'C'};
+static const uint32_t kVersion = 1;
+static const uint64_t kHeaderBytes = 32;
+static const uint64_t kEntryBytes = sizeof(double) + sizeof(int32_t);
+
+static void PutU32(std::string& out, uint32_t v) {
+    for (int i = 0; i < 4; ++i) out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+static void PutU64(std::string& out, uint64_t v) {
+    for (int i = 0; i < 8; ++i) out.push_back(static_cast<char>((v >> (8 * i)) & 0xff));
+}
+
+static uint32_t GetU32(const unsigned char* p) {
+    uint32_t v = 0;
+    for (int i = 0; i < 4; ++i) v |= static_cast<uint32_t>(p[i]) << (8 * i);
+    return v;
+}
+
+static uint64_t GetU64(const unsigned char* p) {
+    uint64_t v = 0;
+    for (int i = 0; i < 8; ++i) v |= static_cast<uint64_t>(p[i]) << (8 * i);
+    return v;
+}
+
+// FNV-1a over raw bytes, continued from h.
+static uint64_t HashBytes(uint64_t h, const void* data, size_t n) {
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    for (size_t i = 0; i < n; ++i) {
+        h = (h ^ p[i]) * 0x100000001B3ull;
+    }
+    return h;
+}
+
+template <typename T>
+static uint64_t HashValue(uint64_t h, T v) {
+    return HashBytes(h, &v, sizeof(v));
+}
+
+static uint64_t HashString(uint64_t h, const std::string& s) {
+    return HashBytes(HashValue(h, (uint64_t)s.size()), s.data(), s.size());
+}
+
+uint64_t NeighborCacheKey(const Dataset& ds, const DistanceConfig& cfg, const std::string& mode) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    h = HashValue(h, kVersion);
+    h = HashValue(h, (uint64_t)ds.types.size());
+    for (AttrType t : ds.types) {
+        h = HashValue(h, (int)t);
+    }
+    h = HashValue(h, (uint64_t)ds.rows.size());
+    for (const auto& row : ds.rows) {
+        for (size_t a = 0; a < row.attrs.size(); ++a) {
+            const auto& v = row.attrs[a];
+            h = HashValue(h, (char)v.missing);
+            if (v.missing) {
+                continue;
+            }
+            if (ds.types[a] == AttrType::Numeric) {
+                h = HashValue(h, v.num);
+            } else {
+                h = HashString(h, ds.nominalValues[a][v.code]);
+            }
+        }
+        h = HashString(h, row.decision);
+    }
+    h = HashValue(h, (int)cfg.metric);
+    h = HashValue(h, (char)cfg.svdmPrime);
+    h = HashValue(h, cfg.missingNominal);
+    h = HashValue(h, cfg.missingNumeric);
+    h = HashValue(h, (uint64_t)cfg.denseValues);
+    h = HashString(h, mode);
+    return Mix64(h);
+}
+
+static uint64_t FileBytes(size_t rows, size_t depth) {
+    return kHeaderBytes + (uint64_t)rows * depth * kEntryBytes;
+}
+
+uint64_t NeighborCacheMemory(size_t rows, size_t depth) {
+    return (uint64_t)rows * (sizeof(std::vector<Neighbor>) + depth * sizeof(Neighbor));
+}
+
+NeighborCache::~NeighborCache() {
+    Unmap();
+}
+
+void NeighborCache::Unmap() {
+    if (!mapped) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(mapped);
+    CloseHandle(static_cast<HANDLE>(mapping));
+#else
+    munmap(const_cast<unsigned char*>(mapped), mappedBytes);
+#endif
+    mapped = nullptr;
+    mapping = nullptr;
+    mappedBytes = 0;
+    mappedDepth = 0;
+}
+
+// Maps path read-only; false (nothing mapped) if it is missing or empty.
+static bool MapFile(const std::string& path, const unsigned char*& data, size_t& bytes, void*& mapping) {
+#ifdef _WIN32
+    HANDLE file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ | FILE_SHARE_DELETE, nullptr,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) {
+        return false;
+    }
+    LARGE_INTEGER size;
+    if (!GetFileSizeEx(file, &size) || size.QuadPart == 0) {
+        CloseHandle(file);
+        return false;
+    }
+    HANDLE map = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    CloseHandle(file);
+    if (!map) {
+        return false;
+    }
+    void* view = MapViewOfFile(map, FILE_MAP_READ, 0, 0, 0);
+    if (!view) {
+        CloseHandle(map);
+        return false;
+    }
+    data = static_cast<const unsigned char*>(view);
+    bytes = static_cast<size_t>(size.QuadPart);
+    mapping = map;
+    return true;
+#else
+    const int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size == 0) {
+        close(fd);
+        return false;
+    }
+    void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (view == MAP_FAILED) {
+        return false;
+    }
+    data = static_cast<const unsigned char*>(view);
+    bytes = (size_t)st.st_size;
+    mapping = nullptr;
+    return true;
+#endif
+}
+
+bool NeighborCache::Open(const std::string& dir, uint64_t fileKey, size_t rowCount, size_t rankDepth, std::string& err) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    if (ec) {
+        err = "Cannot create neighbor cache directory " + dir + ": " + ec.message();
+        return false;
+    }
+    std::ostringstream name;
+    name << "NBR_" << std::hex;
+    name.width(16);
+    name.fill('0');
+    name << fileKey << ".bin";
+    path = (std::filesystem::path(dir) / name.str()).string();
+    key = fileKey;
+    rows = rowCount;
+    Unmap();
+    stored.assign(rows, {});
+    dirty = false;
+
+    // A file of another key, row count or size (e.g. cut short) is ignored.
+    if (MapFile(path, mapped, mappedBytes, mapping)) {
+        const unsigned char* p = mapped;
+        const size_t fileDepth = mappedBytes >= kHeaderBytes ? GetU32(p + 24) : 0;
+        const bool valid = mappedBytes >= kHeaderBytes && std::memcmp(p, kMagic, 4) == 0 &&
+                           GetU32(p + 4) == kVersion && GetU64(p + 8) == key && GetU64(p + 16) == rows &&
+                           fileDepth > 0 && mappedBytes == FileBytes(rows, fileDepth);
+        if (valid) {
+            mappedDepth = fileDepth;
+        } else {
+            Unmap();
+        }
+    }
+    depth = rankDepth;
+    return true;
+}
+
+bool NeighborCache::MapRow(size_t row, size_t k, std::vector<Neighbor>* out) const {
+    if (!mapped || row >= rows || k > mappedDepth) {
+        return false;
+    }
+    const unsigned char* dists = mapped + kHeaderBytes + row * mappedDepth * sizeof(double);
+    const unsigned char* index = mapped + kHeaderBytes + rows * mappedDepth * sizeof(double) +
+                                 row * mappedDepth * sizeof(int32_t);
+    int32_t first;
+    std::memcpy(&first, index, sizeof(first));
+    if (first < 0) {
+        return false;
+    }
+    if (out) {
+        out->resize(k);
+        for (size_t j = 0; j < k; ++j) {
+            int32_t idx;
+            std::memcpy(&idx, index + j * sizeof(int32_t), sizeof(idx));
+            (*out)[j].index = idx;
+            std::memcpy(&(*out)[j].dist, dists + j * sizeof(double), sizeof(double));
+        }
+    }
+    return true;
+}
+
+bool NeighborCache::Find(size_t row, size_t k, std::vector<Neighbor>& out) const {
+    if (row < stored.size() && !stored[row].empty() && k <= stored[row].size()) {
+        out.assign(stored[row].begin(), stored[row].begin() + k);
+        return true;
+    }
+    return MapRow(row, k, &out);
+}
+
+void NeighborCache::Store(size_t row, const std::vector<Neighbor>& ranked) {
+    if (row >= stored.size() || ranked.size() < depth || depth == 0) {
+        return;
+    }
+    stored[row].assign(ranked.begin(), ranked.begin() + depth);
+    dirty = true;
+}
+
+bool NeighborCache::Save(std::string& err) {
+    if (!dirty) {
+        return true;
+    }
+    // Rows of this run, then mapped rows that are deep enough; the rest stay uncached.
+    std::vector<Neighbor> fromFile;
+    auto rowList = [&](size_t row) -> const std::vector<Neighbor>* {
+        if (!stored[row].empty()) {
+            return &stored[row];
+        }
+        if (MapRow(row, depth, &fromFile)) {
+            return &fromFile;
+        }
+        return nullptr;
+    };
+
+    const auto stamp = (uint64_t)std::chrono::steady_clock::now().time_since_epoch().count();
+    const std::string tmpPath = path + ".tmp" + std::to_string(Mix64(stamp ^ (uint64_t)(uintptr_t)this) & 0xffffff);
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            err = "Cannot write neighbor cache: " + tmpPath;
+            return false;
+        }
+        std::string header(kMagic, 4);
+        PutU32(header, kVersion);
+        PutU64(header, key);
+        PutU64(header, rows);
+        PutU32(header, (uint32_t)depth);
+        PutU32(header, 0);
+        out.write(header.data(), (std::streamsize)header.size());
+
+        std::vector<double> dists(depth);
+        for (size_t r = 0; r < rows; ++r) {
+            const std::vector<Neighbor>* list = rowList(r);
+            for (size_t j = 0; j < depth; ++j) {
+                dists[j] = list ? (*list)[j].dist : 0.0;
+            }
+            out.write(reinterpret_cast<const char*>(dists.data()), (std::streamsize)(depth * sizeof(double)));
+        }
+        std::vector<int32_t> index(depth);
+        for (size_t r = 0; r < rows; ++r) {
+            const std::vector<Neighbor>* list = rowList(r);
+            for (size_t j = 0; j < depth; ++j) {
+                index[j] = list ? (int32_t)(*list)[j].index : -1;
+            }
+            out.write(reinterpret_cast<const char*>(index.data()), (std::streamsize)(depth * sizeof(int32_t)));
+        }
+        if (!out) {
+            err = "Cannot write neighbor cache: " + tmpPath;
+            return false;
+        }
+    }
+
+    Unmap();
+    std::error_code ec;
+    std::filesystem::rename(tmpPath, path, ec);
+    if (ec) {
+        err = "Cannot replace neighbor cache " + path + ": " + ec.message();
+        return false;
+    }
+    // The rows now live in the file; keep them in memory only if it cannot be mapped.
+    if (MapFile(path, mapped, mappedBytes, mapping) && mappedBytes == FileBytes(rows, depth)) {
+        mappedDepth = depth;
+        stored.assign(rows, {});
+    } else {
+        Unmap();
+    }
+    dirty = false;
+    return true;
+}
\ No newline at end of file
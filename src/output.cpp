@@ -1,40 +1,355 @@
 #include "output.h"
 
+#include "util.h"
+
+#include <algorithm>
+#include <filesystem>
 #include <fstream>
+#include <sstream>
+
+static void WriteOutRow(std::ostream& out,
+                        const Instance& inst,
+                        const std::string& predStd,
+                        const std::string& predNorm,
+                        const std::string& missingToken) {
+    out << inst.id;
+    for (const auto& attr : inst.attrs) {
+        out << ",";
+        if (attr.missing) {
+            out << missingToken;
+        } else {
+            out << attr.raw;
+        }
+    }
+    out << "," << inst.decision
+        << "," << predStd
+        << "," << predNorm << "\n";
+}
+
+void WriteKnnRow(std::ostream& out, size_t row, const std::vector<Neighbor>& list) {
+    out << (row + 1) << "," << list.size();
+    for (const auto& nb : list) {
+        out << ",(" << (nb.index + 1) << "," << nb.dist << ")";
+    }
+    out << "\n";
+}
 
 void WriteOutFile(const std::string& path,
                   const Dataset& ds,
                   const std::vector<std::string>& predStd,
                   const std::vector<std::string>& predNorm,
-                  const std::string& missingToken) {
+                  const std::string& missingToken,
+                  size_t firstRow,
+                  const std::vector<size_t>* rows) {
     std::ofstream out(path);
-    for (size_t i = 0; i < ds.rows.size(); ++i) {
-        const auto& inst = ds.rows[i];
-        out << inst.id;
-        for (const auto& attr : inst.attrs) {
-            out << ",";
-            if (attr.missing) {
-                out << missingToken;
-            } else {
-                out << attr.raw;
-            }
-        }
-        out << "," << inst.decision
-            << "," << predStd[i]
-            << "," << predNorm[i] << "\n";
+    for (size_t i = 0; i < predStd.size(); ++i) {
+        WriteOutRow(out, ds.rows[rows ? (*rows)[i] : firstRow + i], predStd[i], predNorm[i], missingToken);
     }
 }
 
 void WriteKnnFile(const std::string& path,
-                  const std::vector<std::vector<Neighbor>>& knnLists) {
+                  const std::vector<std::vector<Neighbor>>& knnLists,
+                  size_t firstRow,
+                  const std::vector<size_t>* rows) {
     std::ofstream out(path);
     for (size_t i = 0; i < knnLists.size(); ++i) {
-        const auto& list = knnLists[i];
-        out << (i + 1) << "," << list.size();
-        for (const auto& nb : list) {
-            out << ",(" << (nb.index + 1) << "," << nb.dist << ")";
+        WriteKnnRow(out, rows ? (*rows)[i] : firstRow + i, knnLists[i]);
+    }
+}
+
+bool StreamingResultWriter::Open(const std::string& outPath,
+                                 const std::string& knnPath,
+                                 const std::string& knnFormat,
+                                 size_t firstRow,
+                                 uint64_t outBytes,
+                                 uint64_t knnBytes,
+                                 std::string& err) {
+    binary = (knnFormat != "csv");
+    std::error_code ec;
+    if (outBytes > 0 || knnBytes > 0) {
+        // Continue after a checkpoint: drop anything written past it.
+        std::filesystem::resize_file(outPath, outBytes, ec);
+        if (!ec && !binary) {
+            std::filesystem::resize_file(knnPath, knnBytes, ec);
         }
-        out << "\n";
+        if (ec) {
+            err = "Cannot truncate output files to checkpoint: " + ec.message();
+            return false;
+        }
+        outStream.open(outPath, std::ios::app);
+        if (!binary) {
+            knnStream.open(knnPath, std::ios::app);
+        }
+    } else {
+        outStream.open(outPath, std::ios::trunc);
+        if (!binary) {
+            knnStream.open(knnPath, std::ios::trunc);
+        }
+    }
+    if (binary && !knnBinary.Open(knnPath, firstRow, knnFormat == "bin32", knnBytes, err)) {
+        return false;
+    }
+    if (!outStream || (!binary && !knnStream)) {
+        err = "Cannot open output files: " + outPath + ", " + knnPath;
+        return false;
+    }
+    return true;
+}
+
+void StreamingResultWriter::Write(const Dataset& ds,
+                                  size_t row,
+                                  const ClassificationResult& res,
+                                  const std::string& missingToken) {
+    WriteOutRow(outStream, ds.rows[row], res.predictedStandard, res.predictedNormalized, missingToken);
+    if (binary) {
+        knnBinary.Write(row, res.knnList);
+    } else {
+        WriteKnnRow(knnStream, row, res.knnList);
+    }
+}
+
+void StreamingResultWriter::Flush(uint64_t& outBytes, uint64_t& knnBytes) {
+    outStream.flush();
+    outBytes = static_cast<uint64_t>(outStream.tellp());
+    if (binary) {
+        knnBytes = knnBinary.Flush();
+    } else {
+        knnStream.flush();
+        knnBytes = static_cast<uint64_t>(knnStream.tellp());
+    }
+}
+
+bool StreamingResultWriter::Close(std::string& err) {
+    outStream.close();
+    if (binary) {
+        return knnBinary.Close(err);
+    }
+    knnStream.close();
+    return true;
+}
+
+static void WriteMatrixLine(std::ostream& out, const char* key, const std::vector<std::vector<int>>& conf) {
+    out << key << ":";
+    for (const auto& row : conf) {
+        for (int v : row) {
+            out << " " << v;
+        }
+    }
+    out << "\n";
+}
+
+static bool ReadMatrixLine(const std::string& line, size_t d, std::vector<std::vector<int>>& conf) {
+    std::istringstream ss(line.substr(line.find(':') + 1));
+    conf = InitMatrix(d);
+    for (size_t i = 0; i < d; ++i) {
+        for (size_t j = 0; j < d; ++j) {
+            if (!(ss >> conf[i][j])) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+void WriteShardFile(const std::string& path, const ShardSummary& shard) {
+    std::ofstream out(path);
+    out.precision(17);
+    out << "Shard: " << shard.index << "/" << shard.count << "\n";
+    out << "Rows: " << shard.begin << " " << shard.end << "\n";
+    out << "Times(ms): " << shard.timeReadMs
+        << " " << shard.timePrepMs
+        << " " << shard.timeClassifyMs
+        << " " << shard.timeWriteMs
+        << " " << shard.timeTotalMs << "\n";
+    out << "d: " << shard.confStd.size() << "\n";
+    WriteMatrixLine(out, "ConfusionStandard", shard.confStd);
+    WriteMatrixLine(out, "ConfusionNormalized", shard.confNorm);
+    out << "Partial: " << shard.partial << "\n";
+    out << "Latency: ";
+    shard.latency.Write(out);
+    out << "\n";
+    for (const auto& s : shard.slowest) {
+        out << "Slow: " << s.row << " " << s.latencyNs << " " << s.neighbors << " " << s.ruleChecks << " "
+            << s.consistencyChecks << "\n";
+    }
+}
+
+bool ReadShardFile(const std::string& path, ShardSummary& shard, std::string& err) {
+    std::ifstream in(path);
+    if (!in) {
+        err = "Cannot open shard file: " + path;
+        return false;
+    }
+    std::string line;
+    size_t d = 0;
+    int found = 0;
+    while (std::getline(in, line)) {
+        std::istringstream ss(line.substr(line.find(':') + 1));
+        char slash = 0;
+        if (StartsWithNoCase(line, "Shard:")) {
+            ss >> shard.index >> slash >> shard.count;
+        } else if (StartsWithNoCase(line, "Rows:")) {
+            ss >> shard.begin >> shard.end;
+        } else if (StartsWithNoCase(line, "Times(ms):")) {
+            ss >> shard.timeReadMs >> shard.timePrepMs >> shard.timeClassifyMs
+               >> shard.timeWriteMs >> shard.timeTotalMs;
+        } else if (StartsWithNoCase(line, "d:")) {
+            ss >> d;
+        } else if (StartsWithNoCase(line, "ConfusionStandard:")) {
+            if (!ReadMatrixLine(line, d, shard.confStd)) break;
+        } else if (StartsWithNoCase(line, "ConfusionNormalized:")) {
+            if (!ReadMatrixLine(line, d, shard.confNorm)) break;
+        } else if (StartsWithNoCase(line, "Partial:")) {
+            ss >> shard.partial;
+        } else if (StartsWithNoCase(line, "Latency:")) {
+            if (!shard.latency.Read(ss)) break;
+            ss.clear();
+        } else if (StartsWithNoCase(line, "Slow:")) {
+            SlowObject s;
+            if (!(ss >> s.row >> s.latencyNs >> s.neighbors >> s.ruleChecks >> s.consistencyChecks)) break;
+            shard.slowest.push_back(s);
+            continue;
+        } else {
+            continue;
+        }
+        if (ss.fail()) {
+            break;
+        }
+        ++found;
+    }
+    if (found != 8 || !in.eof()) {
+        err = "Invalid shard file: " + path;
+        return false;
+    }
+    return true;
+}
+
+void AppendShardTimes(const std::string& statPath, const std::vector<ShardSummary>& shards) {
+    double maxWallMs = 0.0;
+    for (const auto& shard : shards) {
+        maxWallMs = std::max(maxWallMs, shard.timeTotalMs);
+    }
+    std::ofstream out(statPath, std::ios::app);
+    out << "Shards: " << shards.size() << "\n";
+    out << "ShardWallTime(ms): max=" << maxWallMs << "\n";
+}
+
+void AppendLatency(const std::string& statPath, const LatencyHistogram& latency) {
+    std::ofstream out(statPath, std::ios::app);
+    out << "Latency(us): p50=" << latency.Percentile(50.0) / 1000.0
+        << ", p90=" << latency.Percentile(90.0) / 1000.0
+        << ", p99=" << latency.Percentile(99.0) / 1000.0
+        << ", max=" << latency.Max() / 1000.0
+        << ", objects=" << latency.Count() << "\n";
+}
+
+void AppendRiaApproxReport(const std::string& statPath, const RiaApproxReport& report) {
+    auto pct = [&](size_t n) { return report.heldOut ? 100.0 * n / report.heldOut : 0.0; };
+    std::ofstream out(statPath, std::ios::app);
+    out << "RiaApprox: nearest=" << report.nearest
+        << ", sample=" << report.sample
+        << ", seed=" << report.seed
+        << ", holdout=" << report.holdout << "\n";
+    out << "RiaApproxHeldOut: objects=" << report.heldOut
+        << ", disagreeStd=" << report.disagreeStd << " (" << pct(report.disagreeStd) << "%)"
+        << ", disagreeNorm=" << report.disagreeNorm << " (" << pct(report.disagreeNorm) << "%)\n";
+    out << "RiaApproxAccuracy: exactStd=" << pct(report.exactCorrectStd)
+        << "%, approxStd=" << pct(report.approxCorrectStd)
+        << "%, exactNorm=" << pct(report.exactCorrectNorm)
+        << "%, approxNorm=" << pct(report.approxCorrectNorm) << "%\n";
+}
+
+void AppendLshReport(const std::string& statPath, const LshReport& report) {
+    std::ofstream out(statPath, std::ios::app);
+    out << "Lsh: tables=" << report.tables
+        << ", hashes=" << report.hashes
+        << ", probes=" << report.probes
+        << ", width=" << report.width << ", embedding=global\n";
+    out << "LshQueries: objects=" << report.queries
+        << ", avgCandidates=" << (report.queries ? (double)report.candidateSum / report.queries : 0.0)
+        << ", exactFallbacks=" << report.fallbacks << "\n";
+    out << "LshRecall: objects=" << report.checked
+        << ", recall@k=" << (report.exactNeighbors ? (double)report.foundNeighbors / report.exactNeighbors : 1.0)
+        << "\n";
+}
+
+void AppendLooSampleReport(const std::string& statPath,
+                           const Dataset& ds,
+                           const LooSampleReport& report,
+                           const std::vector<std::vector<int>>& confStd,
+                           const std::vector<std::vector<int>>& confNorm) {
+    auto interval = [](double lo, double hi) {
+        std::ostringstream text;
+        text << "[" << lo << ", " << hi << "]";
+        return text.str();
+    };
+    auto correct = [](const std::vector<std::vector<int>>& conf) {
+        int sum = 0;
+        for (size_t i = 0; i < conf.size(); ++i) {
+            sum += conf[i][i];
+        }
+        return sum;
+    };
+    const int n = (int)report.objects;
+    std::ofstream out(statPath, std::ios::app);
+    out << "LooSample: objects=" << report.objects << " of " << ds.rows.size() << ", seed=" << report.seed
+        << ", drawn:";
+    for (size_t c = 0; c < ds.decisionValues.size(); ++c) {
+        out << " " << ds.decisionValues[c] << "=" << report.drawn[c];
+    }
+    out << "\n";
+
+    const auto accStd = WilsonInterval(correct(confStd), n);
+    const auto accNorm = WilsonInterval(correct(confNorm), n);
+    out << "LooSampleAccuracy (Wilson 95%): Acc=" << (n ? (double)correct(confStd) / n : 0.0) << " "
+        << interval(accStd.first, accStd.second)
+        << " NAcc=" << (n ? (double)correct(confNorm) / n : 0.0) << " " << interval(accNorm.first, accNorm.second)
+        << "\n";
+
+    out << "LooSampleRecall (Wilson 95%):\n";
+    for (size_t c = 0; c < ds.decisionValues.size(); ++c) {
+        const int drawn = report.drawn[c];
+        const auto rStd = WilsonInterval(confStd[c][c], drawn);
+        const auto rNorm = WilsonInterval(confNorm[c][c], drawn);
+        out << "  " << ds.decisionValues[c] << " Recall=" << interval(rStd.first, rStd.second)
+            << " | NRecall=" << interval(rNorm.first, rNorm.second) << "\n";
+    }
+
+    const auto balStd = BootstrapBalanced(confStd, report.replicates, report.seed);
+    const auto balNorm = BootstrapBalanced(confNorm, report.replicates, report.seed);
+    out << "LooSampleBalanced (bootstrap 95%, " << report.replicates << " replicates):\n";
+    out << "  Bal_Precision=" << interval(balStd.first.precision, balStd.second.precision)
+        << " Bal_Recall=" << interval(balStd.first.recall, balStd.second.recall)
+        << " Bal_F1=" << interval(balStd.first.f1, balStd.second.f1) << "\n";
+    out << "  NBal_Precision=" << interval(balNorm.first.precision, balNorm.second.precision)
+        << " NBal_Recall=" << interval(balNorm.first.recall, balNorm.second.recall)
+        << " NBal_F1=" << interval(balNorm.first.f1, balNorm.second.f1) << "\n";
+}
+
+void AppendBudgetReport(const std::string& statPath, const Config& cfg, size_t partial, size_t objects) {
+    std::ofstream out(statPath, std::ios::app);
+    out << "Budget: timeMs=" << cfg.budgetMs
+        << ", rules=" << cfg.budgetRules
+        << ", distances=" << cfg.budgetDistances
+        << ", partial=" << partial << " of " << objects << "\n";
+}
+
+void AppendNeighborCacheReport(const std::string& statPath, size_t depth, size_t hits, size_t misses) {
+    std::ofstream out(statPath, std::ios::app);
+    out << "NeighborCache: depth=" << depth << ", hits=" << hits << ", misses=" << misses << "\n";
+}
+
+void AppendDedupReport(const std::string& statPath, const Dataset& ds) {
+    std::ofstream out(statPath, std::ios::app);
+    out << "Dedup: rows=" << ds.rows.size() << ", prototypes=" << ds.prototypeCount << "\n";
+}
+
+void WriteSlowFile(const std::string& path, const Dataset& ds, const std::vector<SlowObject>& slowest) {
+    std::ofstream out(path);
+    out << "Id,LatencyUs,Neighbors,RuleChecks,ConsistencyChecks\n";
+    for (const auto& s : slowest) {
+        out << ds.rows[s.row].id << "," << s.latencyNs / 1000.0 << "," << s.neighbors << ","
+            << s.ruleChecks << "," << s.consistencyChecks << "\n";
     }
 }
 
@@ -108,6 +423,10 @@ void WriteStatFile(const std::string& path,
             out << " " << v;
         }
         out << "\n";
+        if (ns.onDemand) {
+            out << "    (computed on demand: " << ns.values.size() << " values)\n";
+            continue;
+        }
         for (size_t i = 0; i < ns.values.size(); ++i) {
             out << "    " << ns.values[i] << ":";
             for (size_t j = 0; j < ns.values.size(); ++j) {
@@ -0,0 +1,360 @@
+#include "planner.h"
+
+#include "consistency_cache.h"
+#include "neighbor_cache.h"
+#include "util.h"
+
+#include <algorithm>
+#include <iomanip>
+#include <sstream>
+
+// Relative cost of one attribute term. Exact nominal terms look values up by
+// string; compact terms are flat float/uint16 arithmetic; u8 nominal terms are
+// byte-table lookups, 16-32 rows per instruction; a matrix read replaces a
+// whole row of terms.
+static constexpr double kExactNumericTerm = 1.0;
+static constexpr double kExactNominalTerm = 4.0;
+static constexpr double kCompactTerm = 0.25;
+static constexpr double kByteTerm = 0.05;
+static constexpr double kMatrixRead = 0.5;
+
+static std::string MiB(uint64_t bytes) {
+    std::ostringstream out;
+    out << std::fixed << std::setprecision(1) << (double)bytes / (1024.0 * 1024.0) << " MiB";
+    return out.str();
+}
+
+static Precision ToPrecision(const std::string& p) {
+    return p == "f32" ? Precision::F32 : p == "u16" ? Precision::U16 : p == "u8" ? Precision::U8 : Precision::F64;
+}
+
+static uint64_t CompactBytes(const Dataset& ds, Precision p) {
+    const uint64_t n = ds.rows.size();
+    const uint64_t numeric = (p == Precision::U16) ? 2 : 4;
+    const uint64_t nominal = (p == Precision::U8) ? 1 : 2;
+    return n * (ds.numericIdx.size() * numeric + ds.nominalIdx.size() * nominal);
+}
+
+bool PlanExecution(const Dataset& ds,
+                   const Stats& stats,
+                   const Config& cfg,
+                   const std::vector<std::string>& algos,
+                   const std::vector<std::string>& modes,
+                   const std::vector<int>& kList,
+                   ExecutionPlan& plan,
+                   std::string& err) {
+    plan = ExecutionPlan();
+    const double n = (double)ds.rows.size();
+    const double pairs = n * (n - 1.0);
+    // Object pairs the experiments compare: only the drawn test objects with --loo-sample.
+    const double queryPairs = (cfg.looSample > 0 && (double)cfg.looSample < n) ? cfg.looSample * (n - 1.0) : pairs;
+    const uint64_t threads = (uint64_t)std::max(1, cfg.threads);
+    const bool local = std::find(modes.begin(), modes.end(), "l") != modes.end();
+    const bool global = std::find(modes.begin(), modes.end(), "g") != modes.end();
+    const bool ria = std::find(algos.begin(), algos.end(), "RIA") != algos.end();
+
+    // Memory: rows, SVDM tables (one copy per worker for local stats),
+    // matrix upper triangle, compact columns and exact RIA verifiers.
+    uint64_t svdmBytes = 0;
+    for (int a : ds.nominalIdx) {
+        const uint64_t v = stats.nomStats[a].values.size();
+        svdmBytes += (stats.nomStats[a].onDemand ? v * ds.decisionValues.size() : v * v) * sizeof(double);
+    }
+    plan.memoryLimit = cfg.memoryLimit;
+    plan.baseBytes = (uint64_t)ds.rows.size() * (sizeof(Instance) + ds.types.size() * (sizeof(AttributeValue) + 8)) +
+                     svdmBytes * (1 + (local ? threads : 0));
+    plan.matrixBytes = (uint64_t)(pairs / 2.0) * sizeof(double);
+    plan.verifierBytes = ria ? threads * (uint64_t)ds.rows.size() * (3 * sizeof(int) + sizeof(Neighbor)) : 0;
+
+    // An IVDM numeric term interpolates two class distributions.
+    const double numericTerm = cfg.metric == "ivdm" ? 2.0 * ds.decisionValues.size() * kExactNumericTerm
+                                                    : kExactNumericTerm;
+    const double rowExact = ds.numericIdx.size() * numericTerm + ds.nominalIdx.size() * kExactNominalTerm;
+    // u8 suits mostly-nominal data whose attributes have at most 255 values.
+    const bool u8Fits = !ds.nominalIdx.empty() && ds.nominalIdx.size() >= ds.numericIdx.size() &&
+                        std::all_of(ds.nominalIdx.begin(), ds.nominalIdx.end(),
+                                    [&](int a) { return ds.nominalValues[a].size() <= 255; });
+    // f32/u16 copy the SVDM matrices into float tables, which on-demand attributes do not have.
+    const bool denseSvdm = std::none_of(ds.nominalIdx.begin(), ds.nominalIdx.end(),
+                                        [&](int a) { return stats.nomStats[a].onDemand; });
+    const double rowCompact = u8Fits ? ds.numericIdx.size() * kCompactTerm + ds.nominalIdx.size() * kByteTerm
+                                     : (ds.numericIdx.size() + ds.nominalIdx.size()) * kCompactTerm;
+    plan.matrixBuildCost = pairs / 2.0 * rowExact;
+
+    // Forced choices.
+    bool forceNeighbors = false;
+    bool forceConsistency = false;
+    std::string precision = cfg.precision;
+    if (!cfg.forceStrategy.empty()) {
+        std::stringstream ss(cfg.forceStrategy);
+        std::string token;
+        while (std::getline(ss, token, ',')) {
+            token = Trim(token);
+            if (token == "scan" || token == "matrix") {
+                forceNeighbors = true;
+                plan.distanceMatrix = (token == "matrix");
+                if (precision.empty()) {
+                    precision = "f64";
+                }
+            } else if (token == "f32" || token == "u16" || token == "u8") {
+                forceNeighbors = true;
+                plan.distanceMatrix = false;
+                precision = token;
+            } else if (token == "exact" || token == "sampled") {
+                forceConsistency = true;
+                plan.sampledConsistency = (token == "sampled");
+            } else {
+                err = "Unknown strategy in --force-strategy: " + token;
+                return false;
+            }
+        }
+        if (forceNeighbors) {
+            plan.reasons.push_back("neighbor search forced (--force-strategy " + cfg.forceStrategy + ")");
+        }
+        if (forceConsistency) {
+            plan.reasons.push_back(std::string("RIA consistency forced to ") +
+                                   (plan.sampledConsistency ? "sampled" : "exact"));
+        }
+    }
+    // The compact columns rank numeric attributes linearly, which IVDM is not.
+    if (cfg.metric == "ivdm" && !precision.empty() && precision != "f64") {
+        err = "IVDM needs --precision f64 (compact columns rank numeric attributes linearly)";
+        return false;
+    }
+    if (!denseSvdm && (precision == "f32" || precision == "u16")) {
+        err = "--precision " + precision + " needs SVDM matrices; attributes with more than --svdm-dense-max " +
+              "values have none (use f64 or u8)";
+        return false;
+    }
+    if (!cfg.precision.empty() && !forceNeighbors) {
+        plan.reasons.push_back("precision " + cfg.precision + " from --precision");
+    }
+
+    // Experiments, with the neighbors each one ranks per object.
+    for (const auto& algo : algos) {
+        for (const auto& mode : modes) {
+            for (int k : kList) {
+                PlannedExperiment e;
+                e.algo = algo;
+                e.mode = mode;
+                e.k = std::min(k, (int)ds.rows.size() - 1);
+                if (algo == "RIONA") {
+                    e.ranked = e.k;
+                    e.consistency = "exact";
+                } else if (algo == "KNN") {
+                    e.ranked = cfg.nForKPlusNN < 0 ? (int)n - 1 : std::max(e.k, std::min(cfg.nForKPlusNN, (int)n - 1));
+                    e.consistency = "none";
+                } else {
+                    e.ranked = (int)n - 1;
+                    e.consistency = "exact";
+                }
+                plan.experiments.push_back(e);
+            }
+        }
+    }
+    // With --dedup each object is compared with the prototypes only.
+    const double scanPairs = ds.prototypeOf.empty() ? queryPairs : queryPairs / (n - 1.0) * ds.prototypeCount;
+    auto scanCost = [&](const PlannedExperiment&) { return scanPairs * rowExact; };
+    // Compact ranking only applies to bounded neighborhoods; the exact
+    // re-check covers about twice the neighbors plus a few ties.
+    auto compactCost = [&](const PlannedExperiment& e) {
+        const double recheck = std::min(n - 1.0, 2.0 * e.ranked + 8.0);
+        const bool applies = e.ranked < (int)n - 1 && cfg.metric != "ivdm" && ds.prototypeOf.empty() &&
+                             (u8Fits || denseSvdm);
+        return applies ? queryPairs * rowCompact + queryPairs / (n - 1.0) * recheck * rowExact : scanCost(e);
+    };
+    auto bestCost = [&](const PlannedExperiment& e, bool compact) {
+        return compact ? std::min(scanCost(e), compactCost(e)) : scanCost(e);
+    };
+
+    if (!forceNeighbors) {
+        // Compact columns pay off when some experiment ranks a bounded neighborhood.
+        const bool compactHelps = std::any_of(plan.experiments.begin(), plan.experiments.end(),
+            [&](const PlannedExperiment& e) { return compactCost(e) < scanCost(e); });
+
+        // Matrix: built once, then every global experiment reads a row of it.
+        double withMatrix = plan.matrixBuildCost;
+        double withoutMatrix = 0.0;
+        for (const auto& e : plan.experiments) {
+            withMatrix += (e.mode == "g") ? queryPairs * kMatrixRead : bestCost(e, compactHelps);
+            withoutMatrix += bestCost(e, compactHelps);
+        }
+        const uint64_t fixed = plan.baseBytes + (plan.sampledConsistency ? 0 : plan.verifierBytes);
+        if (!global) {
+            plan.reasons.push_back("no distance matrix: no global-mode experiments");
+        } else if (withMatrix >= withoutMatrix) {
+            plan.reasons.push_back("no distance matrix: building it costs more than it saves");
+        } else if (fixed + plan.matrixBytes > plan.memoryLimit) {
+            plan.reasons.push_back("no distance matrix: needs " + MiB(plan.matrixBytes) + ", memory limit " +
+                                   MiB(plan.memoryLimit));
+        } else {
+            plan.distanceMatrix = true;
+            std::ostringstream why;
+            why << "distance matrix: " << MiB(plan.matrixBytes) << ", estimated work "
+                << std::setprecision(3) << withMatrix / withoutMatrix << "x of recomputing distances";
+            plan.reasons.push_back(why.str());
+        }
+
+        if (precision.empty()) {
+            const bool needed = std::any_of(plan.experiments.begin(), plan.experiments.end(),
+                [&](const PlannedExperiment& e) {
+                    return !(plan.distanceMatrix && e.mode == "g") && compactCost(e) < scanCost(e);
+                });
+            const uint64_t used = fixed + (plan.distanceMatrix ? plan.matrixBytes : 0);
+            precision = "f64";
+            if (!needed) {
+                plan.reasons.push_back("precision f64: no experiment ranks a bounded neighborhood by scanning");
+            } else if (u8Fits && used + CompactBytes(ds, Precision::U8) <= plan.memoryLimit) {
+                precision = "u8";
+                plan.reasons.push_back("precision u8: mostly nominal attributes ranked with byte lookup tables");
+            } else if (!denseSvdm) {
+                plan.reasons.push_back("precision f64: on-demand SVDM attributes have no compact tables");
+            } else if (used + CompactBytes(ds, Precision::F32) <= plan.memoryLimit) {
+                precision = "f32";
+                plan.reasons.push_back("precision f32: bounded neighborhoods ranked on compact columns");
+            } else if (used + CompactBytes(ds, Precision::U16) <= plan.memoryLimit) {
+                precision = "u16";
+                plan.reasons.push_back("precision u16: f32 columns exceed the memory limit");
+            } else {
+                plan.reasons.push_back("precision f64: compact columns exceed the memory limit");
+            }
+        }
+    }
+    if (precision.empty()) {
+        precision = "f64";
+    }
+    plan.precision = precision;
+    plan.compactBytes = ToPrecision(precision) == Precision::F64 ? 0 : CompactBytes(ds, ToPrecision(precision));
+
+    if (cfg.riaApprox && !plan.sampledConsistency) {
+        plan.sampledConsistency = !forceConsistency;
+        if (plan.sampledConsistency) {
+            plan.reasons.push_back("RIA consistency sampled (--ria-approx)");
+        }
+    }
+    if (ria && !plan.sampledConsistency && !forceConsistency) {
+        const uint64_t used = plan.baseBytes + plan.compactBytes + (plan.distanceMatrix ? plan.matrixBytes : 0);
+        // Sampling changes RIA's results, so it is never chosen silently.
+        if (used + plan.verifierBytes > plan.memoryLimit) {
+            err = "Exact RIA needs " + MiB(used + plan.verifierBytes) + " (verifiers " + MiB(plan.verifierBytes) +
+                  "), memory limit " + MiB(plan.memoryLimit) +
+                  ": raise --memory-limit, or use --ria-approx or --force-strategy sampled for approximate RIA.";
+            return false;
+        }
+    }
+
+    // Rule cache: exact RIA decides each rule once per mode; RIA for the other
+    // k values votes from it and RIONA skips the rules it found consistent.
+    const bool riona = std::find(algos.begin(), algos.end(), "RIONA") != algos.end();
+    if (ria && !plan.sampledConsistency && (kList.size() > 1 || riona)) {
+        const uint64_t used = plan.baseBytes + plan.compactBytes + plan.verifierBytes +
+                              (plan.distanceMatrix ? plan.matrixBytes : 0);
+        const uint64_t bytes = modes.size() * ConsistencyCache::BytesFor(ds.rows.size());
+        if (used + bytes <= plan.memoryLimit) {
+            plan.consistencyCache = true;
+            plan.cacheBytes = bytes;
+            plan.reasons.push_back("rule cache: " + MiB(bytes) + ", RIA rules decided once per mode" +
+                                   (riona ? " and reused by RIONA" : ""));
+        } else {
+            plan.reasons.push_back("no rule cache: needs " + MiB(bytes) + ", memory limit " + MiB(plan.memoryLimit));
+        }
+    }
+
+    // --neighbor-cache: lists of each cached mode ranked as deep as the deepest
+    // RIONA k or k+NN n that fits the rest of the budget. k+NN with the
+    // default n ranks every row, so it is not cached (nor are LSH searches).
+    if (!cfg.neighborCacheDir.empty() && n >= 2) {
+        const uint64_t cachedModes = std::count_if(modes.begin(), modes.end(), [&](const std::string& m) {
+            return m == "g" || cfg.neighborCacheLocal;
+        });
+        const uint64_t used = plan.baseBytes + plan.compactBytes + plan.cacheBytes +
+                              (plan.sampledConsistency ? 0 : plan.verifierBytes) +
+                              (plan.distanceMatrix ? plan.matrixBytes : 0);
+        const size_t rows = ds.rows.size();
+        size_t wanted = 0;
+        for (int k : kList) {
+            const size_t kEff = std::min((size_t)k, rows - 1);
+            for (const auto& algo : algos) {
+                size_t d = 0;
+                if (algo == "RIONA" && cfg.lshTables == 0) {
+                    d = kEff;
+                } else if (algo == "KNN" && cfg.nForKPlusNN >= 0 && cfg.lshTables == 0) {
+                    d = std::min(std::max((size_t)cfg.nForKPlusNN, kEff), rows - 1);
+                }
+                wanted = std::max(wanted, d);
+                if (d > plan.neighborCacheDepth &&
+                    used + cachedModes * NeighborCacheMemory(rows, d) <= plan.memoryLimit) {
+                    plan.neighborCacheDepth = d;
+                }
+            }
+        }
+        plan.neighborCacheBytes = cachedModes * NeighborCacheMemory(rows, plan.neighborCacheDepth);
+        if (cachedModes == 0 || wanted == 0) {
+            plan.neighborCacheDepth = 0;
+            plan.neighborCacheBytes = 0;
+            plan.reasons.push_back("no neighbor cache: no cached mode runs RIONA or k+NN with a bounded n");
+        } else if (plan.neighborCacheDepth == 0) {
+            plan.reasons.push_back("no neighbor cache: lists " + std::to_string(wanted) + " deep need " +
+                                   MiB(cachedModes * NeighborCacheMemory(rows, wanted)) + ", memory limit " +
+                                   MiB(plan.memoryLimit));
+        } else {
+            plan.reasons.push_back("neighbor cache: lists " + std::to_string(plan.neighborCacheDepth) + " deep, " +
+                                   MiB(plan.neighborCacheBytes) + " for rows ranked by this run" +
+                                   (plan.neighborCacheDepth < wanted ? " (deeper lists exceed the memory limit)" : ""));
+        }
+    }
+
+    const bool compact = ToPrecision(precision) != Precision::F64;
+    for (auto& e : plan.experiments) {
+        if (plan.distanceMatrix && e.mode == "g") {
+            e.neighbors = "matrix";
+            e.cost = pairs * kMatrixRead;
+        } else if (compact && e.ranked < (int)n - 1) {
+            e.neighbors = precision;
+            e.cost = compactCost(e);
+        } else {
+            e.neighbors = "scan";
+            e.cost = scanCost(e);
+        }
+        if (e.algo == "RIA" && plan.sampledConsistency) {
+            e.consistency = "sampled";
+        } else if (plan.consistencyCache && e.algo == "RIA" && e.k != std::min(kList.front(), (int)n - 1)) {
+            e.consistency = "cached";
+        } else if (plan.consistencyCache && e.algo == "RIONA") {
+            e.consistency = "exact+cached";
+        }
+    }
+
+    if (plan.baseBytes > plan.memoryLimit) {
+        plan.reasons.push_back("warning: the dataset alone needs " + MiB(plan.baseBytes) + ", over the memory limit");
+    }
+    return true;
+}
+
+void PrintPlan(std::ostream& out, const Dataset& ds, const ExecutionPlan& plan) {
+    size_t maxValues = 0;
+    for (int a : ds.nominalIdx) {
+        maxValues = std::max(maxValues, ds.nominalValues[a].size());
+    }
+    out << "Plan: n=" << ds.rows.size() << ", m=" << ds.types.size()
+        << " (" << ds.numericIdx.size() << " numeric, " << ds.nominalIdx.size()
+        << " nominal, max " << maxValues << " values), classes=" << ds.decisionValues.size() << "\n";
+    out << "  memory: limit " << MiB(plan.memoryLimit) << ", base " << MiB(plan.baseBytes)
+        << ", matrix " << MiB(plan.distanceMatrix ? plan.matrixBytes : 0)
+        << ", compact " << MiB(plan.compactBytes)
+        << ", RIA verifiers " << MiB(plan.sampledConsistency ? 0 : plan.verifierBytes)
+        << ", rule cache " << MiB(plan.cacheBytes)
+        << ", neighbor cache " << MiB(plan.neighborCacheBytes) << "\n";
+    for (const auto& r : plan.reasons) {
+        out << "  " << r << "\n";
+    }
+    if (plan.distanceMatrix) {
+        out << "  matrix build: cost " << std::scientific << std::setprecision(2) << plan.matrixBuildCost
+            << std::defaultfloat << "\n";
+    }
+    for (const auto& e : plan.experiments) {
+        out << "  " << e.algo << " " << e.mode << " k=" << e.k << ": neighbors=" << e.neighbors
+            << " (ranked " << e.ranked << "), consistency=" << e.consistency
+            << ", cost " << std::scientific << std::setprecision(2) << e.cost << std::defaultfloat << "\n";
+    }
+}
\ No newline at end of file
@@ -0,0 +1,147 @@
+#include "prototypes.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <unordered_map>
+#include <utility>
+
+size_t BuildPrototypes(Dataset& ds) {
+    std::unordered_map<std::string, int> ids;
+    ids.reserve(ds.rows.size());
+    ds.prototypeOf.assign(ds.rows.size(), -1);
+    std::string key;
+    for (size_t r = 0; r < ds.rows.size(); ++r) {
+        key.clear();
+        const auto& attrs = ds.rows[r].attrs;
+        for (size_t a = 0; a < ds.types.size(); ++a) {
+            const auto& v = attrs[a];
+            if (v.missing) {
+                key.push_back('?');
+                continue;
+            }
+            char bytes[sizeof(double)];
+            if (ds.types[a] == AttrType::Numeric) {
+                std::memcpy(bytes, &v.num, sizeof(double));
+            } else {
+                const int64_t code = v.code;
+                std::memcpy(bytes, &code, sizeof(code));
+            }
+            key.push_back('=');
+            key.append(bytes, sizeof(bytes));
+        }
+        auto it = ids.emplace(key, (int)ids.size()).first;
+        ds.prototypeOf[r] = it->second;
+    }
+    ds.prototypeCount = ids.size();
+    return ids.size();
+}
+
+// Slot tables of finished RowGroups, all entries -1.
+static thread_local std::vector<std::vector<int>> tFreeSlots;
+
+RowGroups::RowGroups(RowGroups&& other) noexcept {
+    *this = std::move(other);
+}
+
+RowGroups& RowGroups::operator=(RowGroups&& other) noexcept {
+    if (this != &other) {
+        Release();
+        rows = std::move(other.rows);
+        weights = std::move(other.weights);
+        start = std::move(other.start);
+        members = std::move(other.members);
+        slot.swap(other.slot);
+        used.swap(other.used);
+    }
+    return *this;
+}
+
+RowGroups::~RowGroups() {
+    Release();
+}
+
+void RowGroups::Release() {
+    if (slot.empty()) {
+        return;
+    }
+    for (size_t s : used) {
+        slot[s] = -1;
+    }
+    used.clear();
+    tFreeSlots.push_back(std::move(slot));
+    slot = std::vector<int>();
+}
+
+RowGroups GroupRows(const Dataset& ds, const std::vector<int>& rows) {
+    const size_t d = ds.decisionValues.size();
+    RowGroups groups;
+    if (!tFreeSlots.empty()) {
+        groups.slot = std::move(tFreeSlots.back());
+        tFreeSlots.pop_back();
+    }
+    if (groups.slot.size() != ds.prototypeCount * d) {
+        groups.slot.assign(ds.prototypeCount * d, -1);
+    }
+    std::vector<int> groupOfRow(rows.size());
+    for (size_t i = 0; i < rows.size(); ++i) {
+        const int g = GroupOf(ds, groups, rows[i]);
+        if (g < 0) {
+            const size_t s = (size_t)ds.prototypeOf[rows[i]] * d + ds.decisionIndex.at(ds.rows[rows[i]].decision);
+            groups.slot[s] = (int)groups.rows.size();
+            groups.used.push_back(s);
+            groups.rows.push_back(rows[i]);
+            groups.weights.push_back(0);
+            groupOfRow[i] = groups.slot[s];
+        } else {
+            groupOfRow[i] = g;
+        }
+        ++groups.weights[groupOfRow[i]];
+    }
+
+    groups.start.assign(groups.rows.size() + 1, 0);
+    for (size_t g = 0; g < groups.rows.size(); ++g) {
+        groups.start[g + 1] = groups.start[g] + groups.weights[g];
+    }
+    groups.members.resize(rows.size());
+    std::vector<int> fill(groups.start.begin(), groups.start.end() - 1);
+    for (size_t i = 0; i < rows.size(); ++i) {
+        groups.members[fill[groupOfRow[i]]++] = rows[i];
+    }
+    return groups;
+}
+
+int GroupOf(const Dataset& ds, const RowGroups& groups, int row) {
+    const size_t d = ds.decisionValues.size();
+    return groups.slot[(size_t)ds.prototypeOf[row] * d + ds.decisionIndex.at(ds.rows[row].decision)];
+}
+
+std::vector<Neighbor> ExpandNeighbors(const Dataset& ds,
+                                      const RowGroups& groups,
+                                      const std::vector<Neighbor>& ranked,
+                                      int k) {
+    // Take whole groups in distance order until k rows are covered, plus the
+    // groups tied with the last one: they may hold rows of lower index.
+    std::vector<Neighbor> rows;
+    for (const auto& nb : ranked) {
+        if (!rows.empty() && (int)rows.size() >= k && nb.dist > rows.back().dist) {
+            break;
+        }
+        const int g = GroupOf(ds, groups, nb.index);
+        for (int i = groups.start[g]; i < groups.start[g + 1]; ++i) {
+            Neighbor member;
+            member.index = groups.members[i];
+            member.dist = nb.dist;
+            rows.push_back(member);
+        }
+    }
+    k = std::max(0, std::min(k, (int)rows.size()));
+    std::partial_sort(rows.begin(), rows.begin() + k, rows.end(),
+                      [](const Neighbor& a, const Neighbor& b) {
+                          if (a.dist != b.dist) return a.dist < b.dist;
+                          return a.index < b.index;
+                      });
+    rows.resize(k);
+    return rows;
+}
\ No newline at end of file
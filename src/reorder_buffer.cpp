@@ -0,0 +1,25 @@
+#include "reorder_buffer.h"
+
+#include <utility>
+
+ReorderBuffer::ReorderBuffer(size_t firstRow, size_t window, CommitFn commit)
+    : nextRow(firstRow), window(window < 1 ? 1 : window), commit(std::move(commit)) {}
+
+void ReorderBuffer::WaitForTurn(size_t row) {
+    std::unique_lock<std::mutex> lock(mutex);
+    turn.wait(lock, [&] { return row < nextRow + window; });
+}
+
+void ReorderBuffer::Push(size_t row, ClassificationResult res) {
+    std::lock_guard<std::mutex> lock(mutex);
+    pending.emplace(row, std::move(res));
+    bool advanced = false;
+    for (auto it = pending.begin(); it != pending.end() && it->first == nextRow; it = pending.erase(it)) {
+        commit(it->first, it->second);
+        ++nextRow;
+        advanced = true;
+    }
+    if (advanced) {
+        turn.notify_all();
+    }
+}
\ No newline at end of file
@@ -0,0 +1,133 @@
+#include "snapshot.h"
+
+#include "util.h"
+
+#include <utility>
+
+static std::vector<std::string> SplitRow(const std::string& line) {
+    return line.find(',') != std::string::npos ? SplitCsvLike(line) : SplitByWhitespace(line);
+}
+
+bool EncodeQuery(const ModelSnapshot& snap,
+                 const std::string& line,
+                 const std::string& missingToken,
+                 Instance& query,
+                 std::string& err) {
+    const Dataset& ds = snap.ds;
+    const std::vector<std::string> tokens = SplitRow(line);
+    if (tokens.size() != ds.types.size() && tokens.size() != ds.types.size() + 1) {
+        err = "Query has " + std::to_string(tokens.size()) + " values, expected " +
+              std::to_string(ds.types.size()) + " (or " + std::to_string(ds.types.size() + 1) +
+              " with the decision).";
+        return false;
+    }
+    query = Instance();
+    query.attrs.resize(ds.types.size());
+    for (size_t a = 0; a < ds.types.size(); ++a) {
+        auto& v = query.attrs[a];
+        v.raw = Trim(tokens[a]);
+        v.missing = v.raw.empty() || v.raw == missingToken || v.raw == "?";
+        if (v.missing) {
+            continue;
+        }
+        if (ds.types[a] == AttrType::Numeric) {
+            try {
+                v.num = std::stod(v.raw);
+            } catch (...) {
+                v.missing = true;
+            }
+            continue;
+        }
+        auto it = snap.codes[a].find(v.raw);
+        v.code = it == snap.codes[a].end() ? -1 : it->second;
+    }
+    return true;
+}
+
+bool SplitTrainingRow(const Dataset& ds,
+                      const std::string& line,
+                      const std::string& missingToken,
+                      Instance& inst,
+                      std::string& err) {
+    const std::vector<std::string> tokens = SplitRow(line);
+    if (tokens.size() != ds.types.size() + 1) {
+        err = "Row has " + std::to_string(tokens.size()) + " values, expected " +
+              std::to_string(ds.types.size() + 1) + " (attributes and the decision).";
+        return false;
+    }
+    inst = Instance();
+    inst.attrs.resize(ds.types.size());
+    for (size_t a = 0; a < ds.types.size(); ++a) {
+        auto& v = inst.attrs[a];
+        v.raw = Trim(tokens[a]);
+        v.missing = v.raw.empty() || v.raw == missingToken || v.raw == "?";
+    }
+    inst.decision = Trim(tokens.back());
+    if (inst.decision.empty() || inst.decision == missingToken || inst.decision == "?") {
+        err = "Row has no decision.";
+        return false;
+    }
+    return true;
+}
+
+bool SnapshotStore::PublishNext(std::shared_ptr<ModelSnapshot> next, uint64_t expected) {
+    std::lock_guard<std::mutex> lock(publishMutex);
+    const auto now = Current();
+    const uint64_t version = now ? now->version : 0;
+    if (expected != 0 && version != expected) {
+        return false;
+    }
+    next->version = version + 1;
+    std::atomic_store(&current, std::shared_ptr<const ModelSnapshot>(std::move(next)));
+    return true;
+}
+
+SnapshotReloader::SnapshotReloader(SnapshotStore& store, BuildFn build, DoneFn done)
+    : store(store), build(std::move(build)), done(std::move(done)) {
+    worker = std::thread([this] { Run(); });
+}
+
+SnapshotReloader::~SnapshotReloader() {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        stopping = true;
+    }
+    wake.notify_one();
+    worker.join();
+}
+
+void SnapshotReloader::Request(const std::string& path) {
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        pending = path;
+        hasPending = true;
+    }
+    wake.notify_one();
+}
+
+void SnapshotReloader::Run() {
+    for (;;) {
+        std::string path;
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            wake.wait(lock, [this] { return hasPending || stopping; });
+            if (!hasPending) {
+                return;
+            }
+            path = std::move(pending);
+            hasPending = false;
+        }
+
+        // Readers keep using the current snapshot while the next one is built.
+        auto next = std::make_shared<ModelSnapshot>();
+        std::string err;
+        if (build(path, *next, err)) {
+            store.PublishNext(std::move(next));
+        } else if (err.empty()) {
+            err = "Cannot build a model from " + path + ".";
+        }
+        if (done) {
+            done(path, err);
+        }
+    }
+}
\ No newline at end of file
@@ -0,0 +1,152 @@
+#include "trace.h"
+
+#include <atomic>
+#include <fstream>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+namespace {
+
+struct TraceEvent {
+    const char* name;
+    double tsUs;
+    double durUs;
+    int experiment;
+    int row;
+};
+
+struct ThreadBuffer {
+    int tid = 0;
+    std::vector<TraceEvent> events;
+};
+
+std::atomic<bool> gEnabled(false);
+std::chrono::steady_clock::time_point gOrigin = std::chrono::steady_clock::now();
+
+// Registry of per-thread buffers and experiment labels; touched once per
+// thread and once per experiment, never per event.
+std::mutex gRegistryMutex;
+std::vector<std::unique_ptr<ThreadBuffer>> gBuffers;
+std::vector<std::string> gExperiments;
+
+thread_local ThreadBuffer* tBuffer = nullptr;
+thread_local int tRow = -1;
+thread_local int tExperiment = -1;
+
+ThreadBuffer& LocalBuffer() {
+    if (!tBuffer) {
+        std::lock_guard<std::mutex> lock(gRegistryMutex);
+        gBuffers.push_back(std::make_unique<ThreadBuffer>());
+        tBuffer = gBuffers.back().get();
+        tBuffer->tid = static_cast<int>(gBuffers.size());
+    }
+    return *tBuffer;
+}
+
+double MicrosSinceOrigin(std::chrono::steady_clock::time_point t) {
+    return std::chrono::duration<double, std::micro>(t - gOrigin).count();
+}
+
+void WriteJsonString(std::ostream& out, const std::string& s) {
+    out << '"';
+    for (char ch : s) {
+        if (ch == '"' || ch == '\\') {
+            out << '\\' << ch;
+        } else if (static_cast<unsigned char>(ch) < 0x20) {
+            out << ' ';
+        } else {
+            out << ch;
+        }
+    }
+    out << '"';
+}
+
+} // namespace
+
+void TraceEnable() {
+    gOrigin = std::chrono::steady_clock::now();
+    gEnabled = true;
+}
+
+bool TraceEnabled() {
+    return gEnabled.load(std::memory_order_relaxed);
+}
+
+int TraceSetExperiment(const std::string& dataset, const std::string& algo, const std::string& mode, int k) {
+    if (!TraceEnabled()) {
+        return -1;
+    }
+    std::ostringstream label;
+    label << "{\"dataset\":";
+    WriteJsonString(label, dataset);
+    label << ",\"algo\":\"" << algo << "\",\"mode\":\"" << mode << "\",\"k\":" << k;
+    std::lock_guard<std::mutex> lock(gRegistryMutex);
+    gExperiments.push_back(label.str());
+    tExperiment = static_cast<int>(gExperiments.size()) - 1;
+    return tExperiment;
+}
+
+void TraceUseExperiment(int id) {
+    tExperiment = id;
+}
+
+TraceSpan::TraceSpan(const char* name, int row)
+    : name(name), row(row), prevRow(-1), active(TraceEnabled()) {
+    if (!active) {
+        return;
+    }
+    prevRow = tRow;
+    if (row >= 0) {
+        tRow = row;
+    } else {
+        this->row = tRow;
+    }
+    start = std::chrono::steady_clock::now();
+}
+
+TraceSpan::~TraceSpan() {
+    if (!active) {
+        return;
+    }
+    auto end = std::chrono::steady_clock::now();
+    double ts = MicrosSinceOrigin(start);
+    LocalBuffer().events.push_back({name, ts, MicrosSinceOrigin(end) - ts,
+                                    tExperiment, row});
+    tRow = prevRow;
+}
+
+bool WriteTrace(const std::string& path, std::string& err) {
+    std::ofstream out(path);
+    if (!out) {
+        err = "Cannot write trace file: " + path;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(gRegistryMutex);
+    out << std::fixed << std::setprecision(3);
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    for (const auto& buf : gBuffers) {
+        out << (first ? "" : ",\n")
+            << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buf->tid
+            << ",\"args\":{\"name\":\"" << (buf->tid == 1 ? "main" : "worker") << " " << buf->tid << "\"}}";
+        first = false;
+        for (const auto& ev : buf->events) {
+            out << ",\n{\"name\":";
+            WriteJsonString(out, ev.name);
+            out << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << buf->tid
+                << ",\"ts\":" << ev.tsUs << ",\"dur\":" << ev.durUs << ",\"args\":";
+            if (ev.experiment >= 0) {
+                out << gExperiments[ev.experiment];
+                out << (ev.row >= 0 ? ",\"row\":" + std::to_string(ev.row + 1) : std::string()) << "}";
+            } else {
+                out << (ev.row >= 0 ? "{\"row\":" + std::to_string(ev.row + 1) + "}" : std::string("{}"));
+            }
+            out << "}";
+        }
+    }
+    out << "\n]}\n";
+    return true;
+}
\ No newline at end of file
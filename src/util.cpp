@@ -1,6 +1,9 @@
 #include "util.h"
 
+#include <algorithm>
 #include <cctype>
+#include <cmath>
+#include <limits>
 #include <sstream>
 
 std::string Trim(const std::string& s) {
@@ -81,4 +84,67 @@ std::vector<std::string> SplitCsvLike(const std::string& line) {
     }
     tokens.push_back(Trim(cur));
     return tokens;
+}
+
+uint64_t Mix64(uint64_t x) {
+    x += 0x9E3779B97F4A7C15ull;
+    x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ull;
+    x = (x ^ (x >> 27)) * 0x94D049BB133111EBull;
+    return x ^ (x >> 31);
+}
+
+bool ParseByteSize(const std::string& text, uint64_t& bytes) {
+    std::string t = Trim(text);
+    if (t.empty()) {
+        return false;
+    }
+    uint64_t scale = 1;
+    const char unit = static_cast<char>(std::toupper(static_cast<unsigned char>(t.back())));
+    if (unit == 'K' || unit == 'M' || unit == 'G' || unit == 'T') {
+        scale = unit == 'K' ? (1ull << 10) : unit == 'M' ? (1ull << 20) : unit == 'G' ? (1ull << 30) : (1ull << 40);
+        t.pop_back();
+    }
+    try {
+        size_t used = 0;
+        const double value = std::stod(t, &used);
+        if (used != t.size() || value <= 0.0) {
+            return false;
+        }
+        bytes = static_cast<uint64_t>(value * (double)scale);
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+bool ParseCount(const std::string& text, size_t& count) {
+    const std::string t = Trim(text);
+    if (t.empty() || !std::all_of(t.begin(), t.end(), [](unsigned char ch) { return std::isdigit(ch) != 0; })) {
+        return false;
+    }
+    try {
+        const unsigned long long value = std::stoull(t);
+        if (value > std::numeric_limits<size_t>::max()) {
+            return false;
+        }
+        count = static_cast<size_t>(value);
+    } catch (...) {
+        return false;
+    }
+    return true;
+}
+
+bool ParseNonNegative(const std::string& text, double& value) {
+    const std::string t = Trim(text);
+    try {
+        size_t used = 0;
+        const double parsed = std::stod(t, &used);
+        if (used != t.size() || !std::isfinite(parsed) || parsed < 0.0) {
+            return false;
+        }
+        value = parsed;
+    } catch (...) {
+        return false;
+    }
+    return true;
 }
\ No newline at end of file
@@ -0,0 +1,17 @@
+#include "worker_slots.h"
+
+#include <algorithm>
+
+WorkerSlots::WorkerSlots(int idle) : idle(std::max(0, idle)) {}
+
+int WorkerSlots::TryAcquire(int wanted) {
+    std::lock_guard<std::mutex> lock(mutex);
+    int got = std::max(0, std::min(wanted, idle));
+    idle -= got;
+    return got;
+}
+
+void WorkerSlots::Release(int count) {
+    std::lock_guard<std::mutex> lock(mutex);
+    idle += std::max(0, count);
+}
\ No newline at end of file
@@ -0,0 +1,288 @@
+#include "zone_map.h"
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <numeric>
+
+// Numeric attributes interleaved into the curve key (more would leave too few
+// bits per attribute to matter).
+static constexpr size_t kCurveDims = 16;
+
+void BuildZoneMaps(Dataset& ds) {
+    ZoneMaps& z = ds.zones;
+    z = ZoneMaps();
+    const size_t n = ds.rows.size();
+    const size_t nn = ds.numericIdx.size();
+    const size_t nm = ds.nominalIdx.size();
+    if (n == 0 || ds.kernelRows != n) {
+        return;
+    }
+
+    z.slotOf.assign(ds.types.size(), -1);
+    for (size_t s = 0; s < nn; ++s) {
+        z.slotOf[ds.numericIdx[s]] = (int)s;
+    }
+    for (size_t s = 0; s < nm; ++s) {
+        z.slotOf[ds.nominalIdx[s]] = (int)s;
+    }
+    z.classOf.resize(n);
+    for (size_t r = 0; r < n; ++r) {
+        z.classOf[r] = ds.decisionIndex.at(ds.rows[r].decision);
+    }
+
+    // Z-order key over the first numeric slots, each scaled to [0, 1] by its
+    // dataset range; missing values sort as the minimum.
+    const size_t dims = std::min(nn, kCurveDims);
+    const int bits = dims == 0 ? 0 : (int)std::min<size_t>(32, 64 / dims);
+    std::vector<double> lo(dims, std::numeric_limits<double>::infinity());
+    std::vector<double> hi(dims, -std::numeric_limits<double>::infinity());
+    for (size_t r = 0; r < n; ++r) {
+        for (size_t s = 0; s < dims; ++s) {
+            const double v = ds.kernelNum[r * nn + s];
+            if (!std::isnan(v)) {
+                lo[s] = std::min(lo[s], v);
+                hi[s] = std::max(hi[s], v);
+            }
+        }
+    }
+    const double levels = bits == 0 ? 0.0 : std::ldexp(1.0, bits) - 1.0;
+    std::vector<uint64_t> key(n, 0);
+    std::vector<uint64_t> q(dims);
+    for (size_t r = 0; r < n; ++r) {
+        for (size_t s = 0; s < dims; ++s) {
+            const double v = ds.kernelNum[r * nn + s];
+            const double range = hi[s] - lo[s];
+            q[s] = (std::isnan(v) || !(range > 0.0)) ? 0 : (uint64_t)((v - lo[s]) / range * levels);
+        }
+        uint64_t k = 0;
+        for (int b = bits - 1; b >= 0; --b) {
+            for (size_t s = 0; s < dims; ++s) {
+                k = (k << 1) | ((q[s] >> b) & 1);
+            }
+        }
+        key[r] = k;
+    }
+
+    // Equal keys group by nominal codes, then by class, so blocks of
+    // duplicates tend to be pure and their class masks narrow.
+    z.order.resize(n);
+    std::iota(z.order.begin(), z.order.end(), 0);
+    std::sort(z.order.begin(), z.order.end(), [&](int a, int b) {
+        if (key[a] != key[b]) return key[a] < key[b];
+        const int* ca = ds.kernelNom.data() + (size_t)a * nm;
+        const int* cb = ds.kernelNom.data() + (size_t)b * nm;
+        for (size_t s = 0; s < nm; ++s) {
+            if (ca[s] != cb[s]) return ca[s] < cb[s];
+        }
+        if (z.classOf[a] != z.classOf[b]) return z.classOf[a] < z.classOf[b];
+        return a < b;
+    });
+
+    const size_t blocks = z.Blocks();
+    const double nan = std::numeric_limits<double>::quiet_NaN();
+    z.numMin.assign(blocks * nn, nan);
+    z.numMax.assign(blocks * nn, nan);
+    z.numMissing.assign(blocks * nn, 0);
+    z.nomMask.assign(blocks * nm, 0);
+    z.nomMissing.assign(blocks * nm, 0);
+    z.classMask.assign(blocks, 0);
+    const bool classBits = ds.decisionValues.size() <= 64;
+    for (size_t p = 0; p < n; ++p) {
+        const size_t b = p / ZoneMaps::kBlockRows;
+        const size_t r = (size_t)z.order[p];
+        for (size_t s = 0; s < nn; ++s) {
+            const double v = ds.kernelNum[r * nn + s];
+            const size_t i = b * nn + s;
+            if (std::isnan(v)) {
+                z.numMissing[i] = 1;
+            } else if (std::isnan(z.numMin[i])) {
+                z.numMin[i] = z.numMax[i] = v;
+            } else {
+                z.numMin[i] = std::min(z.numMin[i], v);
+                z.numMax[i] = std::max(z.numMax[i], v);
+            }
+        }
+        for (size_t s = 0; s < nm; ++s) {
+            const int c = ds.kernelNom[r * nm + s];
+            const size_t i = b * nm + s;
+            if (c == 0) {
+                z.nomMissing[i] = 1;
+            } else {
+                z.nomMask[i] |= 1ull << ((c - 1) & 63);
+            }
+        }
+        z.classMask[b] |= classBits ? 1ull << z.classOf[r] : ~0ull;
+    }
+}
+
+std::vector<int> BlocksByBound(const Dataset& ds, const DistanceKernel& kernel, size_t x, std::vector<double>& bounds) {
+    const ZoneMaps& z = ds.zones;
+    const size_t nn = ds.numericIdx.size();
+    const size_t nm = ds.nominalIdx.size();
+    const double* numX = ds.kernelNum.data() + x * nn;
+    const int* nomX = ds.kernelNom.data() + x * nm;
+    const double inf = std::numeric_limits<double>::infinity();
+
+    // Per nominal slot: the smallest term from x's value to another value.
+    // On-demand slots and missing values bound the term by 0 and the missing
+    // distance respectively.
+    std::vector<double> otherMin(nm, 0.0);
+    for (size_t s = 0; s < nm; ++s) {
+        if (kernel.nomOnDemand[s] || nomX[s] == 0) {
+            continue;
+        }
+        const size_t width = kernel.nomWidth[s];
+        const double* row = kernel.nomTable[s].data() + (size_t)nomX[s] * width;
+        double m = inf;
+        for (size_t c = 1; c < width; ++c) {
+            if ((int)c != nomX[s]) {
+                m = std::min(m, row[c]);
+            }
+        }
+        otherMin[s] = m == inf ? 0.0 : m;
+    }
+
+    // Terms are added in attribute order like the kernels add them, so each
+    // partial sum stays below the kernel's under round-to-nearest.
+    const size_t blocks = z.Blocks();
+    bounds.assign(blocks, 0.0);
+    for (size_t b = 0; b < blocks; ++b) {
+        double sum = 0.0;
+        size_t numSlot = 0;
+        size_t nomSlot = 0;
+        for (const auto& run : kernel.runs) {
+            for (size_t r = 0; r < run.second; ++r) {
+                double term = inf;
+                if (run.first) {
+                    const size_t s = nomSlot++;
+                    const size_t i = b * nm + s;
+                    if (z.nomMissing[i]) {
+                        term = kernel.missingNominal;
+                    }
+                    if (z.nomMask[i]) {
+                        double present = 0.0;
+                        if (nomX[s] == 0) {
+                            present = kernel.missingNominal;
+                        } else if (!kernel.nomOnDemand[s] && !((z.nomMask[i] >> ((nomX[s] - 1) & 63)) & 1)) {
+                            present = otherMin[s];
+                        }
+                        term = std::min(term, present);
+                    }
+                } else {
+                    const size_t s = numSlot++;
+                    const size_t i = b * nn + s;
+                    if (z.numMissing[i]) {
+                        term = kernel.missingNumeric;
+                    }
+                    if (!std::isnan(z.numMin[i])) {
+                        double present = 0.0;
+                        const double v = numX[s];
+                        if (std::isnan(v)) {
+                            present = kernel.missingNumeric;
+                        } else if (kernel.ivdm.empty() && kernel.range[s] != 0.0) {
+                            const double gap = v < z.numMin[i] ? z.numMin[i] - v : v > z.numMax[i] ? v - z.numMax[i] : 0.0;
+                            present = gap / kernel.range[s];
+                        }
+                        term = std::min(term, present);
+                    }
+                }
+                sum += term == inf ? 0.0 : term;
+            }
+        }
+        bounds[b] = sum;
+    }
+
+    std::vector<int> order(blocks);
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) { return bounds[a] < bounds[b]; });
+    return order;
+}
+
+std::vector<Neighbor> ZoneNeighbors(const Dataset& ds,
+                                    const DistanceKernel& kernel,
+                                    size_t x,
+                                    const std::vector<int>& candidates,
+                                    int k) {
+    const ZoneMaps& z = ds.zones;
+    std::vector<char> isCandidate(ds.rows.size(), 0);
+    for (int idx : candidates) {
+        isCandidate[idx] = 1;
+    }
+    std::vector<double> bounds;
+    const std::vector<int> blocks = BlocksByBound(ds, kernel, x, bounds);
+
+    // Max-heap of the best k under (dist, index): its front is the k-th place.
+    auto before = [](const Neighbor& a, const Neighbor& b) {
+        if (a.dist != b.dist) return a.dist < b.dist;
+        return a.index < b.index;
+    };
+    std::vector<Neighbor> best;
+    best.reserve((size_t)k);
+    std::vector<int> rows;
+    rows.reserve(ZoneMaps::kBlockRows);
+    std::vector<double> dist(ZoneMaps::kBlockRows);
+    for (int b : blocks) {
+        if ((int)best.size() == k && bounds[b] > best.front().dist) {
+            break;
+        }
+        rows.clear();
+        const size_t end = std::min(z.order.size(), ((size_t)b + 1) * ZoneMaps::kBlockRows);
+        for (size_t p = (size_t)b * ZoneMaps::kBlockRows; p < end; ++p) {
+            if (isCandidate[z.order[p]]) {
+                rows.push_back(z.order[p]);
+            }
+        }
+        if (rows.empty()) {
+            continue;
+        }
+        kernel.batch(ds, kernel, x, rows.data(), rows.size(), dist.data());
+        for (size_t i = 0; i < rows.size(); ++i) {
+            Neighbor nb;
+            nb.index = rows[i];
+            nb.dist = dist[i];
+            if ((int)best.size() < k) {
+                best.push_back(nb);
+                std::push_heap(best.begin(), best.end(), before);
+            } else if (before(nb, best.front())) {
+                std::pop_heap(best.begin(), best.end(), before);
+                best.back() = nb;
+                std::push_heap(best.begin(), best.end(), before);
+            }
+        }
+    }
+    std::sort_heap(best.begin(), best.end(), before);
+    return best;
+}
+
+std::vector<uint64_t> FoldAccepted(const CompiledGRule& rule) {
+    std::vector<uint64_t> folded(rule.terms.size(), 0);
+    for (size_t t = 0; t < rule.terms.size(); ++t) {
+        for (uint64_t word : rule.terms[t].accepted) {
+            folded[t] |= word;
+        }
+    }
+    return folded;
+}
+
+bool BlockMayMatch(const Dataset& ds, size_t block, const CompiledGRule& rule, const std::vector<uint64_t>& folded) {
+    const ZoneMaps& z = ds.zones;
+    const size_t nn = ds.numericIdx.size();
+    const size_t nm = ds.nominalIdx.size();
+    for (size_t t = 0; t < rule.terms.size(); ++t) {
+        const auto& term = rule.terms[t];
+        const size_t s = (size_t)z.slotOf[term.attr];
+        if (term.nominal) {
+            const size_t i = block * nm + s;
+            if (!z.nomMissing[i] && !(z.nomMask[i] & folded[t])) {
+                return false;
+            }
+        } else {
+            const size_t i = block * nn + s;
+            if (!z.numMissing[i] && (z.numMax[i] < term.lo || z.numMin[i] > term.hi)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
\ No newline at end of file